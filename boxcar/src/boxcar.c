@@ -129,3 +129,719 @@ data_t do_boxcar(
   
   return EXIT_SUCCESS;
 }
+
+// Block sums of a packed pixel in raw units of sum_t, sum b goes to sum[b*stride]
+static void history_unpack(
+                           const uint8_t *pixel,
+                           int16_t *sum,
+                           int stride){
+  int b;
+  int lsb;
+  int width;
+  uint64_t low;
+  uint64_t high;
+  uint64_t field;
+
+  memcpy(&low, pixel, sizeof(uint64_t));
+  high = pixel[8] | (pixel[9]<<8);
+  for(b = 0; b < NHISTORY; b++){
+    lsb   = HISTORY_LSB(b);
+    width = HISTORY_BITS(b);
+    field = (low >> lsb) | (lsb + width > 64 ? high << (64 - lsb) : 0);
+    field = (field & ((1<<width) - 1)) ^ (1<<(width - 1));
+    sum[b*stride] = (int16_t)(((int)field - (1<<(width - 1)))*(1<<HISTORY_SHIFT));
+  }
+}
+
+// Packs the block sums of a pixel, the sums are exact so that no bit of them is lost
+static void history_pack(
+                         const int16_t *sum,
+                         int stride,
+                         uint8_t *pixel){
+  int b;
+  int lsb;
+  int width;
+  uint64_t low = 0;
+  uint64_t high = 0;
+  uint64_t field;
+
+  for(b = 0; b < NHISTORY; b++){
+    lsb   = HISTORY_LSB(b);
+    width = HISTORY_BITS(b);
+    field = (uint64_t)(sum[b*stride] >> HISTORY_SHIFT) & ((1<<width) - 1);
+    low  |= field << lsb;
+    high |= lsb + width > 64 ? field >> (64 - lsb) : 0;
+  }
+  memcpy(pixel, &low, sizeof(uint64_t));
+  pixel[8] = high & 0xff;
+  pixel[9] = (high >> 8) & 0xff;
+}
+
+// Same search as knl_boxcar, history is [dm][pixel] of HISTORY_PIXEL_BYTES, the input [dm][time][pixel] and the inverse RMS [dm][pixel]
+// Image j is image time_offset+j of the search, width 2^l is searched when a block of 2^(l-1) images ends there and bit l of width_mask is set
+// The best sum of a pixel scaled by 1/sqrt(width) is a candidate if its S/N is above threshold, the widest boxcar wins a tie
+int boxcar_cand(
+                const data_t *in,
+                const uint8_t *previous_history,
+                uint8_t *current_history,
+                const rms_t *inv_rms,
+                int ndm,
+                int ntime,
+                int time_offset,
+                int width_mask,
+                snr_t threshold,
+                cand_t *cand,
+                uint64_t *ncand){
+  int i;
+  int j;
+  int b;
+  int k;
+  int m;
+  int t;
+  int width;
+  bool search[NLEVEL];
+  bool complete;
+  sum_t boxcar[NLEVEL];
+  sum_t history[NHISTORY];
+  sum_t partial;
+  int16_t raw[NHISTORY];
+  scaled_t scaled;
+  scaled_t max_scaled;
+  snr_t snr;
+  const data_t *pin;
+  const coef_t inv_sqrt_width[NLEVEL] = INV_SQRT_WIDTH;
+  size_t loc_history;
+  
+  *ncand = 0;
+  for(i = 0; i < ndm; i++){
+    for(m = 0; m < NSAMP_PER_IMG; m++){
+      loc_history = ((size_t)i*NSAMP_PER_IMG + m)*HISTORY_PIXEL_BYTES;
+      history_unpack(&previous_history[loc_history], raw, 1);
+      for(k = 0; k < NHISTORY; k++){
+        history[k].range(SUM_WIDTH - 1, 0) = raw[k];
+      }
+      pin = &in[(size_t)i*ntime*NSAMP_PER_IMG + m];
+      for(j = 0; j < ntime; j++){
+        // Block b of the tree ends at this image if the image count is a multiple of 2^b
+        // The current block of 2^(b+1) images is the one of 2^b images, plus the last complete one if bit b of the count is set
+        t = time_offset + j;
+        boxcar[0] = pin[(size_t)j*NSAMP_PER_IMG];
+        search[0] = width_mask & 1;
+        partial   = boxcar[0];
+        for(b = 0; b < NLEVEL-1; b++){
+          complete    = ((t + 1) & ((1<<b) - 1)) == 0;
+          boxcar[b+1] = history[b] + partial;
+          search[b+1] = complete && ((width_mask>>(b+1)) & 1);
+          if(complete){
+            history[b] = partial;
+          }
+          if((t>>b) & 1){
+            partial = boxcar[b+1];
+          }
+        }
+        
+        max_scaled = 0;
+        width      = 1;
+        for(k = NLEVEL-1; k >= 0; k--){
+          scaled = boxcar[k]*inv_sqrt_width[k];
+          if(search[k] && scaled > max_scaled){
+            max_scaled = scaled;
+            width      = 1<<k;
+          }
+        }
+        snr = max_scaled*inv_rms[(size_t)i*NSAMP_PER_IMG + m];
+        
+        if(snr > threshold){
+          cand[*ncand] = cand_encode(snr, i, j, m, width);
+          (*ncand)++;
+        }
+      }
+      for(k = 0; k < NHISTORY; k++){
+        raw[k] = history[k].range(SUM_WIDTH - 1, 0).to_int();
+      }
+      history_pack(raw, 1, &current_history[loc_history]);
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Fixed point of boxcar_cand on raw integers, buffers go to the device as they are so a data_t is its raw bits
+// A sum is in units of sum_t, a scaled sum in units of boxcar and 1/sqrt(width) together, both exact
+#define SHIFT_SNR   ((SUM_WIDTH - SUM_INTEGER_WIDTH) + (COEF_WIDTH - 1) + (RMS_WIDTH - RMS_INTEGER_WIDTH) - (SNR_WIDTH - SNR_INTEGER_WIDTH))
+#define MSNR        ((1<<(SNR_WIDTH-1)) - 1)
+#define SPLIT_SNR   16       // A scaled sum is taken in two parts, so that its product with an inverse RMS fits in 32 bits
+
+// NSAMP_PER_TASK pixels of DM dm from pixel first, images are read a row at a time in time order
+// Each step works on all pixels of the task, so that the compiler vectorises it over pixels
+static uint64_t search_task(
+                            const int8_t *in,
+                            const uint8_t *previous_history,
+                            uint8_t *current_history,
+                            const uint16_t *inv_rms,
+                            int dm,
+                            int first,
+                            int ntime,
+                            int time_offset,
+                            int width_mask,
+                            const int32_t *coef,
+                            int threshold,
+                            cand_t *cand){
+  int16_t history[NHISTORY][NSAMP_PER_TASK];
+  int16_t boxcar[NLEVEL][NSAMP_PER_TASK];
+  int16_t partial[NSAMP_PER_TASK];
+  int32_t max_scaled[NSAMP_PER_TASK];
+  int32_t level[NSAMP_PER_TASK];
+  int32_t snr[NSAMP_PER_TASK];
+  int searched[NLEVEL];
+  int nsearched;
+  int scaled;
+  uint32_t value;
+  uint32_t rms;
+  int above;
+  int c;
+  const int8_t *row;
+  const int16_t *sum;
+  bool complete;
+  bool set;
+  snr_t snr_value;
+  uint64_t n = 0;
+  int t;
+  int j;
+  int b;
+  int k;
+  int p;
+  
+  for(p = 0; p < NSAMP_PER_TASK; p++){
+    history_unpack(&previous_history[((size_t)dm*NSAMP_PER_IMG + first + p)*HISTORY_PIXEL_BYTES], &history[0][p], NSAMP_PER_TASK);
+  }
+  
+  for(j = 0; j < ntime; j++){
+    row = &in[((size_t)dm*ntime + j)*NSAMP_PER_IMG + first];
+    
+    // Block 0 of the tree ends at every image, the current block of 2 images has this one and the one before if bit 0 is set
+    t   = time_offset + j;
+    set = t & 1;
+    nsearched = 0;
+    if(width_mask & 1){
+      searched[nsearched++] = 0;
+    }
+    if(width_mask & 2){
+      searched[nsearched++] = 1;
+    }
+#pragma omp simd
+    for(p = 0; p < NSAMP_PER_TASK; p++){
+      boxcar[0][p]  = row[p]*(1<<HISTORY_SHIFT);
+      boxcar[1][p]  = history[0][p] + boxcar[0][p];
+      partial[p]    = set ? boxcar[1][p] : boxcar[0][p];
+      history[0][p] = boxcar[0][p];
+    }
+    for(b = 1; b < NLEVEL-1; b++){
+      complete = ((t + 1) & ((1<<b) - 1)) == 0;
+      set      = (t>>b) & 1;
+      if(complete && ((width_mask>>(b+1)) & 1)){
+        searched[nsearched++] = b+1;
+      }
+#pragma omp simd
+      for(p = 0; p < NSAMP_PER_TASK; p++){
+        boxcar[b+1][p] = history[b][p] + partial[p];
+        history[b][p]  = complete ? partial[p] : history[b][p];
+        partial[p]     = set ? boxcar[b+1][p] : partial[p];
+      }
+    }
+    
+    // The widest boxcar wins a tie, as in boxcar_cand
+#pragma omp simd
+    for(p = 0; p < NSAMP_PER_TASK; p++){
+      max_scaled[p] = 0;
+      level[p]      = 0;
+    }
+    for(k = nsearched - 1; k >= 0; k--){
+      sum = boxcar[searched[k]];
+      b   = searched[k];
+      c   = coef[b];
+#pragma omp simd private(scaled)
+      for(p = 0; p < NSAMP_PER_TASK; p++){
+        scaled        = sum[p]*c;
+        level[p]      = scaled > max_scaled[p] ? b : level[p];
+        max_scaled[p] = scaled > max_scaled[p] ? scaled : max_scaled[p];
+      }
+    }
+    
+    // S/N is floor(max_scaled*rms/2^SHIFT_SNR), max_scaled is not negative
+    above = 0;
+#pragma omp simd private(rms, value) reduction(|:above)
+    for(p = 0; p < NSAMP_PER_TASK; p++){
+      rms    = inv_rms[(size_t)dm*NSAMP_PER_IMG + first + p];
+      value  = (uint32_t)(max_scaled[p] >> SPLIT_SNR)*rms + (((uint32_t)(max_scaled[p] & ((1<<SPLIT_SNR) - 1))*rms) >> SPLIT_SNR);
+      value  = value >> (SHIFT_SNR - SPLIT_SNR);
+      snr[p] = value > MSNR ? MSNR : value;
+      above |= snr[p] > threshold;
+    }
+    
+    for(p = 0; above && p < NSAMP_PER_TASK; p++){
+      if(snr[p] > threshold){
+        snr_value = (double)snr[p]/(1<<(SNR_WIDTH - SNR_INTEGER_WIDTH));
+        cand[n] = cand_encode(snr_value, dm, j, first + p, 1<<level[p]);
+        n++;
+      }
+    }
+  }
+  
+  for(p = 0; p < NSAMP_PER_TASK; p++){
+    history_pack(&history[0][p], NSAMP_PER_TASK, &current_history[((size_t)dm*NSAMP_PER_IMG + first + p)*HISTORY_PIXEL_BYTES]);
+  }
+  
+  return n;
+}
+
+// Same candidates and history as boxcar_cand, what a host checks the kernel with or searches with when it has no kernel
+// Images are read once in time order instead of once per pixel, tasks are spread over threads
+// A task writes candidates to its own part of cand, the parts are packed in task order at the end, so DM then pixel block
+int boxcar_cand_fast(
+                     const data_t *in,
+                     const uint8_t *previous_history,
+                     uint8_t *current_history,
+                     const rms_t *inv_rms,
+                     int ndm,
+                     int ntime,
+                     int time_offset,
+                     int width_mask,
+                     snr_t threshold,
+                     cand_t *cand,
+                     uint64_t *ncand){
+  int ntask = ndm*(NSAMP_PER_IMG/NSAMP_PER_TASK);
+  int task;
+  int k;
+  int32_t coef[NLEVEL];
+  int threshold_raw = (int)(threshold.to_double()*(1<<(SNR_WIDTH - SNR_INTEGER_WIDTH)));
+  uint64_t *ntask_cand = NULL;
+  size_t task_size = (size_t)ntime*NSAMP_PER_TASK;
+  const coef_t inv_sqrt_width[NLEVEL] = INV_SQRT_WIDTH;
+  
+  ntask_cand = (uint64_t *)malloc(ntask*sizeof(uint64_t));
+  if(ntask_cand == NULL){
+    return EXIT_FAILURE;
+  }
+  for(k = 0; k < NLEVEL; k++){
+    coef[k] = (int32_t)(inv_sqrt_width[k].to_double()*(1<<(COEF_WIDTH - 1)));
+  }
+  
+#pragma omp parallel for schedule(dynamic)
+  for(task = 0; task < ntask; task++){
+    ntask_cand[task] = search_task((const int8_t *)in, previous_history, current_history,
+                                   (const uint16_t *)inv_rms, task/(NSAMP_PER_IMG/NSAMP_PER_TASK),
+                                   task%(NSAMP_PER_IMG/NSAMP_PER_TASK)*NSAMP_PER_TASK, ntime, time_offset, width_mask,
+                                   coef, threshold_raw, &cand[task*task_size]);
+  }
+  
+  *ncand = 0;
+  for(task = 0; task < ntask; task++){
+    memmove(&cand[*ncand], &cand[task*task_size], ntask_cand[task]*sizeof(cand_t));
+    *ncand += ntask_cand[task];
+  }
+  
+  free(ntask_cand);
+  return EXIT_SUCCESS;
+}
+
+// Inverse RMS of each pixel of each DM over ntime images, what knl_boxcar takes to get S/N
+// A pixel without noise gets the largest inverse RMS of rms_t
+int boxcar_inv_rms(
+                   const data_t *in,
+                   int ndm,
+                   int ntime,
+                   rms_t *inv_rms){
+  int i;
+  int j;
+  int m;
+  double sum;
+  double sum2;
+  double var;
+  double x;
+  
+#pragma omp parallel for collapse(2) private(j, sum, sum2, var, x) schedule(static)
+  for(i = 0; i < ndm; i++){
+    for(m = 0; m < NSAMP_PER_IMG; m++){
+      sum  = 0;
+      sum2 = 0;
+      for(j = 0; j < ntime; j++){
+        x = in[((size_t)i*ntime + j)*NSAMP_PER_IMG + m].to_double();
+        sum  += x;
+        sum2 += x*x;
+      }
+      var = sum2/ntime - (sum/ntime)*(sum/ntime);
+      inv_rms[(size_t)i*NSAMP_PER_IMG + m] = (var > 0 && 1.0/sqrt(var) < MINV_RMS) ? 1.0/sqrt(var) : MINV_RMS;
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Pack a candidate the same way as knl_boxcar does
+cand_t cand_encode(
+                   snr_t value,
+                   int dm,
+                   int time,
+                   int pixel,
+                   int width){
+  cand_t cand = 0;
+  
+  cand.range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB) = value.range();
+  cand.range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) = width;
+  cand.range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB) = pixel;
+  cand.range(CAND_TIME_LSB  + CAND_TIME_BITS  - 1, CAND_TIME_LSB)  = time;
+  cand.range(CAND_DM_LSB    + CAND_DM_BITS    - 1, CAND_DM_LSB)    = dm;
+  
+  return cand;
+}
+
+int cand_decode(
+                const cand_t *cand,
+                uint64_t ncand,
+                cand_record *record){
+  uint64_t i;
+  snr_t value;
+  
+  for(i = 0; i < ncand; i++){
+    value.range() = cand[i].range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB);
+    record[i].value = value.to_float();
+    record[i].width = cand[i].range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB).to_int();
+    record[i].pixel = cand[i].range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB).to_int();
+    record[i].time  = cand[i].range(CAND_TIME_LSB  + CAND_TIME_BITS  - 1, CAND_TIME_LSB).to_int();
+    record[i].dm    = cand[i].range(CAND_DM_LSB    + CAND_DM_BITS    - 1, CAND_DM_LSB).to_int();
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// The kernel writes candidates in the order its lanes are polled, sort by (dm, time, pixel) before a comparison
+int cand_compare(
+                 const void *a,
+                 const void *b){
+  const cand_record *pa = (const cand_record *)a;
+  const cand_record *pb = (const cand_record *)b;
+  
+  if(pa->dm != pb->dm){
+    return pa->dm < pb->dm ? -1 : 1;
+  }
+  if(pa->time != pb->time){
+    return pa->time < pb->time ? -1 : 1;
+  }
+  return pa->pixel < pb->pixel ? -1 : (pa->pixel > pb->pixel);
+}
+
+static int compare_value(const void *a, const void *b){
+  snr_t va;
+  snr_t vb;
+  
+  va.range() = ((const cand_t *)a)->range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB);
+  vb.range() = ((const cand_t *)b)->range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB);
+  
+  return va > vb ? -1 : (va < vb);
+}
+
+static int compare_image(const void *a, const void *b){
+  const cand_t *pa = (const cand_t *)a;
+  const cand_t *pb = (const cand_t *)b;
+  int image_a = pa->range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_TIME_LSB).to_int();
+  int image_b = pb->range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_TIME_LSB).to_int();
+  int value_a = pa->range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB).to_int() ^ (NCAND_BIN/2);
+  int value_b = pb->range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB).to_int() ^ (NCAND_BIN/2);
+  int pixel_a = pa->range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB).to_int();
+  int pixel_b = pb->range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB).to_int();
+  
+  if(image_a != image_b){
+    return image_a < image_b ? -1 : 1;
+  }
+  if(value_a != value_b){
+    return value_a > value_b ? -1 : 1;
+  }
+  return pixel_a < pixel_b ? -1 : (pixel_a > pixel_b);
+}
+
+// What the top-K mode of knl_boxcar sends on, the best topk candidates of each (dm, time) image, all of them with topk 0
+// kept may be cand
+int cand_topk(
+              const cand_t *cand,
+              uint64_t ncand,
+              int topk,
+              cand_t *kept,
+              uint64_t *nkept){
+  uint64_t i;
+  int image;
+  int previous = -1;
+  int nimage = 0;
+  cand_t *sorted = NULL;
+  
+  if(topk == 0){
+    memmove(kept, cand, ncand*sizeof(cand_t));
+    *nkept = ncand;
+    return EXIT_SUCCESS;
+  }
+  
+  sorted = (cand_t *)malloc(ncand*sizeof(cand_t));
+  memcpy(sorted, cand, ncand*sizeof(cand_t));
+  qsort(sorted, ncand, sizeof(cand_t), compare_image);
+  
+  *nkept = 0;
+  for(i = 0; i < ncand; i++){
+    image    = sorted[i].range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_TIME_LSB).to_int();
+    nimage   = (image == previous) ? nimage + 1 : 1;
+    previous = image;
+    if(nimage <= topk){
+      kept[*nkept] = sorted[i];
+      (*nkept)++;
+    }
+  }
+  
+  free(sorted);
+  return EXIT_SUCCESS;
+}
+
+// What write_cand keeps out of all candidates of a launch, the ones with the highest values up to the capacity
+// Which of the candidates with the lowest kept value survive depends on the order they come in
+int cand_select(
+                const cand_t *cand,
+                uint64_t ncand,
+                int capacity,
+                cand_t *kept,
+                uint64_t *nkept,
+                uint64_t *ndrop){
+  uint64_t ncapacity = capacity < MCAND ? capacity : MCAND;
+  cand_t *sorted = NULL;
+  
+  sorted = (cand_t *)malloc(ncand*sizeof(cand_t));
+  memcpy(sorted, cand, ncand*sizeof(cand_t));
+  qsort(sorted, ncand, sizeof(cand_t), compare_value);
+  
+  *nkept = ncand < ncapacity ? ncand : ncapacity;
+  *ndrop = ncand - *nkept;
+  memcpy(kept, sorted, (*nkept)*sizeof(cand_t));
+  
+  free(sorted);
+  return EXIT_SUCCESS;
+}
+
+// What the host makes of the outputs of ncu CUs, each one has its header and room for nout records in all
+// CU j searched DMs from dm_offset[j] on, DMs of the merged candidates are counted from the first DM of the search
+// Candidates with the highest values are kept up to the capacity, as a single CU would, the rest is counted as dropped
+int cand_merge(
+               const cand_t *out,
+               int ncu,
+               uint64_t nout,
+               const int *dm_offset,
+               int capacity,
+               cand_t *merged){
+  int i;
+  uint64_t j;
+  uint64_t ncapacity = capacity < MCAND ? capacity : MCAND;
+  uint64_t ncand = 0;
+  uint64_t ndrop = 0;
+  uint64_t nkept;
+  uint64_t ncand_cu;
+  const cand_t *cu;
+  cand_t *cand = NULL;
+  
+  cand = (cand_t *)malloc(ncu*ncapacity*sizeof(cand_t));
+  if(cand == NULL){
+    return EXIT_FAILURE;
+  }
+  
+  for(i = 0; i < ncu; i++){
+    cu       = &out[i*nout];
+    ncand_cu = cu[0].to_uint64();
+    ndrop   += cu[1].to_uint64();
+    for(j = 0; j < ncand_cu; j++){
+      cand[ncand] = cu[CAND_HEADER + j];
+      cand[ncand].range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_DM_LSB) = cand[ncand].range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_DM_LSB) + dm_offset[i];
+      ncand++;
+    }
+  }
+  
+  if(ncand > ncapacity){
+    qsort(cand, ncand, sizeof(cand_t), compare_value);
+  }
+  nkept = ncand < ncapacity ? ncand : ncapacity;
+  memcpy(&merged[CAND_HEADER], cand, nkept*sizeof(cand_t));
+  merged[0] = nkept;
+  merged[1] = ndrop + ncand - nkept;
+  
+  free(cand);
+  return EXIT_SUCCESS;
+}
+
+static uint64_t above_value(cand_record *record, uint64_t nrecord, float value){
+  uint64_t i;
+  uint64_t n = 0;
+  
+  for(i = 0; i < nrecord; i++){
+    if(record[i].value > value){
+      record[n] = record[i];
+      n++;
+    }
+  }
+  qsort(record, n, sizeof(cand_record), cand_compare);
+  
+  return n;
+}
+
+// Number of records which differ between the CPU and the kernel, both record arrays are overwritten
+// Candidates with the lowest kept value may be any of them, only the number of them has to match
+uint64_t cand_mismatch(
+                       cand_record *sw_record,
+                       uint64_t nsw,
+                       cand_record *hw_record,
+                       uint64_t nhw){
+  uint64_t i;
+  uint64_t nabove_sw;
+  uint64_t nabove_hw;
+  uint64_t nmismatch;
+  float min_value = FLT_MAX;
+  
+  if(nsw != nhw){
+    return nsw > nhw ? nsw - nhw : nhw - nsw;
+  }
+  for(i = 0; i < nsw; i++){
+    min_value = sw_record[i].value < min_value ? sw_record[i].value : min_value;
+  }
+  nabove_sw = above_value(sw_record, nsw, min_value);
+  nabove_hw = above_value(hw_record, nhw, min_value);
+  if(nabove_sw != nabove_hw){
+    return nabove_sw > nabove_hw ? nabove_sw - nabove_hw : nabove_hw - nabove_sw;
+  }
+  
+  nmismatch = 0;
+  for(i = 0; i < nabove_sw; i++){
+    if(memcmp(&sw_record[i], &hw_record[i], sizeof(cand_record))){
+      nmismatch++;
+    }
+  }
+  
+  return nmismatch;
+}
+
+static int compare_raw(const void *a, const void *b){
+  uint64_t va = ((const cand_t *)a)->to_uint64();
+  uint64_t vb = ((const cand_t *)b)->to_uint64();
+  
+  return va < vb ? -1 : (va > vb);
+}
+
+// Number of candidates in one list and not in the other, for searches which have to give the same candidates in any order
+// Both lists are sorted in place
+uint64_t cand_difference(
+                         cand_t *a,
+                         uint64_t na,
+                         cand_t *b,
+                         uint64_t nb){
+  uint64_t i = 0;
+  uint64_t j = 0;
+  uint64_t ndifference = 0;
+  
+  qsort(a, na, sizeof(cand_t), compare_raw);
+  qsort(b, nb, sizeof(cand_t), compare_raw);
+  while(i < na && j < nb){
+    if(a[i] == b[j]){
+      i++;
+      j++;
+    }
+    else if(compare_raw(&a[i], &b[j]) < 0){
+      i++;
+      ndifference++;
+    }
+    else{
+      j++;
+      ndifference++;
+    }
+  }
+  
+  return ndifference + (na - i) + (nb - j);
+}
+
+// Counters of a launch without stalls
+// write_cand is polled, its active counter is one get per candidate plus the end marker of each lane
+// It writes the header and the kept candidates NCAND_PER_BURST to a burst, a record per cycle
+// History only moves to or from memory as history_mode asks
+// A step of calculate_cand lasts as long as the longest of its load, search and store, the candidates are written after the last one
+int boxcar_stats(
+                 int ndm,
+                 int ntime,
+                 int history_mode,
+                 uint64_t ncand,
+                 int capacity,
+                 stats_t *stats){
+  uint64_t nburst_history = (uint64_t)ndm*NBURST_HISTORY_PER_DM;
+  uint64_t nburst_load    = (history_mode & HISTORY_LOAD)  ? nburst_history : 0;
+  uint64_t nburst_store   = (history_mode & HISTORY_STORE) ? nburst_history : 0;
+  uint64_t nburst_rms     = (uint64_t)ndm*NBURST_RMS_PER_IMG;
+  uint64_t ncapacity      = capacity < MCAND ? capacity : MCAND;
+  uint64_t nrecord        = CAND_HEADER + (ncand < ncapacity ? ncand : ncapacity);
+  uint64_t nload;
+  uint64_t nsearch;
+  uint64_t nstore;
+  uint64_t ncycle = 0;
+  int step;
+  int i;
+  
+  memset(stats, 0x00, NSTATS*sizeof(stats_t));
+  
+  for(step = 0; step < ndm + 2; step++){
+    nload   = step < ndm ? NBURST_RMS_PER_IMG + ((history_mode & HISTORY_LOAD) ? NBURST_HISTORY_PER_DM : 0) : 0;
+    nsearch = (step >= 1 && step <= ndm) ? (uint64_t)ntime*NBURST_PER_IMG : 0;
+    nstore  = (step >= 2 && (history_mode & HISTORY_STORE)) ? NBURST_HISTORY_PER_DM : 0;
+    ncycle += nload > nsearch ? (nload > nstore ? nload : nstore) : (nsearch > nstore ? nsearch : nstore);
+  }
+  ncycle += nrecord;
+  for(i = 0; i < NSTATS; i++){
+    stats[i].cycle = ncycle;
+  }
+  
+  stats[STATS_READ_HISTORY].active   = nburst_load + nburst_rms;
+  stats[STATS_READ_HISTORY].burst    = nburst_load + nburst_rms;
+  stats[STATS_CALCULATE_CAND].active = (uint64_t)ndm*ntime*NBURST_PER_IMG;
+  stats[STATS_CALCULATE_CAND].burst  = (uint64_t)ndm*ntime*NBURST_PER_IMG;
+  stats[STATS_WRITE_HISTORY].active  = nburst_store;
+  stats[STATS_WRITE_HISTORY].burst   = nburst_store;
+  stats[STATS_WRITE_CAND].active     = ncand + NSAMP_PER_BURST;
+  stats[STATS_WRITE_CAND].burst      = (nrecord + NCAND_PER_BURST - 1)/NCAND_PER_BURST;
+  
+  return EXIT_SUCCESS;
+}
+
+// Sum counters of several launches
+int add_stats(
+              stats_t *total,
+              stats_t *stats,
+              int nstats){
+  int i;
+  
+  for(i = 0; i < nstats; i++){
+    total[i].active      += stats[i].active;
+    total[i].stall_empty += stats[i].stall_empty;
+    total[i].stall_full  += stats[i].stall_full;
+    total[i].burst       += stats[i].burst;
+    total[i].cycle       += stats[i].cycle;
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Utilisation is the fraction of the cycles of the launches in which a stage moves data
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "cycle", "utilisation");
+  for(i = 0; i < nstats; i++){
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst, stats[i].cycle,
+            stats[i].cycle ? 100.0*stats[i].active/stats[i].cycle : 0.0);
+  }
+  
+  return EXIT_SUCCESS;
+}
@@ -15,8 +15,9 @@
 #include <ap_int.h>
 #include <hls_stream.h>
 #include <inttypes.h>
+#include <float.h>
+#include <math.h>
 
-#define NBOXCAR             16
 #define FLOAT     1
 //#define DATA_WIDTH     32     // We use float 32-bits real numbers
 #define DATA_WIDTH     8       // We use ap_fixed 8-bits real numbers
@@ -25,9 +26,44 @@
 #define BURST_WIDTH     512
 #define NSAMP_PER_BURST (BURST_WIDTH/DATA_WIDTH)
 #define NBURST_PER_IMG  (NSAMP_PER_IMG/NSAMP_PER_BURST)
+#define MDM             1024     // Max number of DMs of a launch
+#define MTIME           256      // Max number of images of a DM in a launch
 
 #define INTEGER_WIDTH       (DATA_WIDTH/2)      // Integer width of data
 
+// Boxcar widths are powers of two, 1 to MWIDTH, the ones searched are picked at runtime
+// Width 2^l is searched at the end of each block of 2^(l-1) images, as the sum of that block and the one before
+// History of a pixel is the sum of the last complete block of 2^b images for each b
+// The current block of 2^b images so far is the sum of the last complete blocks below b whose bit is set in the image count
+#define NLEVEL              8                   // Number of widths at most, synthesis maximum
+#define MWIDTH              (1<<(NLEVEL-1))     // Widest boxcar
+#define NHISTORY            (NLEVEL-1)          // Block sums of a pixel in history
+
+// History is packed, the block sum of 2^b images takes DATA_WIDTH+b bits from bit HISTORY_LSB(b), in units of data_t
+// A row of NSAMP_PER_BURST pixels is NBURST_HISTORY_PER_ROW bursts, the same on chip and in memory
+#define HISTORY_LSB(b)          ((b)*DATA_WIDTH + (b)*((b) - 1)/2)
+#define HISTORY_BITS(b)         (DATA_WIDTH + (b))
+#define HISTORY_SHIFT           ((SUM_WIDTH - SUM_INTEGER_WIDTH) - (DATA_WIDTH - INTEGER_WIDTH)) // Bits of sum_t below data_t
+#define HISTORY_PIXEL_BITS      80       // HISTORY_LSB(NHISTORY) rounded up to a whole number of bursts per row
+#define HISTORY_PIXEL_BYTES     (HISTORY_PIXEL_BITS/8)
+#define NBURST_HISTORY_PER_ROW  (NSAMP_PER_BURST*HISTORY_PIXEL_BITS/BURST_WIDTH)
+#define NBURST_HISTORY_PER_DM   (NBURST_PER_IMG*NBURST_HISTORY_PER_ROW)
+
+// History stays on chip between launches for up to MDM_RESIDENT DMs, memory is only used when asked for
+// The first launch of a search has to load, the on-chip history is not initialised
+// A bank is the URAMs side by side for a row, a URAM is URAM_DEPTH rows of 72 bits, so 72 URAMs for NSLOT_PER_BANK DMs
+// NBANK banks take 216 URAMs per CU, 864 of the 960 of a U280 for NCU CUs
+#define URAM_DEPTH          4096
+#define NSLOT_PER_BANK      (URAM_DEPTH/NBURST_PER_IMG) // DMs of a bank, one after the other in depth
+#define NBANK               3        // Banks of history of a CU, one each to load, search and store
+#define MDM_RESIDENT        (NBANK*NSLOT_PER_BANK) // Max number of DMs with history on chip
+#define HISTORY_LOAD        1        // History of the launch before is read from memory
+#define HISTORY_STORE       2        // History of this launch is written to memory
+
+// DMs are split across CUs, each CU searches its own range of DMs with its own history and candidate buffers
+// CU n of knl_read streams to CU n of knl_boxcar, the link connects them
+#define NCU                 4        // CUs of knl_read and of knl_boxcar
+
 #if DATA_WIDTH == 32
 #define DATA_RANGE          4096
 #if FLOAT == 1
@@ -51,6 +87,33 @@ typedef ap_int<DATA_WIDTH> data_t; // The size of this should be DATA_WIDTH
 #define MEM_ALIGNMENT       4096  // memory alignment on device
 #define LINE_LENGTH         4096
 
+// Candidates are searched in S/N, the sum of a boxcar scaled by 1/sqrt(width) and by the inverse RMS of its pixel
+#define SNR_WIDTH           8
+#define SNR_INTEGER_WIDTH   6        // S/N up to 32 in steps of 1/4, stronger pulses saturate
+#define COEF_WIDTH          16
+typedef ap_fixed<SNR_WIDTH, SNR_INTEGER_WIDTH, AP_TRN, AP_SAT> snr_t;
+typedef ap_ufixed<COEF_WIDTH, 1> coef_t;                           // 1/sqrt(width)
+#define SUM_WIDTH           16
+#define SUM_INTEGER_WIDTH   (INTEGER_WIDTH+NLEVEL-1) // Sum of MWIDTH images, SUM_WIDTH has to be at least DATA_WIDTH+NLEVEL-1
+typedef ap_fixed<SUM_WIDTH, SUM_INTEGER_WIDTH> sum_t;              // Boxcar and block sums, exact
+typedef ap_fixed<SUM_WIDTH+COEF_WIDTH, SUM_INTEGER_WIDTH> scaled_t; // Boxcar sum times 1/sqrt(width), exact
+
+// Inverse RMS has its own wider type, a data_t step of 1/16 is a large error on the S/N of a noisy pixel
+// A row of NSAMP_PER_BURST pixels is NBURST_RMS_PER_ROW bursts
+#define RMS_WIDTH           16
+#define RMS_INTEGER_WIDTH   INTEGER_WIDTH
+typedef ap_ufixed<RMS_WIDTH, RMS_INTEGER_WIDTH> rms_t;             // Inverse RMS, up to 16 in steps of 1/4096
+#define MINV_RMS            ((1<<RMS_INTEGER_WIDTH) - 1.0/(1<<(RMS_WIDTH-RMS_INTEGER_WIDTH))) // Largest inverse RMS in rms_t
+#define NRMS_PER_BURST      (BURST_WIDTH/RMS_WIDTH)
+#define NBURST_RMS_PER_ROW  (NSAMP_PER_BURST/NRMS_PER_BURST)
+#define NBURST_RMS_PER_IMG  (NBURST_PER_IMG*NBURST_RMS_PER_ROW)
+
+// boxcar_cand_fast searches NSAMP_PER_TASK pixels of a DM at a time, their history stays local through all images
+#define NSAMP_PER_TASK      256      // A divisor of NSAMP_PER_IMG
+
+// 1/sqrt(width) of widths 1, 2, 4 to MWIDTH
+#define INV_SQRT_WIDTH {1.00000000, 0.70710678, 0.50000000, 0.35355339, 0.25000000, 0.17677670, 0.12500000, 0.08838835}
+
 typedef struct burst_t{
   data_t data[NSAMP_PER_BURST];
 }burst_t; // The size of this should be 512; BURST_DATA_WIDTH
@@ -58,6 +121,68 @@ typedef struct burst_t{
 typedef hls::stream<burst_t> fifo_burst_t;
 typedef hls::stream<data_t> fifo_data_t;
 
+typedef ap_uint<BURST_WIDTH> burst_history_t;
+typedef ap_uint<NSAMP_PER_BURST*HISTORY_PIXEL_BITS> history_row_t; // History of a row of pixels
+typedef hls::stream<burst_history_t> fifo_burst_history_t;
+
+typedef ap_uint<BURST_WIDTH> burst_rms_t;                          // NRMS_PER_BURST raw rms_t
+typedef ap_uint<NSAMP_PER_BURST*RMS_WIDTH> rms_row_t;              // Inverse RMS of a row of pixels
+typedef hls::stream<burst_rms_t> fifo_burst_rms_t;
+
+// Packed candidate record, fields from the least significant bit
+// Time is counted from the first image of the launch, width 0 never happens and marks the end of a candidate FIFO
+#define CAND_VALUE_LSB      0
+#define CAND_VALUE_BITS     SNR_WIDTH   // S/N, raw bits of snr_t
+#define CAND_WIDTH_LSB      (CAND_VALUE_LSB + CAND_VALUE_BITS)
+#define CAND_WIDTH_BITS     8           // Boxcar width in images, 1 to MWIDTH
+#define CAND_PIXEL_LSB      (CAND_WIDTH_LSB + CAND_WIDTH_BITS)
+#define CAND_PIXEL_BITS     16          // Pixel index in the image
+#define CAND_TIME_LSB       (CAND_PIXEL_LSB + CAND_PIXEL_BITS)
+#define CAND_TIME_BITS      16          // Time index of the last image of the boxcar
+#define CAND_DM_LSB         (CAND_TIME_LSB + CAND_TIME_BITS)
+#define CAND_DM_BITS        16          // DM index
+#define CAND_BITS           (CAND_DM_LSB + CAND_DM_BITS)
+
+typedef ap_uint<CAND_BITS> cand_t;      // The size of this should be 64
+
+#define MCAND               8192        // Max candidates kept by a launch, the capacity given at runtime is clipped to it
+#define CAND_HEADER         2           // Records before the candidates, number of candidates written and number dropped
+#define NCAND_BIN           (1<<CAND_VALUE_BITS) // Number of distinct candidate values
+typedef hls::stream<cand_t> fifo_cand_t;
+#define NCAND_PER_BURST     (BURST_WIDTH/CAND_BITS)
+typedef ap_uint<BURST_WIDTH> burst_cand_t; // NCAND_PER_BURST records, the first one in the lowest bits
+
+// Top-K mode keeps the best candidates of each image, higher S/N first and lower pixel first on a tie
+#define MTOPK               8           // Max candidates kept per image, a power of two up to NSAMP_PER_BURST
+typedef ap_uint<1 + CAND_VALUE_BITS + CAND_PIXEL_BITS> cand_key_t; // Valid, S/N and pixel of a record, ordered
+
+// Candidate record unpacked on host
+typedef struct cand_record{
+  float value;
+  int dm;
+  int time;
+  int pixel;
+  int width;
+}cand_record;
+
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+  uint64_t cycle;       // Cycles of the launch, counted by write_stats and the same for all stages
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ_HISTORY     0
+#define STATS_CALCULATE_CAND   1
+#define STATS_WRITE_HISTORY    2
+#define STATS_WRITE_CAND       3
+#define NSTATS                 4
+
 int boxcar(
 	   const data_t *in,
 	   data_t *out1,
@@ -87,3 +212,105 @@ data_t do_boxcar(
 		 int ntime,
 		 int boxcar,
 		 data_t *out);
+
+int boxcar_cand(
+                const data_t *in,
+                const uint8_t *previous_history,
+                uint8_t *current_history,
+                const rms_t *inv_rms,
+                int ndm,
+                int ntime,
+                int time_offset,
+                int width_mask,
+                snr_t threshold,
+                cand_t *cand,
+                uint64_t *ncand);
+
+int boxcar_cand_fast(
+                     const data_t *in,
+                     const uint8_t *previous_history,
+                     uint8_t *current_history,
+                     const rms_t *inv_rms,
+                     int ndm,
+                     int ntime,
+                     int time_offset,
+                     int width_mask,
+                     snr_t threshold,
+                     cand_t *cand,
+                     uint64_t *ncand);
+
+int boxcar_inv_rms(
+                   const data_t *in,
+                   int ndm,
+                   int ntime,
+                   rms_t *inv_rms);
+
+cand_t cand_encode(
+                   snr_t value,
+                   int dm,
+                   int time,
+                   int pixel,
+                   int width);
+
+int cand_decode(
+                const cand_t *cand,
+                uint64_t ncand,
+                cand_record *record);
+
+int cand_compare(
+                 const void *a,
+                 const void *b);
+
+int cand_topk(
+              const cand_t *cand,
+              uint64_t ncand,
+              int topk,
+              cand_t *kept,
+              uint64_t *nkept);
+
+int cand_select(
+                const cand_t *cand,
+                uint64_t ncand,
+                int capacity,
+                cand_t *kept,
+                uint64_t *nkept,
+                uint64_t *ndrop);
+
+int cand_merge(
+               const cand_t *out,
+               int ncu,
+               uint64_t nout,
+               const int *dm_offset,
+               int capacity,
+               cand_t *merged);
+
+uint64_t cand_mismatch(
+                       cand_record *sw_record,
+                       uint64_t nsw,
+                       cand_record *hw_record,
+                       uint64_t nhw);
+
+uint64_t cand_difference(
+                         cand_t *a,
+                         uint64_t na,
+                         cand_t *b,
+                         uint64_t nb);
+
+int boxcar_stats(
+                 int ndm,
+                 int ntime,
+                 int history_mode,
+                 uint64_t ncand,
+                 int capacity,
+                 stats_t *stats);
+
+int add_stats(
+              stats_t *total,
+              stats_t *stats,
+              int nstats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);
@@ -0,0 +1,478 @@
+/*
+******************************************************************************
+** CLUSTER CODE FILE
+******************************************************************************
+*/
+
+#include "cluster.h"
+
+// Cells are twice as wide as the largest distance of friends plus one, so friends of a candidate in the lower half of a cell
+// are in that cell or the one below it, and the other way round, 2^CLUSTER_NDIM cells at most
+// Cell indexes are wrapped to 16 bits in the key, cells which share a key only cost extra distance checks
+static uint64_t cell_key(
+                         int dm_cell,
+                         int64_t time_cell,
+                         int x_cell,
+                         int y_cell){
+  return ((uint64_t)(dm_cell & 0xFFFF) << 48) | ((uint64_t)(time_cell & 0xFFFF) << 32) |
+    ((uint64_t)(x_cell & 0xFFFF) << 16) | (uint64_t)(y_cell & 0xFFFF);
+}
+
+// All bits of a key are mixed into the slot, cells next to each other differ in any of the four fields
+static int find_slot(
+                     const cluster_engine *engine,
+                     uint64_t key){
+  uint64_t hash = key;
+  int slot;
+
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  slot  = (int)(hash & (engine->nslot - 1));
+
+  while(engine->slot[slot].head >= 0 && engine->slot[slot].key != key){
+    slot = (slot + 1) & (engine->nslot - 1);
+  }
+  return slot;
+}
+
+// Step to the cell next to a candidate in one dimension, 0 when it is further than link from both edges of its cell
+static int neighbour_step(
+                          int64_t offset,
+                          int link){
+  return offset < link ? -1 : (offset > link + 1 ? 1 : 0);
+}
+
+static int find_root(
+                     cluster_node *node,
+                     int i){
+  while(node[i].parent != i){
+    node[i].parent = node[node[i].parent].parent;
+    i = node[i].parent;
+  }
+  return i;
+}
+
+// Higher value first, then the earliest, so that the peak does not depend on the order candidates come in
+static bool peak_before(
+                        const cluster_t *a,
+                        const cluster_t *b){
+  if(a->value != b->value){
+    return a->value > b->value;
+  }
+  if(a->time != b->time){
+    return a->time < b->time;
+  }
+  if(a->dm != b->dm){
+    return a->dm < b->dm;
+  }
+  return a->pixel < b->pixel;
+}
+
+// All distances are checked without branches, which of them fails is not predictable in a dense cell
+static bool friends(
+                    const cluster_config *config,
+                    const cluster_point *a,
+                    const cluster_point *b){
+  return (abs(a->dm - b->dm) <= config->link_dm) &
+    (abs(a->time - b->time) <= config->link_time) &
+    (abs(a->x - b->x) <= config->link_pixel) &
+    (abs(a->y - b->y) <= config->link_pixel) &
+    (abs(a->level - b->level) <= config->link_width);
+}
+
+// The root with the lower index stays, so a root always comes before the rest of its tree
+static void unite(
+                  cluster_node *node,
+                  int a,
+                  int b){
+  int keep;
+  int gone;
+  uint64_t ncand;
+
+  a = find_root(node, a);
+  b = find_root(node, b);
+  if(a == b){
+    return;
+  }
+  keep = a < b ? a : b;
+  gone = a < b ? b : a;
+
+  node[gone].parent = keep;
+  ncand = node[keep].cluster.ncand + node[gone].cluster.ncand;
+  if(peak_before(&node[gone].cluster, &node[keep].cluster)){
+    node[keep].cluster = node[gone].cluster;
+  }
+  node[keep].cluster.ncand = ncand;
+  node[keep].time_first = node[gone].time_first < node[keep].time_first ? node[gone].time_first : node[keep].time_first;
+  node[keep].time_last  = node[gone].time_last  > node[keep].time_last  ? node[gone].time_last  : node[keep].time_last;
+}
+
+// The hash table is sized to the candidates of a call, at most half full, and is shrunk when it is far too big
+// A new table has all of its slots empty
+// Arrays are only swapped in once they are allocated, on a failure the engine keeps what it has and stays usable
+static int grow(
+                cluster_engine *engine,
+                int nnode){
+  int mnode = 2*engine->mnode > nnode ? 2*engine->mnode : nnode;
+  int nslot = CLUSTER_MIN_SLOT;
+  int k;
+  cluster_node *node;
+  cluster_point *point;
+  int *cell;
+  int *remap;
+  int *used;
+  cluster_t *cluster;
+  cluster_slot *slot;
+
+  if(nnode > engine->mnode){
+    node = (cluster_node *)realloc(engine->node, 2*mnode*sizeof(cluster_node));
+    if(node == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->node = node;
+    point = (cluster_point *)realloc(engine->point, mnode*sizeof(cluster_point));
+    if(point == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->point = point;
+    cell = (int *)realloc(engine->cell, mnode*sizeof(int));
+    if(cell == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->cell = cell;
+    remap = (int *)realloc(engine->remap, mnode*sizeof(int));
+    if(remap == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->remap = remap;
+    used = (int *)realloc(engine->used, mnode*sizeof(int));
+    if(used == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->used = used;
+    cluster = (cluster_t *)realloc(engine->cluster, mnode*sizeof(cluster_t));
+    if(cluster == NULL){
+      return EXIT_FAILURE;
+    }
+    engine->cluster = cluster;
+    engine->mnode   = mnode;
+  }
+
+  while(nslot < 2*nnode){
+    nslot *= 2;
+  }
+  if(nslot > engine->nslot || CLUSTER_SHRINK*nslot < engine->nslot){
+    slot = (cluster_slot *)malloc(nslot*sizeof(cluster_slot));
+    if(slot == NULL){
+      return EXIT_FAILURE;
+    }
+    for(k = 0; k < nslot; k++){
+      slot[k].head  = -1;
+      slot[k].count = 0;
+      slot[k].root  = -1;
+      slot[k].done  = 0;
+    }
+    free(engine->slot);
+    engine->slot  = slot;
+    engine->nslot = nslot;
+    engine->nused = 0;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int cluster_create(
+                   cluster_engine *engine,
+                   const cluster_config *config){
+
+  memset(engine, 0x00, sizeof(cluster_engine));
+  engine->config = *config;
+
+  return grow(engine, CLUSTER_MIN_SLOT/2);
+}
+
+// Add the candidates of a block of ntime images which starts at time_offset, time of a record is counted from the block
+// Candidates of later blocks are at time_offset+ntime or later, clusters which can not get any of them are closed
+// Only candidates of open clusters within link_time of the end of the block are kept, the work of a call is O(nrecord + kept)
+int cluster_add(
+                cluster_engine *engine,
+                const cand_record *record,
+                uint64_t nrecord,
+                int64_t time_offset,
+                int ntime){
+  const cluster_config *config = &engine->config;
+  cluster_node *node;
+  cluster_node *spare;
+  int64_t time_end = time_offset + ntime;
+  int64_t horizon  = time_end - config->link_time;
+  int64_t time_cell;
+  int64_t time_step;
+  uint64_t key;
+  uint64_t i;
+  int nold = engine->nnode;
+  int nnode = engine->nnode + (int)nrecord;
+  int size_dm    = 2*(config->link_dm + 1);
+  int size_time  = 2*(config->link_time + 1);
+  int size_pixel = 2*(config->link_pixel + 1);
+  int dm_cell;
+  int x_cell;
+  int y_cell;
+  int dm_step;
+  int x_step;
+  int y_step;
+  int skip;           // Dimensions without a cell next to the candidate
+  int slot;
+  int head;
+  int j;
+  int k;
+  int m;
+  int r;
+  int q;
+  int tail;
+  bool closed;
+  cluster_point *point;
+  cluster_slot *cell;
+
+  if(grow(engine, nnode)){
+    return EXIT_FAILURE;
+  }
+  node  = engine->node;
+  spare = &engine->node[engine->mnode];
+
+  for(i = 0; i < nrecord; i++){
+    cluster_node *p = &node[nold + i];
+
+    p->time       = time_offset + record[i].time;
+    p->dm         = record[i].dm;
+    p->x          = record[i].pixel%CLUSTER_IMG_WIDTH;
+    p->y          = record[i].pixel/CLUSTER_IMG_WIDTH;
+    p->level      = 0;
+    while((2 << p->level) <= record[i].width){
+      p->level++;
+    }
+    p->parent     = nold + i;
+    p->time_first = p->time;
+    p->time_last  = p->time;
+    p->cluster.value = record[i].value;
+    p->cluster.dm    = record[i].dm;
+    p->cluster.time  = p->time;
+    p->cluster.pixel = record[i].pixel;
+    p->cluster.width = record[i].width;
+    p->cluster.ncand = 1;
+  }
+  engine->nnode = nnode;
+
+  // Grid hash of all candidates, kept and new
+  // Candidates are counted by cell, then sorted by cell into points, so that a cell is scanned in one go
+  for(k = 0; k < engine->nused; k++){
+    cell = &engine->slot[engine->used[k]];
+    cell->head  = -1;
+    cell->count = 0;
+    cell->root  = -1;
+    cell->done  = 0;
+  }
+  engine->nused = 0;
+  for(j = 0; j < nnode; j++){
+    key  = cell_key(node[j].dm/size_dm, node[j].time/size_time, node[j].x/size_pixel, node[j].y/size_pixel);
+    slot = find_slot(engine, key);
+    if(engine->slot[slot].head < 0){
+      engine->slot[slot].key  = key;
+      engine->slot[slot].head = 0;
+      engine->used[engine->nused] = slot;
+      engine->nused++;
+    }
+    engine->slot[slot].count++;
+    engine->cell[j] = slot;
+  }
+  head = 0;
+  for(k = 0; k < engine->nused; k++){
+    cell = &engine->slot[engine->used[k]];
+    cell->head  = head;
+    head       += cell->count;
+    cell->count = 0;
+  }
+  for(j = 0; j < nnode; j++){
+    cluster_slot *p = &engine->slot[engine->cell[j]];
+    cluster_point *q = &engine->point[p->head + p->count];
+
+    q->index = j;
+    q->time  = (int)(node[j].time - time_offset);
+    q->dm    = node[j].dm;
+    q->x     = node[j].x;
+    q->y     = node[j].y;
+    q->level = node[j].level;
+    p->count++;
+  }
+
+  // New candidates go by cell, and look for friends among kept candidates and new ones before them, in their cell and
+  // the cells next to the half of it where they are and within reach, so a cell is done before the next one starts
+  // The first points of a cell which are known to be in one cluster need only one friend, and none from that cluster
+  for(q = 0; q < nnode; q++){
+    point = &engine->point[q];
+    j     = point->index;
+    if(j < nold){
+      continue;
+    }
+    dm_cell   = node[j].dm/size_dm;
+    time_cell = node[j].time/size_time;
+    x_cell    = node[j].x/size_pixel;
+    y_cell    = node[j].y/size_pixel;
+    dm_step   = neighbour_step(node[j].dm%size_dm, config->link_dm);
+    time_step = neighbour_step(node[j].time%size_time, config->link_time);
+    x_step    = neighbour_step(node[j].x%size_pixel, config->link_pixel);
+    y_step    = neighbour_step(node[j].y%size_pixel, config->link_pixel);
+    skip      = (dm_step == 0) | (time_step == 0)<<1 | (x_step == 0)<<2 | (y_step == 0)<<3;
+    for(k = 0; k < CLUSTER_NNEIGHBOUR; k++){
+      if(k & skip){
+        continue;
+      }
+      key  = cell_key(dm_cell + (k & 1)*dm_step, time_cell + (k>>1 & 1)*time_step,
+                      x_cell + (k>>2 & 1)*x_step, y_cell + (k>>3 & 1)*y_step);
+      cell = &engine->slot[find_slot(engine, key)];
+      head = cell->head;
+      tail = head + cell->count;
+      m    = head;
+      if(cell->done > 0){
+        if(find_root(node, cell->root) != find_root(node, j)){
+          for(; m < head + cell->done; m++){
+            if(friends(config, point, &engine->point[m])){
+              unite(node, j, engine->point[m].index);
+              break;
+            }
+          }
+        }
+        m = head + cell->done;
+      }
+
+      // Kept candidates come first in a cell
+      for(; m < tail && (m < q || engine->point[m].index < nold); m++){
+        if(friends(config, point, &engine->point[m])){
+          unite(node, j, engine->point[m].index);
+        }
+      }
+
+      // Points done with are added to the known part of the cell while they are in its cluster
+      if(cell->done == 0 && head < tail && (head <= q || engine->point[head].index < nold)){
+        cell->root = engine->point[head].index;
+        cell->done = 1;
+      }
+      for(m = head + cell->done; m < tail && (m <= q || engine->point[m].index < nold) &&
+            find_root(node, engine->point[m].index) == find_root(node, cell->root); m++){
+        cell->done++;
+      }
+    }
+  }
+
+  // Close clusters out of reach of later blocks or open for longer than the window, keep what may still get friends
+  engine->ncluster = 0;
+  for(j = 0; j < nnode; j++){
+    engine->remap[j] = -1;
+  }
+  m = 0;
+  for(j = 0; j < nnode; j++){
+    r = find_root(node, j);
+    closed = node[r].time_last < horizon || time_end - node[r].time_first >= config->window;
+    if(closed){
+      if(r == j){
+        engine->cluster[engine->ncluster] = node[j].cluster;
+        engine->ncluster++;
+      }
+    }
+    else if(node[j].time >= horizon){
+      spare[m] = node[j];
+      if(engine->remap[r] < 0){
+        engine->remap[r]  = m;
+        spare[m].time_first = node[r].time_first;
+        spare[m].time_last  = node[r].time_last;
+        spare[m].cluster    = node[r].cluster;
+      }
+      spare[m].parent = engine->remap[r];
+      m++;
+    }
+  }
+  memcpy(node, spare, m*sizeof(cluster_node));
+  engine->nnode = m;
+
+  return EXIT_SUCCESS;
+}
+
+// Close all clusters, at the end of a search
+int cluster_flush(
+                  cluster_engine *engine){
+  int j;
+
+  engine->ncluster = 0;
+  for(j = 0; j < engine->nnode; j++){
+    if(find_root(engine->node, j) == j){
+      engine->cluster[engine->ncluster] = engine->node[j].cluster;
+      engine->ncluster++;
+    }
+  }
+  engine->nnode = 0;
+
+  return EXIT_SUCCESS;
+}
+
+// Clusters by peak, then by size and width, a total order of everything a cluster reports
+static int compare_cluster(const void *a, const void *b){
+  const cluster_t *ca = (const cluster_t *)a;
+  const cluster_t *cb = (const cluster_t *)b;
+
+  if(peak_before(ca, cb)){
+    return -1;
+  }
+  if(peak_before(cb, ca)){
+    return 1;
+  }
+  if(ca->ncand != cb->ncand){
+    return ca->ncand > cb->ncand ? -1 : 1;
+  }
+  return ca->width < cb->width ? -1 : (ca->width > cb->width);
+}
+
+// Number of clusters in one list and not in the other, both lists are sorted in place, brightest first
+uint64_t cluster_difference(
+                            cluster_t *a,
+                            uint64_t na,
+                            cluster_t *b,
+                            uint64_t nb){
+  uint64_t i = 0;
+  uint64_t j = 0;
+  uint64_t ndifference = 0;
+  int order;
+
+  qsort(a, na, sizeof(cluster_t), compare_cluster);
+  qsort(b, nb, sizeof(cluster_t), compare_cluster);
+  while(i < na && j < nb){
+    order = compare_cluster(&a[i], &b[j]);
+    if(order == 0){
+      i++;
+      j++;
+    }
+    else if(order < 0){
+      i++;
+      ndifference++;
+    }
+    else{
+      j++;
+      ndifference++;
+    }
+  }
+
+  return ndifference + (na - i) + (nb - j);
+}
+
+int cluster_destroy(
+                    cluster_engine *engine){
+  free(engine->node);
+  free(engine->point);
+  free(engine->cell);
+  free(engine->remap);
+  free(engine->used);
+  free(engine->cluster);
+  free(engine->slot);
+  memset(engine, 0x00, sizeof(cluster_engine));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+******************************************************************************
+** CLUSTER CODE HEADER FILE
+******************************************************************************
+*/
+
+#pragma once
+
+#include "boxcar.h"
+
+// Friends-of-friends clustering of candidates, two candidates are friends when they are close in every dimension
+// Pixels are taken as (x, y) on an image of CLUSTER_IMG_WIDTH by CLUSTER_IMG_WIDTH, widths by log2 of them
+#define CLUSTER_IMG_WIDTH   256      // Pixels per image row, CLUSTER_IMG_WIDTH^2 = NSAMP_PER_IMG
+#define CLUSTER_NDIM        4        // Dimensions of the grid hash, DM, time, x and y
+#define CLUSTER_NNEIGHBOUR  16       // 2^CLUSTER_NDIM cells with friends of a candidate, its own one included
+#define CLUSTER_MIN_SLOT    1024     // Smallest hash table, a power of two
+#define CLUSTER_SHRINK      8        // A hash table this many times bigger than needed is shrunk
+
+// Largest distance of friends in each dimension, and the longest time a cluster stays open
+typedef struct cluster_config{
+  int link_dm;
+  int link_time;      // Images
+  int link_pixel;     // Pixels in x and in y
+  int link_width;     // Factors of two
+  int window;         // Images from the first candidate of a cluster, after that it is closed as it is
+}cluster_config;
+
+// A cluster is reported by its peak
+typedef struct cluster_t{
+  float value;
+  int dm;
+  int64_t time;       // Counted from the start of the search
+  int pixel;
+  int width;
+  uint64_t ncand;     // Candidates in the cluster
+}cluster_t;
+
+// Candidate in the engine, the cluster of a union-find tree is kept in its root
+typedef struct cluster_node{
+  int64_t time;
+  int dm;
+  int x;
+  int y;
+  int level;          // log2 of width
+  int parent;
+  int64_t time_first; // First and last time of the cluster, for roots
+  int64_t time_last;
+  cluster_t cluster;  // Peak of the cluster, for roots
+}cluster_node;
+
+// Candidate as the grid scans it, candidates of a cell are next to each other
+typedef struct cluster_point{
+  int index;          // Candidate in the engine
+  int time;           // From the start of the block
+  short dm;
+  unsigned char x;
+  unsigned char y;
+  unsigned char level;
+}cluster_point;
+
+// Slot of the grid hash, open addressing
+typedef struct cluster_slot{
+  uint64_t key;       // Cell
+  int head;           // First point of the cell, -1 for an empty slot
+  int count;          // Points in the cell
+  int root;           // A candidate in the cluster of the first done points of the cell
+  int done;
+}cluster_slot;
+
+// Clusters still open and the candidates which may still get friends, carried from one block to the next
+typedef struct cluster_engine{
+  cluster_config config;
+  cluster_node *node;
+  cluster_point *point;
+  int *cell;          // Slot of each candidate
+  int *remap;
+  cluster_slot *slot;
+  int *used;          // Slots filled by the last call, the only ones the next call has to empty
+  int nused;
+  int nnode;
+  int mnode;
+  int nslot;
+  cluster_t *cluster; // Clusters closed by the last call
+  uint64_t ncluster;
+}cluster_engine;
+
+int cluster_create(
+                   cluster_engine *engine,
+                   const cluster_config *config);
+
+int cluster_add(
+                cluster_engine *engine,
+                const cand_record *record,
+                uint64_t nrecord,
+                int64_t time_offset,
+                int ntime);
+
+int cluster_flush(
+                  cluster_engine *engine);
+
+uint64_t cluster_difference(
+                            cluster_t *a,
+                            uint64_t na,
+                            cluster_t *b,
+                            uint64_t nb);
+
+int cluster_destroy(
+                    cluster_engine *engine);
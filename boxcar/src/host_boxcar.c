@@ -6,82 +6,175 @@
 
 #include "util_sdaccel.h"
 #include "boxcar.h"
+#include "cluster.h"
+#include "writer.h"
 
 int main(int argc, char* argv[]){
   // Check argument
-  if (argc != 2) {
+  if (argc < 2 || argc > 8) {
     fprintf(stderr, "ERROR: Failed to execute the program!\n");
-    fprintf(stderr, "USAGE: %s xclbin\n", argv[0]);
+    fprintf(stderr, "USAGE: %s xclbin [nblock [width_mask [topk [ndm [cand_file [socket]]]]]]\n", argv[0]);
     fprintf(stderr, "INFO: Please re-execute it with the above usage method!\n");
     return EXIT_FAILURE;
-  }	
+  }
 
   // Prepare host buffers
+  // Each launch searches a block of ntime images for every DM, the history carries boxcars over to the next block
+  // Bit l of the width mask searches boxcars of width 2^l, all widths by default
+  // With at most MDM_RESIDENT DMs the history stays on chip, it is only loaded by the first block and stored by the last one
+  // A topk above 0 keeps only that many of the best candidates of each image
+  // DMs are split across CUs, each CU searches its range with its own slices of the images, history and RMS, and its own candidates
+  // Candidates of the kernel are appended to cand_file and sent to processes on the Unix socket, - for none
   int i;
   uint64_t j;
-  uint64_t ndata0;
-  uint64_t ndata[NBOXCAR];
-  cl_int ndm   = 16;
-  cl_int ntime = 64;
+  uint64_t ndata1;
+  uint64_t ndata2;
+  uint64_t ndata3;
+  uint64_t ndata4;
+  uint64_t ndata5;
+  cl_int ndm      = 16;
+  cl_int ntime    = 64;
+  cl_int nblock   = 4;
+  cl_int capacity = MCAND;
+  cl_int width_mask = (1<<NLEVEL) - 1;
+  cl_int topk     = 0;
+  cl_int time_offset;
+  cl_int history_mode;
+  int resident;
+  cl_int ncu = 0;
+  cl_int ndm_per_cu[NCU];
+  cl_int dm_offset[NCU];
+  cl_int nburst_in[NCU];
+  cl_int mdm_per_cu;
+  const char *cand_file = NULL;
+  const char *socket_path = NULL;
+  snr_t threshold = 5.0;
   if(is_hw_emulation()){
-    ndm   = 2;
-    ntime = 32;
+    ndm    = 2;
+    ntime  = 4;
+    nblock = 2;
   }
   if(is_sw_emulation()){
-    ndm   = 2;
-    ntime = 32;
-  }
-  ndata0 = ndm*(uint64_t)NSAMP_PER_IMG*ntime;
-  
-  data_t *in      = NULL;
-  data_t **sw_out = NULL;
-  data_t **hw_out = NULL;  
-  in = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata0*sizeof(data_t));
-  sw_out = (data_t **)calloc(NBOXCAR, sizeof(data_t*));
-  hw_out = (data_t **)calloc(NBOXCAR, sizeof(data_t*));
-  for(i = 0; i < NBOXCAR; i++){
-    ndata[i] = ndm*(uint64_t)NSAMP_PER_IMG*(ntime-i);
-    sw_out[i] = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata0*sizeof(data_t));
-    hw_out[i] = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata0*sizeof(data_t));
-    memset(sw_out[i], 0x00, ndata0*sizeof(data_t));
-    memset(hw_out[i], 0x00, ndata0*sizeof(data_t));
-  }    
+    ndm    = 2;
+    ntime  = 4;
+    nblock = 3;
+  }
+  if(argc >= 3){
+    nblock = atoi(argv[2]);
+  }
+  if(argc >= 4){
+    width_mask = strtol(argv[3], NULL, 0);
+  }
+  if(argc >= 5){
+    topk = atoi(argv[4]);
+  }
+  if(argc >= 6){
+    ndm = atoi(argv[5]);
+  }
+  if(argc >= 7 && strcmp(argv[6], "-")){
+    cand_file = argv[6];
+  }
+  if(argc == 8 && strcmp(argv[7], "-")){
+    socket_path = argv[7];
+  }
+  if(ndm <= 0 || ndm > MDM || ntime > MTIME || nblock <= 0){
+    fprintf(stderr, "ERROR: %d DMs and %d images per block should be at most %d and %d, with at least one block!\n", ndm, ntime, MDM, MTIME);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  if(width_mask <= 0 || width_mask >= (1<<NLEVEL)){
+    fprintf(stderr, "ERROR: Width mask 0x%x should pick some of the %d widths up to %d!\n", width_mask, NLEVEL, MWIDTH);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  if(topk < 0 || topk > MTOPK){
+    fprintf(stderr, "ERROR: %d candidates per image should be at most %d!\n", topk, MTOPK);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  mdm_per_cu = (ndm + NCU - 1)/NCU;
+  for(i = 0; i < NCU; i++){
+    dm_offset[i]  = i*mdm_per_cu;
+    ndm_per_cu[i] = (i + 1)*mdm_per_cu < ndm ? mdm_per_cu : ndm - dm_offset[i];
+    nburst_in[i]  = ndm_per_cu[i]*ntime*NBURST_PER_IMG;
+    if(ndm_per_cu[i] > 0){
+      ncu++;
+    }
+  }
+  // History stays on chip if a CU has room for its DMs
+  // Each CU has its own memory on hw_emu and hardware, but sw_emu runs all CUs on the same statics of the kernel
+  resident = (mdm_per_cu <= MDM_RESIDENT) && !(is_sw_emulation() && ncu > 1);
+  fprintf(stdout, "INFO: %d CUs, %d DMs per CU, history %s\n", ncu, mdm_per_cu, resident ? "on chip" : "in device memory");
+
+  ndata1 = ndm*(uint64_t)ntime*NSAMP_PER_IMG;
+  ndata2 = ndm*(uint64_t)NSAMP_PER_IMG*HISTORY_PIXEL_BYTES;
+  ndata3 = (CAND_HEADER + (uint64_t)capacity + NCAND_PER_BURST - 1)/NCAND_PER_BURST*NCAND_PER_BURST; // The last burst of records is written in full
+  ndata4 = ndm*(uint64_t)NSAMP_PER_IMG;
+  ndata5 = ntime*(uint64_t)NSAMP_PER_IMG;
+
+  data_t  *in = NULL;
+  uint8_t *sw_history[2] = {NULL, NULL};
+  uint8_t *hw_history = NULL;
+  rms_t   *inv_rms = NULL;
+  cand_t  *sw_cand = NULL;
+  uint8_t *ref_history = NULL;
+  cand_t  *ref_cand = NULL;
+  cand_t  *sw_out = NULL;
+  cand_t  *hw_out = NULL;
+  cand_t  *hw_out_cu = NULL;
+  cand_record *sw_record = NULL;
+  cand_record *hw_record = NULL;
+  stats_t *sw_stats = NULL;
+  stats_t *hw_stats = NULL;
+  stats_t *sw_total = NULL;
+  stats_t *hw_total = NULL;
+  stats_t *cu_stats = NULL;
+  const char *stage[NSTATS] = {"read_history", "calculate_cand", "write_history", "write_cand"};
+
+  in            = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(data_t));
+  sw_history[0] = (uint8_t *)aligned_alloc(MEM_ALIGNMENT, ndata2);
+  sw_history[1] = (uint8_t *)aligned_alloc(MEM_ALIGNMENT, ndata2);
+  hw_history    = (uint8_t *)aligned_alloc(MEM_ALIGNMENT, ndata2);
+  inv_rms       = (rms_t *)aligned_alloc(MEM_ALIGNMENT, ndata4*sizeof(rms_t));
+  sw_cand       = (cand_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(cand_t));
+  ref_history   = (uint8_t *)aligned_alloc(MEM_ALIGNMENT, NSAMP_PER_IMG*HISTORY_PIXEL_BYTES);
+  ref_cand      = (cand_t *)aligned_alloc(MEM_ALIGNMENT, ndata5*sizeof(cand_t));
+  sw_out        = (cand_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(cand_t));
+  hw_out        = (cand_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(cand_t));
+  hw_out_cu     = (cand_t *)aligned_alloc(MEM_ALIGNMENT, NCU*ndata3*sizeof(cand_t));
+  sw_record     = (cand_record *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(cand_record));
+  hw_record     = (cand_record *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(cand_record));
+  sw_stats      = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_stats      = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NCU*NSTATS*sizeof(stats_t));
+  sw_total      = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_total      = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  cu_stats      = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+
   fprintf(stdout, "INFO: %f MB memory used on host in total\n",
-	  (2*NBOXCAR+1)*ndata0*DATA_WIDTH/(8*1024.*1024.));
+	  (ndata1*DATA_WIDTH + ndata4*RMS_WIDTH + (3*ndata2 + NSAMP_PER_IMG*HISTORY_PIXEL_BYTES)*8 + (ndata1 + (2 + NCU)*ndata3 + ndata5)*CAND_BITS)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device in total\n",
-	  (NBOXCAR+1)*ndata0*DATA_WIDTH/(8*1024.*1024.));
+	  (ndata1*DATA_WIDTH + ndata4*RMS_WIDTH + 2*ndata2*8 + ncu*ndata3*CAND_BITS)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device for raw input\n",
-	  ndata0*DATA_WIDTH/(8*1024.*1024.));  
-  fprintf(stdout, "INFO: %f MB memory used on device for raw output\n",
-	  ndata0*NBOXCAR*DATA_WIDTH/(8*1024.*1024.));  
-  
-  // Prepare input
+	  ndata1*DATA_WIDTH/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %f MB memory used on device for history\n",
+	  2*ndata2/(1024.*1024.));
+
+  memset(sw_history[0], 0x00, ndata2);
+  memset(hw_history, 0x00, ndata2);
+  memset(sw_total, 0x00, NSTATS*sizeof(stats_t));
+  memset(hw_total, 0x00, NSTATS*sizeof(stats_t));
   srand(time(NULL));
-  for(j = 0; j < ndata0; j++){
-    in[j] = (data_t)(0.99*(rand()%DATA_RANGE));
-  }
-  
-  // Calculate on host
-  cl_float cpu_elapsed_time;
-  struct timespec host_start;
-  struct timespec host_finish;
-  clock_gettime(CLOCK_REALTIME, &host_start);
-  boxcar(in, sw_out[0], sw_out[1], sw_out[2], sw_out[3],
-	 sw_out[4], sw_out[5], sw_out[6], sw_out[7],
-	 sw_out[8], sw_out[9], sw_out[10], sw_out[11],
-	 sw_out[12], sw_out[13], sw_out[14], sw_out[15],
-	 ndm, ntime);
-  fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
-  clock_gettime(CLOCK_REALTIME, &host_finish);
-  cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
-  
+
   // Get platform ID and info
   cl_int err;
   cl_uint platforms;
   cl_int get_platform_id = 0;
   cl_platform_id platform_id;
   cl_platform_id platform_ids[MAX_PALTFORMS];
-  char platform_name[PARAM_VALUE_SIZE];  
+  char platform_name[PARAM_VALUE_SIZE];
   OCL_CHECK(err, err = clGetPlatformIDs(MAX_PALTFORMS, platform_ids, &platforms));
   for(i = 0; i < platforms; i++){
     OCL_CHECK(err, err = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_VENDOR, PARAM_VALUE_SIZE, (void *)platform_name, NULL));
@@ -97,7 +190,7 @@ int main(int argc, char* argv[]){
     fprintf(stderr, "ERROR: Test failed ...!\n");
     return EXIT_FAILURE;
   }
-  
+
   // Get device ID and info
   cl_uint devices;
   cl_int get_device_id = 0;
@@ -106,7 +199,7 @@ int main(int argc, char* argv[]){
   char device_name[PARAM_VALUE_SIZE];
   OCL_CHECK(err, err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ACCELERATOR, MAX_DEVICES, device_ids, &devices));
   for(i = 0; i < devices; i++){
-    OCL_CHECK(err, err = clGetDeviceInfo(device_ids[i], CL_DEVICE_NAME, PARAM_VALUE_SIZE, device_name, 0));    
+    OCL_CHECK(err, err = clGetDeviceInfo(device_ids[i], CL_DEVICE_NAME, PARAM_VALUE_SIZE, device_name, 0));
     if(strstr(device_name, "u280")){
       device_id = device_ids[i];
       get_device_id = 1;
@@ -116,19 +209,19 @@ int main(int argc, char* argv[]){
   if(get_device_id ==0){
     fprintf(stderr, "ERROR: Failed to get device ID!\n");
     fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
-    fprintf(stderr, "ERROR: Test failed ...!\n");   
-    return EXIT_FAILURE; 
-  }  
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
   fprintf(stdout, "INFO: We will use %s!\n", device_name);
 
   // Create context
   cl_context context;
   OCL_CHECK(err, context = clCreateContext(0, 1, &device_id, NULL, NULL, &err));
-  
-  // Create command queue
+
+  // Create command queue, out of order so that the streaming kernels run at the same time
   cl_command_queue queue;
-  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err));
-  
+  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err));
+
   // Read kernel binary into memory
   char *xclbin = argv[1];
   unsigned char *binary = NULL;
@@ -147,118 +240,416 @@ int main(int argc, char* argv[]){
   cl_program program;
   OCL_CHECK(err, program = clCreateProgramWithBinary(context, 1, &device_id, &binary_size, (const unsigned char **) &binary, &status, &err));
   free(binary);
-  
+
   // Program the card with the program binary
   OCL_CHECK(err, err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL));
 
-  // Create the kernel
-  cl_kernel kernel;
-  OCL_CHECK(err, kernel = clCreateKernel(program, "knl_boxcar", &err));
+  // Create the kernel, one handle per CU, so that each CU gets its own buffers
+  // CU n of knl_read streams to CU n of knl_boxcar and the memory banks of each CU are given with the connectivity at link time
+  cl_kernel knl_read[NCU];
+  cl_kernel knl_boxcar[NCU];
+  char kernel_name[LINE_LENGTH];
+  for(i = 0; i < ncu; i++){
+    sprintf(kernel_name, "knl_read:{knl_read_%d}", i + 1);
+    OCL_CHECK(err, knl_read[i]   = clCreateKernel(program, kernel_name, &err));
+    sprintf(kernel_name, "knl_boxcar:{knl_boxcar_%d}", i + 1);
+    OCL_CHECK(err, knl_boxcar[i] = clCreateKernel(program, kernel_name, &err));
+  }
 
   // Prepare device buffer
-  cl_mem buffer_in;
-  cl_mem buffer_out[NBOXCAR];
-  cl_mem pt[NBOXCAR+1];
-  status = 1;
-  OCL_CHECK(err, buffer_in   = clCreateBuffer(context, CL_MEM_READ_ONLY  | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata0, in, &err));
-  status = status && buffer_in;
-  for(i = 0; i < NBOXCAR; i++){
-    OCL_CHECK(err, buffer_out[i] = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata0, hw_out[i], &err));
-    status = status && hw_out[i];
-  }
-  if (!status) {
-    fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
-    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
-    fprintf(stderr, "ERROR: Test failed ...!\n");
-    return EXIT_FAILURE;
+  // Images, history and RMS of a CU are its DM slices of the host buffers, DMs are the outer dimension of all of them
+  // The second history buffer only lives on the device, the first one starts from zero
+  cl_mem buffer_in[NCU];
+  cl_mem buffer_history[NCU][2];
+  cl_mem buffer_rms[NCU];
+  cl_mem buffer_out[NCU];
+  cl_mem buffer_stats[NCU];
+  cl_mem pt[5*NCU];
+
+  for(i = 0; i < ncu; i++){
+    OCL_CHECK(err, buffer_in[i]         = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndm_per_cu[i]*ntime*NSAMP_PER_IMG, &in[dm_offset[i]*(uint64_t)ntime*NSAMP_PER_IMG], &err));
+    OCL_CHECK(err, buffer_history[i][0] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, ndm_per_cu[i]*(uint64_t)NSAMP_PER_IMG*HISTORY_PIXEL_BYTES, &hw_history[dm_offset[i]*(uint64_t)NSAMP_PER_IMG*HISTORY_PIXEL_BYTES], &err));
+    OCL_CHECK(err, buffer_history[i][1] = clCreateBuffer(context, CL_MEM_READ_WRITE, ndm_per_cu[i]*(uint64_t)NSAMP_PER_IMG*HISTORY_PIXEL_BYTES, NULL, &err));
+    OCL_CHECK(err, buffer_rms[i]        = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(rms_t)*ndm_per_cu[i]*NSAMP_PER_IMG, &inv_rms[dm_offset[i]*(uint64_t)NSAMP_PER_IMG], &err));
+    OCL_CHECK(err, buffer_out[i]        = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(cand_t)*ndata3, &hw_out_cu[i*ndata3], &err));
+    OCL_CHECK(err, buffer_stats[i]      = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, &hw_stats[i*NSTATS], &err));
+    if (!(buffer_in[i]&&
+          buffer_history[i][0]&&
+          buffer_history[i][1]&&
+          buffer_rms[i]&&
+          buffer_out[i]&&
+          buffer_stats[i]
+          )) {
+      fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
+      fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+      fprintf(stderr, "ERROR: Test failed ...!\n");
+      return EXIT_FAILURE;
+    }
   }
-  
+
   // Setup kernel arguments
   // To use multiple banks, this has to be before any enqueue options (e.g., clEnqueueMigrateMemObjects)
-  pt[0] = buffer_in;
-  for(i = 0; i < NBOXCAR; i++){
-    pt[i+1] = buffer_out[i];
-  }
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_in));
-  for(i = 0; i < NBOXCAR; i++){
-    OCL_CHECK(err, err = clSetKernelArg(kernel, i+1, sizeof(cl_mem), &buffer_out[i]));
+  // Images of each CU go first in pt, then the history, the candidates and counters, and the RMS
+  for(i = 0; i < ncu; i++){
+    pt[i]               = buffer_in[i];
+    pt[ncu + i]         = buffer_history[i][0];
+    pt[2*ncu + 2*i]     = buffer_out[i];
+    pt[2*ncu + 2*i + 1] = buffer_stats[i];
+    pt[4*ncu + i]       = buffer_rms[i];
+
+    OCL_CHECK(err, err = clSetKernelArg(knl_read[i], 0, sizeof(cl_mem), &buffer_in[i]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_read[i], 2, sizeof(cl_int), &nburst_in[i]));
+
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 1, sizeof(cl_mem), &buffer_history[i][0]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 2, sizeof(cl_mem), &buffer_history[i][1]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 3, sizeof(cl_mem), &buffer_rms[i]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 4, sizeof(cl_int), &ndm_per_cu[i]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 5, sizeof(cl_int), &ntime));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 7, sizeof(cl_int), &width_mask));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 9, sizeof(snr_t), &threshold));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 10, sizeof(cl_int), &topk));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 11, sizeof(cl_mem), &buffer_out[i]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 12, sizeof(cl_int), &capacity));
+    OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 13, sizeof(cl_mem), &buffer_stats[i]));
   }
-  OCL_CHECK(err, err = clSetKernelArg(kernel, NBOXCAR+1, sizeof(cl_int), &ndm));
-  OCL_CHECK(err, err = clSetKernelArg(kernel, NBOXCAR+2, sizeof(cl_int), &ntime));
   fprintf(stdout, "INFO: DONE SETUP KERNEL\n");
 
-  // Migrate host memory to device
-  cl_int inputs = 1;
-  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, inputs, pt, 0 ,0,NULL, NULL));
-  OCL_CHECK(err, err = clFinish(queue));
-  fprintf(stdout, "INFO: DONE MEMCPY FROM HOST TO KERNEL\n");
-
-  // Execute the kernel
-  struct timespec device_start;
-  struct timespec device_finish;
-  cl_float kernel_elapsed_time;
-  clock_gettime(CLOCK_REALTIME, &device_start);
-  OCL_CHECK(err, err = clEnqueueTask(queue, kernel, 0, NULL, NULL));
+  // The initial history goes to the device once
+  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, ncu, &pt[ncu], 0, 0, NULL, NULL));
   OCL_CHECK(err, err = clFinish(queue));
-  fprintf(stdout, "INFO: DONE KERNEL EXECUTION\n");
-  clock_gettime(CLOCK_REALTIME, &device_finish);
-  kernel_elapsed_time = (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
 
-  // Migrate data from device to host
-  cl_int outputs = NBOXCAR;
-  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[1], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
-  OCL_CHECK(err, err = clFinish(queue));
-  fprintf(stdout, "INFO: DONE MEMCPY FROM KERNEL TO HOST\n");
-
-  // Save result to files for further check
-  FILE *fp=NULL;
-  char fname[LINE_LENGTH];
-  for(i = 0; i < NBOXCAR; i++){
-    sprintf(fname, "/data/FRIGG_2/Workspace/coherent-craft-sdaccel/boxcar/src/out%d.txt", i);
-    fp = fopen(fname, "w");
-    for(j = 0; j < ndata0; j++) {
-      fprintf(fp, "%f\n", sw_out[i][j].to_float());
+  int block;
+  int current;
+  int dm;
+  uint64_t ncand_cu[NCU];
+  uint64_t ncand;
+  uint64_t nref;
+  uint64_t nfirst;
+  uint64_t ntopk;
+  uint64_t nkept;
+  uint64_t ndrop;
+  uint64_t nkept_hw;
+  uint64_t ndrop_hw;
+  uint64_t nmismatch = 0;
+  uint64_t ncand_total = 0;
+  uint64_t nburst_history = 0;
+  uint64_t ncluster_total = 0;
+  uint64_t ncand_cluster = 0;
+  uint64_t ncluster_mismatch = 0;
+  uint64_t k;
+  bool cluster_check = true;
+  cluster_t brightest;
+  cl_float cpu_elapsed_time = 0;
+  cl_float search_elapsed_time = 0;
+  cl_float kernel_elapsed_time = 0;
+  cl_float memcpy_elapsed_time = 0;
+  cl_float cluster_elapsed_time = 0;
+  cl_float merge_elapsed_time = 0;
+  cl_float writer_elapsed_time = 0;
+  int writer_error = 0;
+  struct timespec start;
+  struct timespec finish;
+
+  // Candidates the kernel writes are clustered as blocks come, a cluster may go over several blocks
+  // Friends are next to each other in DM, pixel and width, and at most two images apart
+  cluster_engine engine;
+  cluster_config config = {1, 2, 1, 1, 4*MWIDTH};
+  if(cluster_create(&engine, &config)){
+    fprintf(stderr, "ERROR: Failed to create the clustering engine!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Peaks of the clusters are checked against the ones of the expected candidates, and the brightest one is reported
+  cluster_engine ref_engine;
+  if(cluster_create(&ref_engine, &config)){
+    fprintf(stderr, "ERROR: Failed to create the reference clustering engine!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  memset(&brightest, 0x00, sizeof(cluster_t));
+
+  // Candidates are written by a background thread, the launch loop only copies them into its queue
+  cand_writer writer;
+  writer_config writer_setup = {ndm, ntime, width_mask, topk, threshold.to_float()};
+  if((cand_file != NULL || socket_path != NULL) && writer_create(&writer, &writer_setup, cand_file, socket_path)){
+    fprintf(stderr, "ERROR: Failed to open candidate file %s or socket %s!\n", cand_file ? cand_file : "-", socket_path ? socket_path : "-");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  for(block = 0; block < nblock; block++){
+    current = block%2;
+    time_offset = (block*ntime)%MWIDTH;
+    history_mode = resident ? 0 : HISTORY_LOAD | HISTORY_STORE;
+    if(block == 0){
+      history_mode |= HISTORY_LOAD;
+    }
+    if(block == nblock-1){
+      history_mode |= HISTORY_STORE;
+    }
+
+    // Images of the block, noise around zero so that long boxcars do not wrap
+    for(j = 0; j < ndata1; j++){
+      in[j] = (data_t)((rand()%DATA_RANGE - DATA_RANGE/2)/8.0);
+    }
+    
+    // The noise level is measured once from the first block, it goes to the device with the images
+    if(block == 0){
+      boxcar_inv_rms(in, ndm, ntime, inv_rms);
+      OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, ncu, &pt[4*ncu], 0, 0, NULL, NULL));
+    }
+
+    // Calculate on host
+    clock_gettime(CLOCK_REALTIME, &start);
+    boxcar_cand_fast(in, sw_history[current], sw_history[1-current], inv_rms, ndm, ntime, time_offset, width_mask, threshold, sw_cand, &ncand);
+    clock_gettime(CLOCK_REALTIME, &finish);
+    search_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+    cpu_elapsed_time    += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+
+    // The plain search checks the fast one on the first DM of the first block, candidates of a DM are together
+    if(block == 0){
+      boxcar_cand(in, sw_history[current], ref_history, inv_rms, 1, ntime, time_offset, width_mask, threshold, ref_cand, &nref);
+      for(nfirst = 0; nfirst < ncand && sw_cand[nfirst].range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_DM_LSB) == 0; nfirst++){
+      }
+      if(cand_difference(ref_cand, nref, sw_cand, nfirst) ||
+         memcmp(ref_history, sw_history[1-current], NSAMP_PER_IMG*HISTORY_PIXEL_BYTES)){
+        fprintf(stderr, "ERROR: Test failed, the fast CPU search gives %" PRIu64 " candidates of DM 0 and the plain one %" PRIu64 ", or another history\n",
+                nfirst, nref);
+        nmismatch++;
+      }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    cand_topk(sw_cand, ncand, topk, sw_cand, &ntopk);
+    cand_select(sw_cand, ntopk, capacity, sw_out, &nkept, &ndrop);
+    clock_gettime(CLOCK_REALTIME, &finish);
+    cpu_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+
+    // Each CU writes the candidates of its own DMs, the counters of the model are summed over CUs
+    memset(ncand_cu, 0x00, NCU*sizeof(uint64_t));
+    memset(sw_stats, 0x00, NSTATS*sizeof(stats_t));
+    for(j = 0; j < ntopk; j++){
+      dm = sw_cand[j].range(CAND_DM_LSB + CAND_DM_BITS - 1, CAND_DM_LSB).to_int();
+      ncand_cu[dm/mdm_per_cu]++;
+    }
+    for(i = 0; i < ncu; i++){
+      boxcar_stats(ndm_per_cu[i], ntime, history_mode, ncand_cu[i], capacity, cu_stats);
+      add_stats(sw_stats, cu_stats, NSTATS);
+    }
+    add_stats(sw_total, sw_stats, NSTATS);
+    nburst_history += sw_stats[STATS_READ_HISTORY].burst - (uint64_t)ndm*NBURST_RMS_PER_IMG + sw_stats[STATS_WRITE_HISTORY].burst;
+    ncand_total += ncand;
+
+    // Migrate images of the block to device
+    clock_gettime(CLOCK_REALTIME, &start);
+    OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, ncu, &pt[0], 0, 0, NULL, NULL));
+    OCL_CHECK(err, err = clFinish(queue));
+    clock_gettime(CLOCK_REALTIME, &finish);
+    memcpy_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+
+    // Swap history buffers, the current history of this block is the previous one of the next block
+    // Blocks of the history tree are aligned to the first image of the search
+    for(i = 0; i < ncu; i++){
+      OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 1, sizeof(cl_mem), &buffer_history[i][current]));
+      OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 2, sizeof(cl_mem), &buffer_history[i][1-current]));
+      OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 6, sizeof(cl_int), &time_offset));
+      OCL_CHECK(err, err = clSetKernelArg(knl_boxcar[i], 8, sizeof(cl_int), &history_mode));
+    }
+
+    // Execute the kernel, all CUs run at the same time
+    clock_gettime(CLOCK_REALTIME, &start);
+    for(i = 0; i < ncu; i++){
+      OCL_CHECK(err, err = clEnqueueTask(queue, knl_read[i], 0, NULL, NULL));
+      OCL_CHECK(err, err = clEnqueueTask(queue, knl_boxcar[i], 0, NULL, NULL));
+    }
+    OCL_CHECK(err, err = clFinish(queue));
+    clock_gettime(CLOCK_REALTIME, &finish);
+    kernel_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+
+    // Migrate candidates and counters from device to host
+    clock_gettime(CLOCK_REALTIME, &start);
+    OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, 2*ncu, &pt[2*ncu], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
+    OCL_CHECK(err, err = clFinish(queue));
+    clock_gettime(CLOCK_REALTIME, &finish);
+    memcpy_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+    for(i = 0; i < ncu; i++){
+      add_stats(hw_total, &hw_stats[i*NSTATS], NSTATS);
+    }
+
+    // Candidates of all CUs are merged into one list, as one CU searching all DMs would write it
+    clock_gettime(CLOCK_REALTIME, &start);
+    if(cand_merge(hw_out_cu, ncu, ndata3, dm_offset, capacity, hw_out)){
+      fprintf(stderr, "ERROR: Failed to merge candidates of block %d!\n", block);
+      fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+      fprintf(stderr, "ERROR: Test failed ...!\n");
+      return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_REALTIME, &finish);
+    merge_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+
+    // Check the result
+    nkept_hw = hw_out[0].to_uint64();
+    ndrop_hw = hw_out[1].to_uint64();
+    cand_decode(&hw_out[CAND_HEADER], nkept_hw, hw_record);
+
+    // Candidates of the block go out as they are, whatever the check says
+    if(cand_file != NULL || socket_path != NULL){
+      clock_gettime(CLOCK_REALTIME, &start);
+      if(writer_push(&writer, hw_record, nkept_hw, ndrop_hw, (int64_t)block*ntime)){
+        fprintf(stderr, "ERROR: Failed to queue candidates of block %d!\n", block);
+        fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+        fprintf(stderr, "ERROR: Test failed ...!\n");
+        return EXIT_FAILURE;
+      }
+      clock_gettime(CLOCK_REALTIME, &finish);
+      writer_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+    }
+
+    // Candidates of every block are clustered, the check below only says if they are the expected ones
+    clock_gettime(CLOCK_REALTIME, &start);
+    if(cluster_add(&engine, hw_record, nkept_hw, (int64_t)block*ntime, ntime)){
+      fprintf(stderr, "ERROR: Failed to cluster candidates of block %d!\n", block);
+      fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+      fprintf(stderr, "ERROR: Test failed ...!\n");
+      return EXIT_FAILURE;
     }
-    fclose(fp);
-  }
-	
-  // Check the result
-  uint64_t counter;
-  for(i = 0; i < NBOXCAR; i++){
-    counter = 0;
-    for(j = 0; j<ndata[i]; j++){
-      if(sw_out[i][j]!=0){
-	counter++;
-      }    
-      if(sw_out[i][j] != hw_out[i][j]){
-	fprintf(stderr, "ERROR: Test failed %"PRIu64" (%f %f)\n", i, sw_out[i][j].to_float(), hw_out[i][j].to_float());
-	break;
+    clock_gettime(CLOCK_REALTIME, &finish);
+    cluster_elapsed_time += (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec)/1.0E9L;
+    ncluster_total += engine.ncluster;
+    ncand_cluster  += nkept_hw;
+    for(k = 0; k < engine.ncluster; k++){
+      if(brightest.ncand == 0 || engine.cluster[k].value > brightest.value){
+        brightest = engine.cluster[k];
       }
     }
-    fprintf(stdout, "INFO: %"PRIu64" none zero boxcar%d out of %"PRIu64", which is %.0f\%\n", counter, i+1, ndata[i], 100.0*(float)counter/ndata[i]);
-  }  
+
+    cand_decode(sw_out, nkept, sw_record);
+    if(cluster_add(&ref_engine, sw_record, nkept, (int64_t)block*ntime, ntime)){
+      fprintf(stderr, "ERROR: Failed to cluster expected candidates of block %d!\n", block);
+      fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+      fprintf(stderr, "ERROR: Test failed ...!\n");
+      return EXIT_FAILURE;
+    }
+    
+    // Dropped candidates at the lowest kept value may be any of them, clusters with them differ from then on
+    cluster_check = cluster_check && ndrop == 0 && nkept_hw == nkept && ndrop_hw == ndrop;
+    if(cluster_check){
+      ncluster_mismatch += cluster_difference(engine.cluster, engine.ncluster, ref_engine.cluster, ref_engine.ncluster);
+    }
+
+    if(nkept_hw != nkept || ndrop_hw != ndrop){
+      fprintf(stderr, "ERROR: Test failed at block %d, %" PRIu64 " candidates written and %" PRIu64 " dropped, expected %" PRIu64 " and %" PRIu64 "\n",
+              block, nkept_hw, ndrop_hw, nkept, ndrop);
+      nmismatch++;
+    }
+    else{
+      nmismatch += cand_mismatch(sw_record, nkept, hw_record, nkept_hw);
+    }
+    fprintf(stdout, "INFO: Block %d, %" PRIu64 " candidates, %" PRIu64 " sent on, %" PRIu64 " written and %" PRIu64 " dropped\n",
+            block, ncand, ntopk, nkept_hw, ndrop_hw);
+  }
+  cluster_flush(&engine);
+  cluster_flush(&ref_engine);
+  ncluster_total += engine.ncluster;
+  for(k = 0; k < engine.ncluster; k++){
+    if(brightest.ncand == 0 || engine.cluster[k].value > brightest.value){
+      brightest = engine.cluster[k];
+    }
+  }
+  if(cluster_check){
+    ncluster_mismatch += cluster_difference(engine.cluster, engine.ncluster, ref_engine.cluster, ref_engine.ncluster);
+  }
+  if(cand_file != NULL || socket_path != NULL){
+    if(writer_destroy(&writer)){
+      fprintf(stderr, "ERROR: Failed to write candidate file %s or socket %s!\n", cand_file ? cand_file : "-", socket_path ? socket_path : "-");
+      writer_error = 1;
+    }
+    fprintf(stdout, "INFO: %" PRIu64 " blocks written, %" PRIu64 " lost from a full queue and %" PRIu64 " skipped to slow subscribers\n",
+            writer.nwritten, writer.nlost, writer.nskip);
+  }
   fprintf(stdout, "INFO: DONE RESULT CHECK\n");
+
+  if(nmismatch){
+    fprintf(stderr, "ERROR: Test failed, %" PRIu64 " candidates do not match\n", nmismatch);
+  }
+  if(ncluster_mismatch){
+    fprintf(stderr, "ERROR: Test failed, %" PRIu64 " clusters do not match\n", ncluster_mismatch);
+  }
+  if(nmismatch == 0 && ncluster_mismatch == 0){
+    fprintf(stdout, "INFO: Test passed, %" PRIu64 " candidates in %d blocks\n", ncand_total, nblock);
+  }
+  if(!cluster_check){
+    fprintf(stdout, "INFO: Clusters are not checked, candidates were dropped or do not match\n");
+  }
   fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
   fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
-  
+  fprintf(stdout, "INFO: Elapsed time of memcpy is %E seconds\n", memcpy_elapsed_time);
+  fprintf(stdout, "INFO: Elapsed time of merging candidates is %E seconds\n", merge_elapsed_time);
+  fprintf(stdout, "INFO: Elapsed time of clustering is %E seconds\n", cluster_elapsed_time);
+  fprintf(stdout, "INFO: Elapsed time of queueing candidates to the writer is %E seconds\n", writer_elapsed_time);
+  fprintf(stdout, "INFO: %d CUs search %E images per second\n", ncu, (double)ndm*ntime*nblock/kernel_elapsed_time);
+  fprintf(stdout, "INFO: CPU searches %E images per second\n", (double)ndm*ntime*nblock/search_elapsed_time);
+  fprintf(stdout, "INFO: %f MB of history moved to and from device memory, %f MB without history on chip\n",
+          nburst_history*BURST_WIDTH/(8*1024.*1024.), 2.0*nblock*ndm*NBURST_HISTORY_PER_DM*BURST_WIDTH/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %" PRIu64 " candidates in %" PRIu64 " clusters, clustering takes %E candidates per second\n",
+          ncand_cluster, ncluster_total, ncand_cluster/cluster_elapsed_time);
+  if(brightest.ncand > 0){
+    fprintf(stdout, "INFO: Brightest cluster has S/N %f at DM %d, time %" PRId64 ", pixel %d and width %d, with %" PRIu64 " candidates\n",
+            brightest.value, brightest.dm, brightest.time, brightest.pixel, brightest.width, brightest.ncand);
+  }
+  print_stats("Counters of CPU model", stage, sw_total, NSTATS);
+  print_stats("Counters of kernel", stage, hw_total, NSTATS);
+
+  // Cycles are counted by the kernel, the model is one iteration per cycle without stalls
+  // In sw_emu the count is the polls of a thread, which says nothing of the hardware
+  if(!is_sw_emulation()){
+    fprintf(stdout, "INFO: calculate_cand searches in %f of the %" PRIu64 " cycles of the launches, the model takes %" PRIu64 " cycles\n",
+            hw_total[STATS_CALCULATE_CAND].active/(double)hw_total[STATS_CALCULATE_CAND].cycle, hw_total[STATS_CALCULATE_CAND].cycle,
+            sw_total[STATS_CALCULATE_CAND].cycle);
+  }
+
   // Cleanup
-  clReleaseMemObject(buffer_in);
-  for(i = 0; i < NBOXCAR; i++){
+  for(i = 0; i < ncu; i++){
+    clReleaseMemObject(buffer_in[i]);
+    clReleaseMemObject(buffer_history[i][0]);
+    clReleaseMemObject(buffer_history[i][1]);
+    clReleaseMemObject(buffer_rms[i]);
     clReleaseMemObject(buffer_out[i]);
+    clReleaseMemObject(buffer_stats[i]);
+    clReleaseKernel(knl_read[i]);
+    clReleaseKernel(knl_boxcar[i]);
   }
-  
+
   free(in);
-  for(i = 0; i < NBOXCAR; i++){
-    free(sw_out[i]);
-    free(hw_out[i]);
-  }
-  
+  free(sw_history[0]);
+  free(sw_history[1]);
+  free(hw_history);
+  free(inv_rms);
+  free(sw_cand);
+  free(ref_history);
+  free(ref_cand);
+  free(sw_out);
+  free(hw_out);
+  free(hw_out_cu);
+  free(sw_record);
+  free(hw_record);
+  free(sw_stats);
+  free(hw_stats);
+  free(sw_total);
+  free(hw_total);
+  free(cu_stats);
+  cluster_destroy(&engine);
+  cluster_destroy(&ref_engine);
+
   clReleaseProgram(program);
-  clReleaseKernel(kernel);
   clReleaseCommandQueue(queue);
   clReleaseContext(context);
 
   fprintf(stdout, "INFO: DONE ALL\n");
-  
-  return EXIT_SUCCESS;
+
+  return (nmismatch == 0 && ncluster_mismatch == 0 && writer_error == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -3,107 +3,185 @@
 extern "C"{
   void knl_boxcar(
                   fifo_burst_t &in,
-                  burst_t *previous_history,
-                  burst_t *current_history,
+                  burst_history_t *previous_history,
+                  burst_history_t *current_history,
+                  const burst_rms_t *rms,
                   int ndm,
                   int ntime,
-                  data_t threshold,
-                  data_t *out
+                  int time_offset,
+                  int width_mask,
+                  int history_mode,
+                  snr_t threshold,
+                  int topk,
+                  burst_cand_t *out,
+                  int capacity,
+                  stats_t *stats
                   );
   
   void fill_cand_fifo(
                       fifo_burst_t &in, 
-                      burst_t *previous_history,
-                      burst_t *current_history,
+                      burst_history_t *previous_history,
+                      burst_history_t *current_history,
+                      const burst_rms_t *rms,
                       int ndm,
                       int ntime,
-                      data_t threshold,
-                      fifo_data_t *cand
+                      int time_offset,
+                      int width_mask,
+                      int history_mode,
+                      snr_t threshold,
+                      int topk,
+                      fifo_cand_t *cand,
+                      fifo_stats &read_stats_fifo,
+                      fifo_stats &cand_stats_fifo,
+                      fifo_stats &write_stats_fifo
                       );
 
   void write_cand(
-                  fifo_data_t *cand,
-		  data_t *out);
+                  fifo_cand_t *cand,
+                  burst_cand_t *out,
+                  int capacity,
+                  fifo_stats &stats_fifo);
+
+  void write_stats(
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats);
   
 
   void terminate_cand_fifo(
-                           fifo_data_t *cand);
+                           fifo_cand_t *cand);
+
+  int lowest_bin(
+                 ap_uint<NCAND_BIN> occupied);
   
   void read_history(
                     int ndm,
-                    burst_t *history,
-                    fifo_burst_t &history_fifo
+                    int history_mode,
+                    burst_history_t *history,
+                    const burst_rms_t *rms,
+                    fifo_burst_rms_t &rms_fifo,
+                    fifo_burst_history_t &history_fifo,
+                    fifo_stats &stats_fifo
                     );
 
   void calculate_cand_wrap(
                            fifo_burst_t &in, 
-                           burst_t *previous_history,
-                           burst_t *current_history,
+                           burst_history_t *previous_history,
+                           burst_history_t *current_history,
+                           const burst_rms_t *rms,
                            int ndm,
                            int ntime,
-                           data_t threshold,
-                           fifo_data_t *cand);
+                           int time_offset,
+                           int width_mask,
+                           int history_mode,
+                           snr_t threshold,
+                           int topk,
+                           fifo_cand_t *cand,
+                           fifo_stats &read_stats_fifo,
+                           fifo_stats &cand_stats_fifo,
+                           fifo_stats &write_stats_fifo);
   
   void write_history(
                      int ndm,
-                     burst_t *history,
-                     fifo_burst_t &history_fifo
+                     int history_mode,
+                     burst_history_t *history,
+                     fifo_burst_history_t &history_fifo,
+                     fifo_stats &stats_fifo
                      );
   
-  void fifo2history(
-                    fifo_burst_t &history_fifo,
-                    data_t history[NSAMP_PER_IMG][NBOXCAR-1]
-                    );
-  
-  void history2fifo(
-                    data_t history[NSAMP_PER_IMG][NBOXCAR-1],
-                    fifo_burst_t &history_fifo
-                    );
-
   void calculate_cand(
                       fifo_burst_t &in, 
-                      fifo_burst_t &previous_history_fifo,
-                      fifo_burst_t &current_history_fifo,
+                      fifo_burst_rms_t &rms_fifo,
+                      fifo_burst_history_t &previous_history_fifo,
+                      fifo_burst_history_t &current_history_fifo,
                       int ndm,
                       int ntime,
-                      data_t threshold,
-                      fifo_data_t *cand);
-
-  void calculate_cand_worker(
-                             int ntime,
-                             fifo_burst_t &in,
-                             data_t previous_history[NSAMP_PER_IMG][NBOXCAR-1],
-                             data_t current_history[NSAMP_PER_IMG][NBOXCAR-1],
-                             data_t threshold,
-                             fifo_data_t *cand);
+                      int time_offset,
+                      int width_mask,
+                      int history_mode,
+                      snr_t threshold,
+                      int topk,
+                      fifo_cand_t *cand,
+                      fifo_stats &stats_fifo);
+
+  void calculate_cand_step(
+                           int step,
+                           int ndm,
+                           int ntime,
+                           int time_offset,
+                           int width_mask,
+                           int history_mode,
+                           snr_t threshold,
+                           int topk,
+                           fifo_burst_t &in,
+                           fifo_burst_rms_t &rms_fifo,
+                           fifo_burst_history_t &previous_history_fifo,
+                           fifo_burst_history_t &current_history_fifo,
+                           history_row_t load_history[URAM_DEPTH],
+                           rms_row_t load_rms[NBURST_PER_IMG],
+                           history_row_t search_history[URAM_DEPTH],
+                           const rms_row_t search_rms[NBURST_PER_IMG],
+                           const history_row_t store_history[URAM_DEPTH],
+                           fifo_cand_t *cand,
+                           stats_t &stats);
+
+  bool cand_before(
+                   cand_t a,
+                   cand_t b);
+
+  void sort_cand(
+                 cand_t lane[NSAMP_PER_BURST]);
+
+  void merge_top(
+                 cand_t top[MTOPK],
+                 cand_t lane[NSAMP_PER_BURST],
+                 bool restart);
   
 }
 
+// time_offset is the index of the first image of the launch in the search, modulo MWIDTH is enough
+// Bit l of width_mask searches width 2^l
+// history_mode says if history is read from and written to memory, otherwise it stays on chip for the next launch
+// With topk above 0 only the best topk candidates of each image are sent out, at most MTOPK
 void knl_boxcar(
                 fifo_burst_t &in, 
-                burst_t *previous_history,
-                burst_t *current_history,
+                burst_history_t *previous_history,
+                burst_history_t *current_history,
+                const burst_rms_t *rms,
                 int ndm,
                 int ntime,
-                data_t threshold,
-                data_t *out
+                int time_offset,
+                int width_mask,
+                int history_mode,
+                snr_t threshold,
+                int topk,
+                burst_cand_t *out,
+                int capacity,
+                stats_t *stats
                 ){
   const int max_burst_length = BURST_LENGTH;
   
 #pragma HLS INTERFACE m_axi port = previous_history offset = slave bundle = gmem0 max_read_burst_length =max_burst_length
 #pragma HLS INTERFACE m_axi port = current_history  offset = slave bundle = gmem1 max_read_burst_length =max_burst_length
-#pragma HLS INTERFACE m_axi port = out              offset = slave bundle = gmem2 //max_read_burst_length =max_burst_length
+#pragma HLS INTERFACE m_axi port = rms              offset = slave bundle = gmem0 max_read_burst_length =max_burst_length
+#pragma HLS INTERFACE m_axi port = out              offset = slave bundle = gmem2 max_write_burst_length=max_burst_length
+#pragma HLS INTERFACE m_axi port = stats            offset = slave bundle = gmem3
 #pragma HLS INTERFACE axis port  = in
   
 #pragma HLS INTERFACE s_axilite port = previous_history bundle = control
 #pragma HLS INTERFACE s_axilite port = current_history  bundle = control
+#pragma HLS INTERFACE s_axilite port = rms              bundle = control
 #pragma HLS INTERFACE s_axilite port = ndm              bundle = control
 #pragma HLS INTERFACE s_axilite port = ntime            bundle = control
+#pragma HLS INTERFACE s_axilite port = time_offset      bundle = control
+#pragma HLS INTERFACE s_axilite port = width_mask       bundle = control
+#pragma HLS INTERFACE s_axilite port = history_mode     bundle = control
 #pragma HLS INTERFACE s_axilite port = threshold        bundle = control  
+#pragma HLS INTERFACE s_axilite port = topk             bundle = control
+#pragma HLS INTERFACE s_axilite port = capacity         bundle = control
+#pragma HLS INTERFACE s_axilite port = stats            bundle = control
 #pragma HLS INTERFACE s_axilite port = return           bundle = control
 
-#pragma HLS DATA_PACK variable = previous_history
-#pragma HLS DATA_PACK variable = current_history
+#pragma HLS DATA_PACK variable = stats
 
   int i;
   int j;
@@ -112,62 +190,219 @@ void knl_boxcar(
   int loc_boxcar;
   int loc_img;
 
-  fifo_data_t cand[NSAMP_PER_BURST];
+  fifo_cand_t cand[NSAMP_PER_BURST];
  loop_setup_cand_fifo:
   for(i = 0; i < NSAMP_PER_BURST; i++){
 #pragma HLS PIPELINE
 #pragma HLS STREAM variable=cand[i]
   }
   
+  fifo_stats stats_fifo[NSTATS]; // Counters of each stage
+#pragma HLS STREAM variable=stats_fifo
+  
 #pragma HLS DATAFLOW
-  fill_cand_fifo(in, previous_history, current_history, ndm, ntime, threshold, cand);
-  write_cand(cand, out);
+  fill_cand_fifo(in, previous_history, current_history, rms, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, cand,
+                 stats_fifo[STATS_READ_HISTORY], stats_fifo[STATS_CALCULATE_CAND], stats_fifo[STATS_WRITE_HISTORY]);
+  write_cand(cand, out, capacity, stats_fifo[STATS_WRITE_CAND]);
+  write_stats(stats_fifo, stats);
 }
 
 void fill_cand_fifo(
                     fifo_burst_t &in, 
-                    burst_t *previous_history,
-                    burst_t *current_history,
+                    burst_history_t *previous_history,
+                    burst_history_t *current_history,
+                    const burst_rms_t *rms,
                     int ndm,
                     int ntime,
-                    data_t threshold,
-                    fifo_data_t *cand){
+                    int time_offset,
+                    int width_mask,
+                    int history_mode,
+                    snr_t threshold,
+                    int topk,
+                    fifo_cand_t *cand,
+                    fifo_stats &read_stats_fifo,
+                    fifo_stats &cand_stats_fifo,
+                    fifo_stats &write_stats_fifo){
 
-  calculate_cand_wrap(in, previous_history, current_history, ndm, ntime, threshold, cand);
+  calculate_cand_wrap(in, previous_history, current_history, rms, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, cand,
+                      read_stats_fifo, cand_stats_fifo, write_stats_fifo);
   terminate_cand_fifo(cand);
 }
 
+// Candidates are kept on chip and written out at the end, behind a header of CAND_HEADER records
+// out[0] is the number of candidates written and out[1] the number of them dropped
+// When capacity is reached, a new candidate replaces one with the lowest value if it is above that value, otherwise it is dropped
+// Slots are linked in lists by value and the lowest occupied bin is kept in a register, so a slot is freed in one go
+// Lanes are polled one per iteration, records go out NCAND_PER_BURST to a burst and the last burst is padded with empty records
 void write_cand(
-                fifo_data_t *cand,
-                data_t *out){
+                fifo_cand_t *cand,
+                burst_cand_t *out,
+                int capacity,
+                fifo_stats &stats_fifo){
 
   int i;
-  int off = 0;
+  int k;
+  int lane;
+  int bin;
+  int min_bin;
+  int slot;
+  int head_next;
+  int last_slot;
+  int last_next;
+  int nkept = 0;
+  int nrecord;
+  int ncapacity;
   int nvalid = NSAMP_PER_BURST;
-  data_t val;
-  const int nsamp_per_burst = NSAMP_PER_BURST;
+  bool got;
+  bool empty;
+  uint64_t ndrop = 0;
+  cand_t val;
+  cand_t record;
+  burst_cand_t burst;
+  cand_t buffer[MCAND];
+  int next[MCAND];
+  int head[NCAND_BIN];
+  ap_uint<NCAND_BIN> occupied = 0;
+  stats_t stats = {0, 0, 0, 0, 0};
+  const int mcand   = MCAND;
+  const int mrecord = CAND_HEADER + MCAND;
+
+#pragma HLS ARRAY_PARTITION variable = head complete
+
+  ncapacity = capacity < MCAND ? capacity : MCAND;
   
-  while(nvalid>0){
+  // A poll is active when it gets something
+  // The slot written last is forwarded, so next[] is only read from memory two iterations or more after a write to it
+  lane      = 0;
+  min_bin   = NCAND_BIN;
+  last_slot = -1;
+  last_next = -1;
+ loop_poll_cand:
+  while(nvalid > 0){
+#pragma HLS LOOP_TRIPCOUNT max = mcand
+#pragma HLS PIPELINE II=1
+#pragma HLS DEPENDENCE variable = next inter distance = 2 true
+    got = false;
     for(i = 0; i < NSAMP_PER_BURST; i++){
-#pragma HLS PIPELINE II=nsamp_per_burst
-      if(cand[i].read_nb(val)){
-        if(val==0){
-          nvalid--;
+      if(i == lane){
+        got = cand[i].read_nb(val);
+      }
+    }
+    lane = (lane == NSAMP_PER_BURST - 1) ? 0 : lane + 1;
+    
+    if(got){
+      stats.active++;
+      if(val.range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) == 0){
+        nvalid--;
+      }
+      else{
+        // Values are signed, flip the sign bit so that bins go up with the value
+        bin = val.range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB).to_int() ^ (NCAND_BIN/2);
+        
+        empty = false;
+        if(nkept < ncapacity){
+          slot = nkept;
+          nkept++;
+        }
+        else if(bin > min_bin){
+          slot      = head[min_bin];
+          head_next = (slot == last_slot) ? last_next : next[slot];
+          head[min_bin] = head_next;
+          if(head_next < 0){
+            occupied[min_bin] = 0;
+            empty = true;
+          }
+          ndrop++;
         }
         else{
-          out[off] = val;
-          off++;
+          slot = -1;
+          ndrop++;
+        }
+        
+        if(slot >= 0){
+          last_slot     = slot;
+          last_next     = occupied[bin] ? head[bin] : -1;
+          buffer[slot]  = val;
+          next[slot]    = last_next;
+          head[bin]     = slot;
+          occupied[bin] = 1;
+          
+          // The lowest bin only has to be found again when its list runs empty
+          if(empty){
+            min_bin = lowest_bin(occupied);
+          }
+          else if(bin < min_bin){
+            min_bin = bin;
+          }
         }
       }
     }
-  }  
+    else{
+      stats.stall_empty++;
+    }
+  }
+  
+  nrecord = CAND_HEADER + nkept;
+  burst   = 0;
+  k       = 0;
+ loop_write_cand:
+  for(i = 0; i < nrecord; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mrecord
+#pragma HLS PIPELINE II=1
+    if(i == 0){
+      record = nkept;
+    }
+    else if(i == 1){
+      record = ndrop;
+    }
+    else{
+      record = buffer[i - CAND_HEADER];
+    }
+    burst.range(k*CAND_BITS + CAND_BITS - 1, k*CAND_BITS) = record;
+    if(k == NCAND_PER_BURST - 1 || i == nrecord - 1){
+      out[i/NCAND_PER_BURST] = burst;
+      stats.burst++; // The burst counter is the number of bursts written, the header included
+      burst = 0;
+      k     = 0;
+    }
+    else{
+      k++;
+    }
+  }
+  
+  stats_fifo.write(stats);
+}
+
+// Lowest set bit of the occupied bins, isolated with two's complement and then encoded
+// Bit k of the bin is an OR of the bins with bit k set, so it takes no scan over the bins
+int lowest_bin(
+               ap_uint<NCAND_BIN> occupied){
+  int b;
+  int k;
+  int bin;
+  bool set;
+  ap_uint<NCAND_BIN> lowest;
+
+  lowest = occupied & (~occupied + 1);
+  bin    = 0;
+  for(k = 0; k < CAND_VALUE_BITS; k++){
+    set = false;
+    for(b = 0; b < NCAND_BIN; b++){
+      if((b>>k) & 1){
+        set = set || lowest[b];
+      }
+    }
+    bin |= set<<k;
+  }
+  
+  return bin;
 }
 
 void terminate_cand_fifo(
-                         fifo_data_t *cand){
+                         fifo_cand_t *cand){
   int n;
   
-  // terminate the current block
+  // terminate the current block, a record with width 0
   for(n = 0; n < NSAMP_PER_BURST; n++){
 #pragma HLS UNROLL
     cand[n].write(0);
@@ -177,194 +412,555 @@ void terminate_cand_fifo(
 
 void calculate_cand_wrap(
                          fifo_burst_t &in, 
-                         burst_t *previous_history,
-                         burst_t *current_history,
+                         burst_history_t *previous_history,
+                         burst_history_t *current_history,
+                         const burst_rms_t *rms,
                          int ndm,
                          int ntime,
-                         data_t threshold,
-                         fifo_data_t *cand){
+                         int time_offset,
+                         int width_mask,
+                         int history_mode,
+                         snr_t threshold,
+                         int topk,
+                         fifo_cand_t *cand,
+                         fifo_stats &read_stats_fifo,
+                         fifo_stats &cand_stats_fifo,
+                         fifo_stats &write_stats_fifo){
   
-  fifo_burst_t previous_history_fifo;
-  fifo_burst_t current_history_fifo;
+  fifo_burst_rms_t rms_fifo;
+  fifo_burst_history_t previous_history_fifo;
+  fifo_burst_history_t current_history_fifo;
   
+#pragma HLS STREAM variable=rms_fifo
 #pragma HLS STREAM variable=previous_history_fifo
 #pragma HLS STREAM variable=current_history_fifo
 
 #pragma HLS DATAFLOW
   
-  read_history(ndm, previous_history, previous_history_fifo);
-  calculate_cand(in, previous_history_fifo, current_history_fifo, ndm, ntime, threshold, cand);
-  write_history(ndm, current_history, current_history_fifo);
+  read_history(ndm, history_mode, previous_history, rms, rms_fifo, previous_history_fifo, read_stats_fifo);
+  calculate_cand(in, rms_fifo, previous_history_fifo, current_history_fifo, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, cand, cand_stats_fifo);
+  write_history(ndm, history_mode, current_history, current_history_fifo, write_stats_fifo);
 }
 
 void read_history(
                   int ndm,
-                  burst_t *history,
-                  fifo_burst_t &history_fifo
+                  int history_mode,
+                  burst_history_t *history,
+                  const burst_rms_t *rms,
+                  fifo_burst_rms_t &rms_fifo,
+                  fifo_burst_history_t &history_fifo,
+                  fifo_stats &stats_fifo
                   ){
   
   int i;
   int j;
   int m;
   int loc;
+  int nburst;
+  stats_t stats = {0, 0, 0, 0, 0};
+  const int nburst_per_history = NBURST_RMS_PER_IMG + NBURST_HISTORY_PER_DM;
   
+  // The inverse RMS image of a DM goes first, then its history if it is not on chip
+  nburst = NBURST_RMS_PER_IMG + ((history_mode & HISTORY_LOAD) ? NBURST_HISTORY_PER_DM : 0);
   for(i = 0; i < ndm; i++){
 #pragma HLS LOOP_TRIPCOUNT min=1024 max=1024
+    j = 0;
   loop_read_history:
-    for(j = 0; j < (NBOXCAR-1)*NBURST_PER_IMG; j++){
+    while(j < nburst){
+#pragma HLS LOOP_TRIPCOUNT min=nburst_per_history max=nburst_per_history
 #pragma HLS PIPELINE
-      loc = i*(NBOXCAR-1)*NBURST_PER_IMG+j;
-      history_fifo.write(history[loc]);
+      if(j < NBURST_RMS_PER_IMG){
+        if(rms_fifo.full()){
+          stats.stall_full++;
+        }
+        else{
+          rms_fifo.write(rms[i*NBURST_RMS_PER_IMG+j]);
+          stats.active++;
+          stats.burst++;
+          j++;
+        }
+      }
+      else{
+        if(history_fifo.full()){
+          stats.stall_full++;
+        }
+        else{
+          loc = i*NBURST_HISTORY_PER_DM+j-NBURST_RMS_PER_IMG;
+          history_fifo.write(history[loc]);
+          stats.active++;
+          stats.burst++;
+          j++;
+        }
+      }
     }
   }
+  stats_fifo.write(stats);
 }
 
 void write_history(
                    int ndm,
-                   burst_t *history,
-                   fifo_burst_t &history_fifo
+                   int history_mode,
+                   burst_history_t *history,
+                   fifo_burst_history_t &history_fifo,
+                   fifo_stats &stats_fifo
                    ){
   int i;
   int j;
   int m;
   int loc;
+  int nburst;
+  stats_t stats = {0, 0, 0, 0, 0};
+  const int nburst_per_history = NBURST_HISTORY_PER_DM;
   
+  nburst = (history_mode & HISTORY_STORE) ? NBURST_HISTORY_PER_DM : 0;
   for(i = 0; i < ndm; i++){
 #pragma HLS LOOP_TRIPCOUNT min=1024 max=1024
+    j = 0;
   loop_read_history:
-    for(j = 0; j < (NBOXCAR-1)*NBURST_PER_IMG; j++){
+    while(j < nburst){
+#pragma HLS LOOP_TRIPCOUNT min=nburst_per_history max=nburst_per_history
 #pragma HLS PIPELINE
-      loc = i*(NBOXCAR-1)*NBURST_PER_IMG+j;
-      history[loc] = history_fifo.read();
+      if(history_fifo.empty()){
+        stats.stall_empty++;
+      }
+      else{
+        loc = i*NBURST_HISTORY_PER_DM+j;
+        history[loc] = history_fifo.read();
+        stats.active++;
+        stats.burst++;
+        j++;
+      }
     }
   }
+  stats_fifo.write(stats);
 }
 
 void calculate_cand(
                     fifo_burst_t &in, 
-                    fifo_burst_t &previous_history_fifo,
-                    fifo_burst_t &current_history_fifo,
+                    fifo_burst_rms_t &rms_fifo,
+                    fifo_burst_history_t &previous_history_fifo,
+                    fifo_burst_history_t &current_history_fifo,
                     int ndm,
                     int ntime,
-                    data_t threshold,
-                    fifo_data_t *cand){
-  int i;
-  data_t previous_history[NSAMP_PER_IMG][NBOXCAR-1];
-  data_t current_history[NSAMP_PER_IMG][NBOXCAR-1];
-  
-  const int nsamp_per_burst = NSAMP_PER_BURST;
-#pragma HLS array_reshape variable=previous_history cyclic factor=nsamp_per_burst dim=1
-#pragma HLS array_reshape variable=previous_history complete dim=2
-#pragma HLS array_reshape variable=current_history cyclic factor=nsamp_per_burst dim=1
-#pragma HLS array_reshape variable=current_history complete dim=2
+                    int time_offset,
+                    int width_mask,
+                    int history_mode,
+                    snr_t threshold,
+                    int topk,
+                    fifo_cand_t *cand,
+                    fifo_stats &stats_fifo){
+  int step;
+  stats_t stats = {0, 0, 0, 0, 0};
+  rms_row_t rms0[NBURST_PER_IMG];
+  rms_row_t rms1[NBURST_PER_IMG];
+  rms_row_t rms2[NBURST_PER_IMG];
   
-  for(i = 0; i < ndm; i++){
-    //#pragma HLS DATAFLOW
-    fifo2history(previous_history_fifo, previous_history);
-    calculate_cand_worker(ntime, in, previous_history, current_history, threshold, cand);    
-    history2fifo(current_history, current_history_fifo);
-  } 
-}
-
-void fifo2history(
-                  fifo_burst_t &history_fifo,
-                  data_t history[NSAMP_PER_IMG][NBOXCAR-1]
-                  ){
+  // Kept between launches, DM i has slot (i/NBANK)%NSLOT_PER_BANK of bank i%NBANK and is updated in place
+  // The inverse RMS image of a DM goes with it through the banks
+  // Software emulation shares the banks between CUs, so the host keeps the history off chip there with more than one CU
+  static history_row_t bank0[URAM_DEPTH];
+  static history_row_t bank1[URAM_DEPTH];
+  static history_row_t bank2[URAM_DEPTH];
+#pragma HLS RESOURCE variable = bank0 core = XPM_MEMORY uram
+#pragma HLS RESOURCE variable = bank1 core = XPM_MEMORY uram
+#pragma HLS RESOURCE variable = bank2 core = XPM_MEMORY uram
+#pragma HLS ALLOCATION instances=calculate_cand_step limit=1 function
   
-  int i;
-  int j;
-  burst_t burst;
-  
- loop_fifo2history:
-  for(i = 0; i < (NBOXCAR-1)*NBURST_PER_IMG; i++){
-#pragma HLS PIPELINE
-    burst = history_fifo.read();
-    for(j = 0; j < NSAMP_PER_BURST; j++){
-      history[(i%NBURST_PER_IMG)*NSAMP_PER_BURST+j][i/NBURST_PER_IMG] = burst.data[j];
-    }
+  // Step s loads DM s, searches DM s-1 and stores DM s-2, two more steps than DMs fill and drain the engine
+  // The banks take the three roles in turn, each call passes them in its own order so that a bank has one role in a step
+ loop_calculate_cand:
+  for(step = 0; step < ndm + 2; step += NBANK){
+#pragma HLS LOOP_TRIPCOUNT min=342 max=342
+    calculate_cand_step(step, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, in, rms_fifo, previous_history_fifo, current_history_fifo,
+                        bank0, rms0, bank2, rms2, bank1, cand, stats);
+    calculate_cand_step(step + 1, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, in, rms_fifo, previous_history_fifo, current_history_fifo,
+                        bank1, rms1, bank0, rms0, bank2, cand, stats);
+    calculate_cand_step(step + 2, ndm, ntime, time_offset, width_mask, history_mode, threshold, topk, in, rms_fifo, previous_history_fifo, current_history_fifo,
+                        bank2, rms2, bank1, rms1, bank0, cand, stats);
   }
+  stats_fifo.write(stats);
 }
 
-void calculate_cand_worker(
-                           int ntime,
-                           fifo_burst_t &in,
-                           data_t previous_history[NSAMP_PER_IMG][NBOXCAR-1],
-                           data_t current_history[NSAMP_PER_IMG][NBOXCAR-1],
-                           data_t threshold,
-                           fifo_data_t *cand){
+// Explicit history engine, the history of DM s is loaded and the one of DM s-2 is stored while DM s-1 is searched
+// A search reads and writes a row of its bank per burst, a load writes a row of its bank and a store reads one per NBURST_HISTORY_PER_ROW bursts
+// So no bank has more than one read and one write per iteration, what a dual-port URAM takes at II=1
+// A step is over when all sides are done, a search which is done waits for the other sides, on empty for a load and on full for a store
+void calculate_cand_step(
+                         int step,
+                         int ndm,
+                         int ntime,
+                         int time_offset,
+                         int width_mask,
+                         int history_mode,
+                         snr_t threshold,
+                         int topk,
+                         fifo_burst_t &in,
+                         fifo_burst_rms_t &rms_fifo,
+                         fifo_burst_history_t &previous_history_fifo,
+                         fifo_burst_history_t &current_history_fifo,
+                         history_row_t load_history[URAM_DEPTH],
+                         rms_row_t load_rms[NBURST_PER_IMG],
+                         history_row_t search_history[URAM_DEPTH],
+                         const rms_row_t search_rms[NBURST_PER_IMG],
+                         const history_row_t store_history[URAM_DEPTH],
+                         fifo_cand_t *cand,
+                         stats_t &stats){
+  int i;
   int j;
   int m;
   int n;
+  int b;
   int k;
-  int loc_boxcar;
   int loc_img;
+  int nload;
+  int nsearch;
+  int nstore;
+  int iload;
+  int isearch;
+  int istore;
+  bool ready;
   burst_t burst;
+  rms_row_t load_rms_row;
+  rms_row_t rms_row;
+  rms_t rms;
+  history_row_t load_row;
+  history_row_t store_row;
+  history_row_t search_row;
+  history_row_t next_row;
+  ap_int<SUM_WIDTH> raw;
+  cand_t record;
+  int t;
+  int lsb;
+  int dm           = step - 1;
+  int load_first   = step/NBANK%NSLOT_PER_BANK*NBURST_PER_IMG;        // First row of the slot of a DM
+  int search_first = (step - 1)/NBANK%NSLOT_PER_BANK*NBURST_PER_IMG;
+  int store_first  = (step - 2)/NBANK%NSLOT_PER_BANK*NBURST_PER_IMG;
   
   const int nsamp_per_burst = NSAMP_PER_BURST;
+  const int mburst_per_step = MTIME*NBURST_PER_IMG;
   
-  data_t boxcar[NBOXCAR];
-  data_t max_boxcar[NSAMP_PER_BURST];
+  bool complete[NLEVEL];
+  bool search[NLEVEL];
+  sum_t boxcar[NLEVEL];
+  sum_t sum[NHISTORY];
+  bool set[NLEVEL];
+  sum_t partial;
+  scaled_t scaled;
+  scaled_t max_scaled[NSAMP_PER_BURST];
+  snr_t snr[NSAMP_PER_BURST];
+  int width[NSAMP_PER_BURST];
+  cand_t lane[NSAMP_PER_BURST];
+  cand_t top[MTOPK];
+  const coef_t inv_sqrt_width[NLEVEL] = INV_SQRT_WIDTH;
   
+#pragma HLS array_partition variable=complete complete
+#pragma HLS array_partition variable=search complete
+#pragma HLS array_partition variable=set complete
 #pragma HLS array_reshape variable=boxcar complete
-#pragma HLS array_reshape variable=max_boxcar complete
+#pragma HLS array_reshape variable=sum complete
+#pragma HLS array_reshape variable=max_scaled complete
+#pragma HLS array_reshape variable=snr complete
+#pragma HLS array_reshape variable=width complete
+#pragma HLS array_partition variable=lane complete
+#pragma HLS array_partition variable=top complete
+#pragma HLS array_partition variable=inv_sqrt_width complete
 
-  for(j = 0; j < ntime; j++){
-#pragma HLS LOOP_TRIPCOUNT min=256 max=256
-  loop_calculate_cand_worker:
-    for(m = 0; m < NBURST_PER_IMG; m++){
+  // The inverse RMS image goes first, then the history if it is not on chip
+  nload   = (step < ndm) ? NBURST_RMS_PER_IMG + ((history_mode & HISTORY_LOAD) ? NBURST_HISTORY_PER_DM : 0) : 0;
+  nsearch = (step >= 1 && step <= ndm) ? ntime*NBURST_PER_IMG : 0;
+  nstore  = (step >= 2 && step - 2 < ndm && (history_mode & HISTORY_STORE)) ? NBURST_HISTORY_PER_DM : 0;
+  
+  iload   = 0;
+  isearch = 0;
+  istore  = 0;
+  j       = 0;
+  m       = 0;
+ loop_calculate_cand_step:
+  while(iload < nload || isearch < nsearch || istore < nstore){
+#pragma HLS LOOP_TRIPCOUNT max=mburst_per_step
 #pragma HLS PIPELINE
-      burst = in.read();
+#pragma HLS DEPENDENCE variable=search_history inter false
+    if(iload < NBURST_RMS_PER_IMG && iload < nload){
+      // A row of inverse RMS or history is written once all of its bursts are in
+      if(!rms_fifo.empty()){
+        k = iload%NBURST_RMS_PER_ROW;
+        load_rms_row.range(k*BURST_WIDTH + BURST_WIDTH - 1, k*BURST_WIDTH) = rms_fifo.read();
+        if(k == NBURST_RMS_PER_ROW - 1){
+          load_rms[iload/NBURST_RMS_PER_ROW] = load_rms_row;
+        }
+        iload++;
+      }
+    }
+    else if(iload < nload){
+      if(!previous_history_fifo.empty()){
+        i = iload - NBURST_RMS_PER_IMG;
+        k = i%NBURST_HISTORY_PER_ROW;
+        load_row.range(k*BURST_WIDTH + BURST_WIDTH - 1, k*BURST_WIDTH) = previous_history_fifo.read();
+        if(k == NBURST_HISTORY_PER_ROW - 1){
+          load_history[load_first + i/NBURST_HISTORY_PER_ROW] = load_row;
+        }
+        iload++;
+      }
+    }
+    
+    // A row is read once for all of its bursts
+    if(istore < nstore && !current_history_fifo.full()){
+      k = istore%NBURST_HISTORY_PER_ROW;
+      if(k == 0){
+        store_row = store_history[store_first + istore/NBURST_HISTORY_PER_ROW];
+      }
+      current_history_fifo.write(store_row.range(k*BURST_WIDTH + BURST_WIDTH - 1, k*BURST_WIDTH));
+      istore++;
+    }
+    
+    // Any candidate FIFO may be written, so all of them have to have room
+    ready = true;
+    for(n = 0; n < NSAMP_PER_BURST; n++){
+      ready = ready && !cand[n].full();
+    }
+    
+    // Block b of the tree ends at this image if the image count is a multiple of 2^b, the same for all pixels
+    // Width 2^(b+1) is searched only then, width 1 at every image
+    t = time_offset + j;
+    search[0] = width_mask & 1;
+    for(b = 0; b < NLEVEL-1; b++){
+      complete[b] = ((t + 1) & ((1<<b) - 1)) == 0;
+      search[b+1] = complete[b] && ((width_mask>>(b+1)) & 1);
+      set[b]      = (t>>b) & 1;
+    }
+    
+    if(isearch == nsearch){
+      if(iload < nload){
+        stats.stall_empty++;
+      }
+      else{
+        stats.stall_full++;
+      }
+    }
+    else if(in.empty()){
+      stats.stall_empty++;
+    }
+    else if(!ready){
+      stats.stall_full++;
+    }
+    else{
+      burst      = in.read();
+      rms_row    = search_rms[m];
+      search_row = search_history[search_first + m];
+      next_row   = 0;
       
       for(n = 0; n < NSAMP_PER_BURST; n++){
-        max_boxcar[n] = 0;
         loc_img = m*NSAMP_PER_BURST + n;
-	
-        // Last boxcar
-        boxcar[NBOXCAR-1] = previous_history[loc_img][NBOXCAR-2] + burst.data[n];
-        if(boxcar[NBOXCAR-1]>max_boxcar[n]){
-          max_boxcar[n]=boxcar[NBOXCAR-1];
+        
+        // Block sums of the pixel up to the image before, from the launch before for the first image
+        for(b = 0; b < NHISTORY; b++){
+          lsb = n*HISTORY_PIXEL_BITS + HISTORY_LSB(b);
+          raw = search_row.range(lsb + HISTORY_BITS(b) - 1, lsb);
+          raw = raw << (SUM_WIDTH - HISTORY_BITS(b));
+          raw = raw >> (SUM_WIDTH - HISTORY_BITS(b) - HISTORY_SHIFT);
+          sum[b].range(SUM_WIDTH - 1, 0) = raw;
         }
-        // Boxcars without the first and last one
-        for(k = NBOXCAR - 2; k > 0; k--){
-          boxcar[k] = previous_history[loc_img][k-1] + burst.data[n];
-          if(boxcar[k]>max_boxcar[n]){
-            max_boxcar[n]=boxcar[k];
+        
+        // Width 2^(b+1) is the last complete block of 2^b images plus the current one, which ends here when it is searched
+        // A finished block becomes the last one, the current block of 2^(b+1) images takes the last one of 2^b if bit b is set
+        boxcar[0] = burst.data[n];
+        partial   = boxcar[0];
+        for(b = 0; b < NLEVEL-1; b++){
+          boxcar[b+1] = sum[b] + partial;
+          if(complete[b]){
+            sum[b] = partial;
+          }
+          if(set[b]){
+            partial = boxcar[b+1];
+          }
+        }
+        for(b = 0; b < NHISTORY; b++){
+          lsb = n*HISTORY_PIXEL_BITS + HISTORY_LSB(b);
+          next_row.range(lsb + HISTORY_BITS(b) - 1, lsb) = sum[b].range(HISTORY_SHIFT + HISTORY_BITS(b) - 1, HISTORY_SHIFT);
+        }
+        
+        // Noise of a sum grows with sqrt(width), so sums scaled by 1/sqrt(width) compare between widths
+        // The widest boxcar wins a tie, the per-pixel inverse RMS then turns the best one into S/N
+        max_scaled[n] = 0;
+        width[n]      = 1;
+        for(k = NLEVEL-1; k >= 0; k--){
+          scaled = boxcar[k]*inv_sqrt_width[k];
+          if(search[k] && scaled > max_scaled[n]){
+            max_scaled[n] = scaled;
+            width[n]      = 1<<k;
           }
-          current_history[loc_img][k] = boxcar[k];
-        }	
-	
-        // First boxcar
-        boxcar[0]  = burst.data[n];
-        current_history[loc_img][0] = boxcar[0];
-        if(boxcar[0]>max_boxcar[n]){
-          max_boxcar[n]=boxcar[0];
         }
+        rms.range(RMS_WIDTH - 1, 0) = rms_row.range(n*RMS_WIDTH + RMS_WIDTH - 1, n*RMS_WIDTH);
+        snr[n] = max_scaled[n]*rms;
         
-        // Send out cand above threshold
-        if(max_boxcar[n]>threshold)
-          cand[n].write(max_boxcar[n]);
-      }        
+        // Send out cand above threshold, with where it is, a lane without one holds an empty record
+        lane[n] = 0;
+        if(snr[n]>threshold){
+          record = 0;
+          record.range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB) = snr[n].range();
+          record.range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) = width[n];
+          record.range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB) = loc_img;
+          record.range(CAND_TIME_LSB  + CAND_TIME_BITS  - 1, CAND_TIME_LSB)  = j;
+          record.range(CAND_DM_LSB    + CAND_DM_BITS    - 1, CAND_DM_LSB)    = dm;
+          lane[n] = record;
+          if(topk == 0){
+            cand[n].write(record);
+          }
+        }
+      }
+      
+      search_history[search_first + m] = next_row;
+      
+      // Best records of the image so far, the first burst of an image starts a new list
+      // The list goes out at the last burst, record k to lane k
+      if(topk > 0){
+        sort_cand(lane);
+        merge_top(top, lane, m == 0);
+        if(m == NBURST_PER_IMG-1){
+          for(k = 0; k < MTOPK; k++){
+            if(k < topk && top[k].range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) != 0){
+              cand[k].write(top[k]);
+            }
+          }
+        }
+      }
+      stats.active++;
+      stats.burst++;
+      isearch++;
+      m++;
+      if(m == NBURST_PER_IMG){
+        m = 0;
+        j++;
+      }
     }
   }
 }
 
-void history2fifo(
-                  data_t history[NSAMP_PER_IMG][NBOXCAR-1],
-                  fifo_burst_t &history_fifo
-                  ){
+// Order of candidates of one image, a record comes before an empty one, then higher S/N first and lower pixel first
+bool cand_before(
+                 cand_t a,
+                 cand_t b){
+  cand_key_t key_a;
+  cand_key_t key_b;
+
+  key_a = (a.range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) != 0);
+  key_a = (key_a << CAND_VALUE_BITS) | (a.range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB).to_uint() ^ (NCAND_BIN/2));
+  key_a = (key_a << CAND_PIXEL_BITS) | (NSAMP_PER_IMG - 1 - a.range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB).to_uint());
   
+  key_b = (b.range(CAND_WIDTH_LSB + CAND_WIDTH_BITS - 1, CAND_WIDTH_LSB) != 0);
+  key_b = (key_b << CAND_VALUE_BITS) | (b.range(CAND_VALUE_LSB + CAND_VALUE_BITS - 1, CAND_VALUE_LSB).to_uint() ^ (NCAND_BIN/2));
+  key_b = (key_b << CAND_PIXEL_BITS) | (NSAMP_PER_IMG - 1 - b.range(CAND_PIXEL_LSB + CAND_PIXEL_BITS - 1, CAND_PIXEL_LSB).to_uint());
+
+  return key_a > key_b;
+}
+
+// Bitonic sort of the lanes of a burst, best first
+void sort_cand(
+               cand_t lane[NSAMP_PER_BURST]){
+  int size;
+  int stride;
   int i;
-  int j;
-  int loc;
-  burst_t burst;
+  bool down;
+  cand_t tmp;
+
+ loop_sort_cand:
+  for(size = 2; size <= NSAMP_PER_BURST; size *= 2){
+    for(stride = size/2; stride > 0; stride /= 2){
+      for(i = 0; i < NSAMP_PER_BURST; i++){
+        if((i & stride) == 0){
+          down = ((i & size) == 0);
+          if(down == cand_before(lane[i+stride], lane[i])){
+            tmp            = lane[i];
+            lane[i]        = lane[i+stride];
+            lane[i+stride] = tmp;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Merge the best MTOPK lanes of a sorted burst into the sorted list of an image
+// The list against the lanes in reverse is bitonic, the better of each pair are the best MTOPK and get sorted by a bitonic merge
+void merge_top(
+               cand_t top[MTOPK],
+               cand_t lane[NSAMP_PER_BURST],
+               bool restart){
+  int stride;
+  int i;
+  cand_t tmp;
+  cand_t current;
+
+  for(i = 0; i < MTOPK; i++){
+    current = restart ? (cand_t)0 : top[i];
+    top[i]  = cand_before(lane[MTOPK-1-i], current) ? lane[MTOPK-1-i] : current;
+  }
   
- loop_history2fifo:
-  for(i = 0; i < (NBOXCAR-1)*NBURST_PER_IMG; i++){
-#pragma HLS PIPELINE
-    for(j = 0; j < NSAMP_PER_BURST; j++){
-      loc = i*NSAMP_PER_BURST+j;
-      burst.data[j] = history[(i%NBURST_PER_IMG)*NSAMP_PER_BURST+j][i/NBURST_PER_IMG];
+ loop_merge_top:
+  for(stride = MTOPK/2; stride > 0; stride /= 2){
+    for(i = 0; i < MTOPK; i++){
+      if((i & stride) == 0 && cand_before(top[i+stride], top[i])){
+        tmp           = top[i];
+        top[i]        = top[i+stride];
+        top[i+stride] = tmp;
+      }
     }
-    history_fifo.write(burst);
+  }
+}
+
+void write_stats(
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats){
+  int i;
+  bool finish;
+  uint64_t ncycle;
+  int nrecord[NSTATS];
+  int count[NSTATS];
+  stats_t record;
+  stats_t total[NSTATS];
+#pragma HLS ARRAY_PARTITION variable = nrecord complete
+#pragma HLS ARRAY_PARTITION variable = count   complete
+#pragma HLS ARRAY_PARTITION variable = total   complete
+
+  // Stages send one record per call
+  nrecord[STATS_READ_HISTORY]   = 1;
+  nrecord[STATS_CALCULATE_CAND] = 1;
+  nrecord[STATS_WRITE_HISTORY]  = 1;
+  nrecord[STATS_WRITE_CAND]     = 1;
+  
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS UNROLL
+    count[i] = 0;
+    total[i].active      = 0;
+    total[i].stall_empty = 0;
+    total[i].stall_full  = 0;
+    total[i].burst       = 0;
+  }
+
+  // A poll takes a cycle, so the polls are the cycles of the launch up to the last record
+  ncycle = 0;
+  finish = false;
+ loop_collect_stats:
+  while(!finish){
+#pragma HLS PIPELINE II=1
+    ncycle++;
+    finish = true;
+    for(i = 0; i < NSTATS; i++){
+      if(count[i] < nrecord[i] && stats_fifo[i].read_nb(record)){
+        total[i].active      += record.active;
+        total[i].stall_empty += record.stall_empty;
+        total[i].stall_full  += record.stall_full;
+        total[i].burst       += record.burst;
+        count[i]++;
+      }
+      finish = finish && (count[i] == nrecord[i]);
+    }
+  }
+  
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS PIPELINE
+    total[i].cycle = ncycle;
+    stats[i] = total[i];
   }
 }
@@ -0,0 +1,34 @@
+#include "boxcar.h"
+
+// Feeds images from memory to knl_boxcar, stands for the upstream stage in the test
+extern "C"{
+  void knl_read(
+                const burst_t *in,
+                fifo_burst_t &in_stream,
+                int nburst);
+}
+
+void knl_read(
+              const burst_t *in,
+              fifo_burst_t &in_stream,
+              int nburst){
+#pragma HLS INTERFACE m_axi port = in offset = slave bundle = gmem4
+#pragma HLS INTERFACE axis  port = in_stream
+
+#pragma HLS INTERFACE s_axilite port = in     bundle = control
+#pragma HLS INTERFACE s_axilite port = nburst bundle = control
+#pragma HLS INTERFACE s_axilite port = return bundle = control
+
+#pragma HLS DATA_PACK variable = in
+  
+  const int mburst = MDM*MTIME*NBURST_PER_IMG;
+  
+  int i;
+  
+ loop_read:
+  for(i = 0; i < nburst; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst
+#pragma HLS PIPELINE
+    in_stream.write(in[i]);
+  }
+}
@@ -0,0 +1,366 @@
+/*
+******************************************************************************
+** WRITER CODE FILE
+******************************************************************************
+*/
+
+#include "writer.h"
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int64_t now_ns(){
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (int64_t)now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
+// A write may be cut short, the rest goes after it
+static int write_all(
+                     int fd,
+                     const char *buffer,
+                     uint64_t nbyte){
+  ssize_t n;
+
+  while(nbyte){
+    n = write(fd, buffer, nbyte);
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return EXIT_FAILURE;
+    }
+    buffer += n;
+    nbyte  -= n;
+  }
+  return EXIT_SUCCESS;
+}
+
+// An existing file has to be of the same search, its blocks are walked so that the sequence numbers go on
+// A block cut short by a crash is cut off, new blocks follow the last complete one
+static int open_file(
+                     cand_writer *writer,
+                     const char *file_name){
+  struct stat status;
+  writer_file_header header;
+  writer_block_header block;
+  off_t offset;
+  off_t end;
+
+  writer->fd = open(file_name, O_RDWR | O_CREAT, 0644);
+  if(writer->fd < 0 || fstat(writer->fd, &status)){
+    return EXIT_FAILURE;
+  }
+  if(status.st_size == 0){
+    return write_all(writer->fd, (const char *)&writer->header, sizeof(writer_file_header));
+  }
+
+  if(pread(writer->fd, &header, sizeof(writer_file_header), 0) != sizeof(writer_file_header) ||
+     memcmp(header.magic, writer->header.magic, sizeof(header.magic)) ||
+     header.version       != writer->header.version ||
+     header.header_bytes  != writer->header.header_bytes ||
+     header.block_bytes   != writer->header.block_bytes ||
+     header.record_bytes  != writer->header.record_bytes ||
+     header.ndm           != writer->header.ndm ||
+     header.ntime         != writer->header.ntime ||
+     header.nsamp_per_img != writer->header.nsamp_per_img ||
+     header.width_mask    != writer->header.width_mask ||
+     header.topk          != writer->header.topk ||
+     header.threshold     != writer->header.threshold){
+    return EXIT_FAILURE;
+  }
+  writer->header.created = header.created;
+
+  offset = sizeof(writer_file_header);
+  while(offset + (off_t)sizeof(writer_block_header) <= status.st_size &&
+        pread(writer->fd, &block, sizeof(writer_block_header), offset) == sizeof(writer_block_header) &&
+        memcmp(block.magic, WRITER_BLOCK_MAGIC, sizeof(block.magic)) == 0){
+    end = offset + sizeof(writer_block_header) + (off_t)block.ncand*sizeof(cand_record);
+    if(end > status.st_size){
+      break;
+    }
+    writer->sequence = block.sequence + 1;
+    offset = end;
+  }
+  if(offset < status.st_size && ftruncate(writer->fd, offset)){
+    return EXIT_FAILURE;
+  }
+  if(lseek(writer->fd, 0, SEEK_END) < 0){
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// A socket left by a run before is replaced
+static int open_socket(
+                       cand_writer *writer,
+                       const char *socket_path){
+  struct sockaddr_un address;
+
+  if(strlen(socket_path) >= sizeof(address.sun_path)){
+    return EXIT_FAILURE;
+  }
+  memset(&address, 0x00, sizeof(struct sockaddr_un));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  strcpy(writer->socket_path, socket_path);
+
+  writer->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(writer->listen_fd < 0){
+    return EXIT_FAILURE;
+  }
+  unlink(socket_path);
+  if(bind(writer->listen_fd, (struct sockaddr *)&address, sizeof(struct sockaddr_un)) ||
+     listen(writer->listen_fd, WRITER_MSUBSCRIBER) ||
+     fcntl(writer->listen_fd, F_SETFL, O_NONBLOCK)){
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static void drop_subscriber(
+                            writer_subscriber *subscriber){
+  close(subscriber->fd);
+  subscriber->fd    = -1;
+  subscriber->nbyte = 0;
+  subscriber->nsent = 0;
+}
+
+// Sends as much of the pending bytes as the socket takes without waiting, a subscriber which went away is dropped
+static void flush_subscriber(
+                             writer_subscriber *subscriber){
+  ssize_t n;
+
+  while(subscriber->fd >= 0 && subscriber->nsent < subscriber->nbyte){
+    n = send(subscriber->fd, subscriber->pending + subscriber->nsent, subscriber->nbyte - subscriber->nsent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(n > 0){
+      subscriber->nsent += n;
+    }
+    else if(n < 0 && errno == EINTR){
+      continue;
+    }
+    else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      break;
+    }
+    else{
+      drop_subscriber(subscriber);
+    }
+  }
+}
+
+// A new subscriber starts with the file header, then gets the blocks from the next one on
+static void accept_subscribers(
+                               cand_writer *writer){
+  int fd;
+  int i;
+  writer_subscriber *subscriber;
+
+  if(writer->listen_fd < 0){
+    return;
+  }
+  while((fd = accept(writer->listen_fd, NULL, NULL)) >= 0){
+    for(i = 0; i < WRITER_MSUBSCRIBER && writer->subscriber[i].fd >= 0; i++){
+    }
+    if(i == WRITER_MSUBSCRIBER || fcntl(fd, F_SETFL, O_NONBLOCK)){
+      close(fd);
+      continue;
+    }
+    subscriber        = &writer->subscriber[i];
+    subscriber->fd    = fd;
+    subscriber->nbyte = sizeof(writer_file_header);
+    subscriber->nsent = 0;
+    memcpy(subscriber->pending, &writer->header, sizeof(writer_file_header));
+    flush_subscriber(subscriber);
+  }
+}
+
+static void write_block(
+                        cand_writer *writer,
+                        const writer_slot *slot){
+  int i;
+  writer_subscriber *subscriber;
+
+  if(writer->fd >= 0 && !writer->error){
+    if(write_all(writer->fd, (const char *)&slot->header, sizeof(writer_block_header)) ||
+       write_all(writer->fd, (const char *)slot->record, slot->header.ncand*sizeof(cand_record))){
+      writer->error = 1;
+    }
+    else{
+      writer->nwritten++;
+    }
+  }
+
+  // A subscriber still busy with a block before skips this one, it sees the gap in the sequence numbers
+  for(i = 0; i < WRITER_MSUBSCRIBER; i++){
+    subscriber = &writer->subscriber[i];
+    flush_subscriber(subscriber);
+    if(subscriber->fd < 0){
+      continue;
+    }
+    if(subscriber->nsent < subscriber->nbyte){
+      writer->nskip++;
+      continue;
+    }
+    memcpy(subscriber->pending, &slot->header, sizeof(writer_block_header));
+    memcpy(subscriber->pending + sizeof(writer_block_header), slot->record, slot->header.ncand*sizeof(cand_record));
+    subscriber->nbyte = sizeof(writer_block_header) + slot->header.ncand*sizeof(cand_record);
+    subscriber->nsent = 0;
+    flush_subscriber(subscriber);
+  }
+}
+
+// Wakes up for each block pushed, or every WRITER_POLL milliseconds to take new subscribers and send pending bytes
+static void *writer_thread(
+                           void *argument){
+  cand_writer *writer = (cand_writer *)argument;
+  struct timespec deadline;
+  uint64_t tail;
+  int stop;
+  int i;
+
+  while(true){
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += WRITER_POLL*1000000L;
+    deadline.tv_sec  += deadline.tv_nsec/1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    sem_timedwait(&writer->ready, &deadline);
+
+    // The stop flag is set after the last push, so the last block is seen with it
+    stop = __atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&writer->tail, __ATOMIC_ACQUIRE);
+    accept_subscribers(writer);
+    for(i = 0; i < WRITER_MSUBSCRIBER; i++){
+      flush_subscriber(&writer->subscriber[i]);
+    }
+    while(writer->head != tail){
+      write_block(writer, &writer->slot[writer->head%WRITER_NSLOT]);
+      __atomic_store_n(&writer->head, writer->head + 1, __ATOMIC_RELEASE);
+    }
+    if(stop){
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Without a file name or a socket path that sink is not used
+int writer_create(
+                  cand_writer *writer,
+                  const writer_config *config,
+                  const char *file_name,
+                  const char *socket_path){
+  int i;
+  writer_file_header *header = &writer->header;
+
+  memset(writer, 0x00, sizeof(cand_writer));
+  writer->fd        = -1;
+  writer->listen_fd = -1;
+  for(i = 0; i < WRITER_MSUBSCRIBER; i++){
+    writer->subscriber[i].fd      = -1;
+    writer->subscriber[i].pending = (char *)malloc(sizeof(writer_block_header) + MCAND*sizeof(cand_record));
+    if(writer->subscriber[i].pending == NULL){
+      return EXIT_FAILURE;
+    }
+  }
+  for(i = 0; i < WRITER_NSLOT; i++){
+    writer->slot[i].record = (cand_record *)malloc(MCAND*sizeof(cand_record));
+    if(writer->slot[i].record == NULL){
+      return EXIT_FAILURE;
+    }
+  }
+
+  memcpy(header->magic, WRITER_MAGIC, sizeof(header->magic));
+  header->version       = WRITER_VERSION;
+  header->header_bytes  = sizeof(writer_file_header);
+  header->block_bytes   = sizeof(writer_block_header);
+  header->record_bytes  = sizeof(cand_record);
+  header->ndm           = config->ndm;
+  header->ntime         = config->ntime;
+  header->nsamp_per_img = NSAMP_PER_IMG;
+  header->width_mask    = config->width_mask;
+  header->topk          = config->topk;
+  header->threshold     = config->threshold;
+  header->created       = now_ns();
+
+  if(file_name != NULL && open_file(writer, file_name)){
+    return EXIT_FAILURE;
+  }
+  if(socket_path != NULL && open_socket(writer, socket_path)){
+    return EXIT_FAILURE;
+  }
+  if(sem_init(&writer->ready, 0, 0) ||
+     pthread_create(&writer->thread, NULL, writer_thread, writer)){
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Never waits, a block which finds the queue full is counted as lost
+// Records are copied, the caller may reuse them at once
+int writer_push(
+                cand_writer *writer,
+                const cand_record *record,
+                uint64_t nrecord,
+                uint64_t ndrop,
+                int64_t time_offset){
+  uint64_t head = __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = writer->tail;
+  writer_slot *slot;
+
+  if(nrecord > MCAND){
+    return EXIT_FAILURE;
+  }
+  if(tail - head == WRITER_NSLOT){
+    writer->sequence++;
+    writer->nlost++;
+    return EXIT_SUCCESS;
+  }
+
+  slot = &writer->slot[tail%WRITER_NSLOT];
+  memcpy(slot->header.magic, WRITER_BLOCK_MAGIC, sizeof(slot->header.magic));
+  slot->header.ncand       = nrecord;
+  slot->header.sequence    = writer->sequence++;
+  slot->header.time_offset = time_offset;
+  slot->header.timestamp   = now_ns();
+  slot->header.ndrop       = ndrop;
+  memcpy(slot->record, record, nrecord*sizeof(cand_record));
+
+  __atomic_store_n(&writer->tail, tail + 1, __ATOMIC_RELEASE);
+  sem_post(&writer->ready);
+
+  return EXIT_SUCCESS;
+}
+
+// Blocks still in the queue are written before the thread stops, bytes pending for a slow subscriber are not
+// The counters stay for the caller
+int writer_destroy(
+                   cand_writer *writer){
+  int i;
+
+  __atomic_store_n(&writer->stop, 1, __ATOMIC_RELEASE);
+  sem_post(&writer->ready);
+  pthread_join(writer->thread, NULL);
+  sem_destroy(&writer->ready);
+
+  if(writer->fd >= 0){
+    close(writer->fd);
+  }
+  if(writer->listen_fd >= 0){
+    close(writer->listen_fd);
+    unlink(writer->socket_path);
+  }
+  for(i = 0; i < WRITER_MSUBSCRIBER; i++){
+    if(writer->subscriber[i].fd >= 0){
+      drop_subscriber(&writer->subscriber[i]);
+    }
+    free(writer->subscriber[i].pending);
+  }
+  for(i = 0; i < WRITER_NSLOT; i++){
+    free(writer->slot[i].record);
+  }
+
+  return writer->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
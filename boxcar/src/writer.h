@@ -0,0 +1,104 @@
+/*
+******************************************************************************
+** WRITER CODE HEADER FILE
+******************************************************************************
+*/
+
+#pragma once
+
+#include "boxcar.h"
+#include <pthread.h>
+#include <semaphore.h>
+
+// Append-only candidate file, a file header and then one block per launch, in the byte order of the host
+// A block is a block header and its candidate records, a local socket gets the same bytes from the file header on
+// Blocks go through a queue to a background thread, a block which finds the queue full is lost and its sequence number skipped
+#define WRITER_MAGIC        "BOXCAND"  // Magic of the file header, with its terminating zero
+#define WRITER_BLOCK_MAGIC  "BLK"      // Magic of a block header, with its terminating zero
+#define WRITER_VERSION      1
+#define WRITER_NSLOT        16         // Blocks in the queue, a power of two
+#define WRITER_MSUBSCRIBER  4          // Max number of processes on the socket
+#define WRITER_POLL         100        // Milliseconds between checks of the socket without blocks
+
+// What the search is, it goes to the file header
+typedef struct writer_config{
+  int ndm;
+  int ntime;          // Images per block
+  int width_mask;
+  int topk;
+  float threshold;
+}writer_config;
+
+typedef struct writer_file_header{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes;  // Size of the file header
+  uint32_t block_bytes;   // Size of a block header
+  uint32_t record_bytes;  // Size of a record, a cand_record with value, dm, time, pixel and width
+  int32_t ndm;
+  int32_t ntime;
+  int32_t nsamp_per_img;
+  int32_t width_mask;
+  int32_t topk;
+  float threshold;
+  int64_t created;        // Nanoseconds since the epoch when the file was started
+}writer_file_header;
+
+typedef struct writer_block_header{
+  char magic[4];
+  uint32_t ncand;         // Records after the header
+  uint64_t sequence;      // One per block pushed, it goes on from the last block of the file
+  int64_t time_offset;    // First image of the block in the search, time of a record is counted from it
+  int64_t timestamp;      // Nanoseconds since the epoch when the block was pushed
+  uint64_t ndrop;         // Candidates dropped beyond the capacity of the launch
+}writer_block_header;
+
+// Block in the queue, room for MCAND records
+typedef struct writer_slot{
+  writer_block_header header;
+  cand_record *record;
+}writer_slot;
+
+// Process on the socket, a block it is slow to take stays pending and the blocks after it are skipped
+typedef struct writer_subscriber{
+  int fd;
+  char *pending;
+  uint64_t nbyte;
+  uint64_t nsent;
+}writer_subscriber;
+
+// The launch loop only moves tail and the thread only moves head, so the queue needs no lock
+typedef struct cand_writer{
+  writer_file_header header;
+  writer_slot slot[WRITER_NSLOT];
+  uint64_t head;          // Next block the thread takes
+  uint64_t tail;          // Next block pushed
+  uint64_t sequence;
+  int stop;
+  int error;              // The file could not be written, the socket still gets blocks
+  sem_t ready;
+  pthread_t thread;
+  int fd;                 // File, -1 without one
+  int listen_fd;          // Socket, -1 without one
+  char socket_path[LINE_LENGTH];
+  writer_subscriber subscriber[WRITER_MSUBSCRIBER];
+  uint64_t nwritten;      // Blocks written to the file
+  uint64_t nlost;         // Blocks lost from a full queue
+  uint64_t nskip;         // Blocks skipped to slow subscribers
+}cand_writer;
+
+int writer_create(
+                  cand_writer *writer,
+                  const writer_config *config,
+                  const char *file_name,
+                  const char *socket_path);
+
+int writer_push(
+                cand_writer *writer,
+                const cand_record *record,
+                uint64_t nrecord,
+                uint64_t ndrop,
+                int64_t time_offset);
+
+int writer_destroy(
+                   cand_writer *writer);
@@ -0,0 +1,204 @@
+/*
+******************************************************************************
+** FFT CODE FILE
+******************************************************************************
+*/
+
+#include "fft.h"
+#include "util_sdaccel.h"
+
+// 2D inverse FFT of gridded UV planes, rows first and then columns as the kernel does
+// Each 1D FFT is scaled by 1/fft_size, rows and columns are spread across threads
+int fft(
+        uv_data_t *in,
+        img_t *out,
+        int fft_size,
+        int nimg
+        ){
+  int i;
+  int j;
+  int k;
+  long loc;
+  long nsamp_per_img = (long)fft_size*fft_size;
+  double *re = NULL;
+  double *im = NULL;
+  double *w_re = NULL;
+  double *w_im = NULL;
+
+  re   = (double *)malloc(nsamp_per_img*sizeof(double));
+  im   = (double *)malloc(nsamp_per_img*sizeof(double));
+  w_re = (double *)malloc(fft_size/2*sizeof(double));
+  w_im = (double *)malloc(fft_size/2*sizeof(double));
+  
+  // Twiddles once for all rows and columns
+  for(j = 0; j < fft_size/2; j++){
+    w_re[j] = cos(2*M_PI*j/fft_size);
+    w_im[j] = sin(2*M_PI*j/fft_size);
+  }
+  
+  for(i = 0; i < nimg; i++){
+    for(j = 0; j < nsamp_per_img; j++){
+      loc   = (long)i*nsamp_per_img + j;
+      re[j] = in[2*loc];
+      im[j] = in[2*loc+1];
+    }
+    
+    // Row FFT
+#pragma omp parallel for
+    for(j = 0; j < fft_size; j++){
+      fft_1d(&re[(long)j*fft_size], &im[(long)j*fft_size], w_re, w_im, fft_size);
+    }
+
+    // Column FFT, each thread has its own column
+#pragma omp parallel private(j, k)
+    {
+      double *col_re = (double *)malloc(fft_size*sizeof(double));
+      double *col_im = (double *)malloc(fft_size*sizeof(double));
+#pragma omp for
+      for(j = 0; j < fft_size; j++){
+        for(k = 0; k < fft_size; k++){
+          col_re[k] = re[(long)k*fft_size+j];
+          col_im[k] = im[(long)k*fft_size+j];
+        }
+        fft_1d(col_re, col_im, w_re, w_im, fft_size);
+        for(k = 0; k < fft_size; k++){
+          re[(long)k*fft_size+j] = col_re[k];
+        }
+      }
+      free(col_re);
+      free(col_im);
+    }
+    
+    // Image is the real part
+    for(j = 0; j < nsamp_per_img; j++){
+      out[(long)i*nsamp_per_img + j] = (img_t)re[j];
+    }
+  }
+
+  free(re);
+  free(im);
+  free(w_re);
+  free(w_im);
+  
+  return EXIT_SUCCESS;
+}
+
+// In-place radix-2 inverse FFT scaled by 1/fft_size, w holds the fft_size/2 twiddles of exp(2*pi*i*j/fft_size)
+int fft_1d(
+           double *re,
+           double *im,
+           const double *w_re,
+           const double *w_im,
+           int fft_size
+           ){
+  int i;
+  int j;
+  int k;
+  int half;
+  int step;
+  double tmp;
+  double t_re;
+  double t_im;
+  
+  // Bit reversal
+  for(i = 1, j = 0; i < fft_size; i++){
+    k = fft_size >> 1;
+    while(j & k){
+      j ^= k;
+      k >>= 1;
+    }
+    j |= k;
+    if(i < j){
+      tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+      tmp = im[i]; im[i] = im[j]; im[j] = tmp;
+    }
+  }
+  
+  for(half = 1; half < fft_size; half <<= 1){
+    step = fft_size/(2*half);
+    for(i = 0; i < fft_size; i += 2*half){
+      for(j = 0; j < half; j++){
+        t_re = re[i+j+half]*w_re[j*step] - im[i+j+half]*w_im[j*step];
+        t_im = re[i+j+half]*w_im[j*step] + im[i+j+half]*w_re[j*step];
+        re[i+j+half] = (re[i+j] - t_re)/2.0;
+        im[i+j+half] = (im[i+j] - t_im)/2.0;
+        re[i+j]      = (re[i+j] + t_re)/2.0;
+        im[i+j]      = (im[i+j] + t_im)/2.0;
+      }
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Twiddle factors of inverse FFT for the kernel, fft_size/2 complex numbers
+int make_twiddle(
+                 twiddle_t *twiddle,
+                 int fft_size
+                 ){
+  int i;
+  
+  for(i = 0; i < fft_size/2; i++){
+    twiddle[2*i]   = (twiddle_t)cos(2*M_PI*i/fft_size);
+    twiddle[2*i+1] = (twiddle_t)sin(2*M_PI*i/fft_size);
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Each turn stage has nothing to fill while it sends the last plane or image out, or the last two blocks for read_row
+int fft_stats(
+              int fft_size,
+              int nimg,
+              stats_t *stats){
+  uint64_t nburst_per_uv  = (uint64_t)fft_size*fft_size/NSAMP_PER_BURST;
+  uint64_t nburst_per_img = (uint64_t)fft_size*fft_size/NSAMP_PER_IMG_BURST;
+  int nstage = (int)round(log2(fft_size));
+  int i;
+  int half;
+  
+  memset(stats, 0x00, NSTATS*sizeof(stats_t));
+  
+  stats[STATS_READ_ROW].active       = nimg*nburst_per_uv;
+  stats[STATS_READ_ROW].stall_full   = 2*fft_size;
+  stats[STATS_READ_ROW].burst        = nimg*nburst_per_uv;
+  stats[STATS_TURN_PLANE].active     = nimg*nburst_per_uv;
+  stats[STATS_TURN_PLANE].stall_full = nburst_per_uv;
+  stats[STATS_TURN_PLANE].burst      = nimg*nburst_per_uv;
+  stats[STATS_STREAM_IMG].active     = nimg*nburst_per_uv;
+  stats[STATS_STREAM_IMG].stall_full = nburst_per_img;
+  stats[STATS_STREAM_IMG].burst      = nimg*nburst_per_img;
+  
+  // A stage waits on its output for the last step, stages beyond nstage pass bursts through
+  for(i = 0; i < MFFT_STAGE; i++){
+    half = 1 << i;
+    stats[STATS_ROW_STAGE + i].active = nimg*nburst_per_uv;
+    stats[STATS_ROW_STAGE + i].burst  = nimg*nburst_per_uv;
+    if(i < nstage){
+      stats[STATS_ROW_STAGE + i].stall_full = (2*half > 2*FFT_DISTANCE) ? 2*half : 2*FFT_DISTANCE;
+    }
+    stats[STATS_COL_STAGE + i] = stats[STATS_ROW_STAGE + i];
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  uint64_t niteration;
+  
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "utilisation");
+  for(i = 0; i < nstats; i++){
+    niteration = stats[i].active + stats[i].stall_empty + stats[i].stall_full;
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst,
+            niteration ? 100.0*stats[i].active/niteration : 0.0);
+  }
+  
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+******************************************************************************
+** FFT CODE HEADER FILE
+******************************************************************************
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <math.h>
+#include <inttypes.h>
+#include <ap_fixed.h>
+#include <ap_int.h>
+#include <hls_stream.h>
+#include "ap_axi_sdata.h"
+
+#define FLOAT     1
+#define DATA_WIDTH     16       // We use ap_fixed 16-bits complex numbers for UV, same as grid
+#define IMG_WIDTH      8        // We use ap_fixed 8-bits real numbers for image, same as boxcar
+// The plane of turn_plane and the image of stream_img are ping-pong buffers in URAM, a URAM is 4096 words of 72 bits
+// At MFFT_SIZE 256 the plane takes 2x16 URAMs of 4096 64-bit samples and the image 2x4x2 URAMs of 1024 128-bit words
+// That is 48 URAMs, next to the 864 of the 4 boxcar CUs it stays in the 960 of a U280, MFFT_SIZE 512 would take 144
+#define MFFT_SIZE            256      // Max FFT size, the size is given at run time and is a power of two from NSAMP_PER_IMG_BURST on
+#define MFFT_STAGE           8        // log2(MFFT_SIZE)
+#define FFT_DISTANCE         4        // Iterations at least between a write and a read of the same word of a ping-pong buffer
+#define BURST_WIDTH         512
+#define NSAMP_PER_BURST     (BURST_WIDTH/(2*DATA_WIDTH))
+#define NSAMP_PER_IMG_BURST (BURST_WIDTH/IMG_WIDTH)
+
+#define MDM                 1024
+#define MTIME               256
+#define MIMG                (MDM*MTIME)
+#define NSAMP_PER_IMG       65536    // Samples of an image knl_boxcar takes, 256^2, same as boxcar
+#define MSAMP_PER_IMG       (MFFT_SIZE*MFFT_SIZE)  // MFFT_SIZE^2
+#define MBURST_PER_UV       (MSAMP_PER_IMG/NSAMP_PER_BURST)
+#define MBURST_PER_IMG      (MSAMP_PER_IMG/NSAMP_PER_IMG_BURST)
+#define NBURST_TWIDDLE      (MFFT_SIZE/(2*NSAMP_PER_BURST)) // Twiddles of MFFT_SIZE serve every smaller size
+
+#define INTEGER_WIDTH       (DATA_WIDTH/2)
+#define IMG_INTEGER_WIDTH   (IMG_WIDTH/2)
+#define FFT_DATA_WIDTH      32       // Width used inside FFT
+#define FFT_INTEGER_WIDTH   10       // Every stage is scaled by 1/2, so the FFT never grows beyond the input range
+#define TWIDDLE_WIDTH       16
+#define TWIDDLE_INTEGER_WIDTH 2
+
+#define DATA_RANGE          127
+#define NSAMP_PER_UV_IN     4368     // Number of non-zero cells in the grid
+
+typedef ap_fixed<DATA_WIDTH, INTEGER_WIDTH> uv_data_t;  // The size of this should be DATA_WIDTH
+typedef ap_fixed<IMG_WIDTH, IMG_INTEGER_WIDTH> img_t;   // The size of this should be IMG_WIDTH
+typedef ap_fixed<FFT_DATA_WIDTH, FFT_INTEGER_WIDTH> fft_data_t;
+typedef ap_fixed<TWIDDLE_WIDTH, TWIDDLE_INTEGER_WIDTH> twiddle_t;
+
+typedef ap_uint<2*DATA_WIDTH> uv_t; // Use for the top-level interface
+typedef ap_uint<2*FFT_DATA_WIDTH> fft_t; // Complex sample inside FFT, real part in the low half
+typedef ap_uint<NSAMP_PER_BURST*IMG_WIDTH> img_word_t; // Image samples of one burst of FFT lanes
+
+#define MAX_PALTFORMS       16
+#define MAX_DEVICES         16
+#define PARAM_VALUE_SIZE    1024
+#define MEM_ALIGNMENT       4096  // memory alignment on device
+#define LINE_LENGTH         4096
+
+typedef struct burst_uv{
+  uv_t data[NSAMP_PER_BURST];
+}burst_uv; // The size of this should be 512; BURST_DATA_WIDTH
+
+typedef struct burst_img{
+  img_t data[NSAMP_PER_IMG_BURST];
+}burst_img; // The size of this should be 512, same as burst_t of boxcar
+
+typedef hls::stream<burst_img> fifo_img;
+
+// One sample of NSAMP_PER_BURST independent FFTs, a burst goes through an FFT stage every clock
+typedef struct burst_fft{
+  fft_data_t re[NSAMP_PER_BURST];
+  fft_data_t im[NSAMP_PER_BURST];
+}burst_fft;
+
+typedef hls::stream<burst_fft> fifo_fft;
+
+typedef ap_axiu<BURST_WIDTH, 0, 0, 0> stream_t; 
+typedef hls::stream<stream_t> stream_uv; // Same as the output of knl_grid
+
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ_ROW      0
+#define STATS_TURN_PLANE    1
+#define STATS_STREAM_IMG    2
+#define STATS_ROW_STAGE     3                          // First of MFFT_STAGE row stages
+#define STATS_COL_STAGE     (STATS_ROW_STAGE+MFFT_STAGE) // First of MFFT_STAGE column stages
+#define NSTATS              (STATS_COL_STAGE+MFFT_STAGE)
+
+int fft(
+        uv_data_t *in,
+        img_t *out,
+        int fft_size,
+        int nimg
+        );
+
+int fft_1d(
+           double *re,
+           double *im,
+           const double *w_re,
+           const double *w_im,
+           int fft_size
+           );
+
+int make_twiddle(
+                 twiddle_t *twiddle,
+                 int fft_size
+                 );
+
+int fft_stats(
+              int fft_size,
+              int nimg,
+              stats_t *stats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);
@@ -0,0 +1,327 @@
+/*
+******************************************************************************
+** MAIN FUNCTION
+******************************************************************************
+*/
+
+#include "util_sdaccel.h"
+#include "fft.h"
+
+int main(int argc, char* argv[]){
+  // Check argument
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "ERROR: Failed to execute the program!\n");
+    fprintf(stderr, "USAGE: %s xclbin [fft_size [ndm]]\n", argv[0]);
+    fprintf(stderr, "INFO: Please re-execute it with the above usage method!\n");
+    return EXIT_FAILURE;
+  }	
+
+  // Prepare host buffers
+  uint64_t ndata1;
+  uint64_t ndata2;
+  uint64_t ndata3;
+  cl_int ndm          = 16;
+  cl_int ntime_per_cu = 16;
+  cl_int fft_size     = 256;
+  cl_int nimg;
+  uint64_t nsamp_per_img;
+  
+  if(is_hw_emulation()){
+    ndm          = 1;
+    ntime_per_cu = 2;
+    fft_size     = 256;
+  }
+  if(is_sw_emulation()){
+    ndm          = 1;
+    ntime_per_cu = 2;
+    fft_size     = 256;
+  }
+  if(argc >= 3){
+    fft_size = atoi(argv[2]);
+  }
+  if(argc >= 4){
+    ndm = atoi(argv[3]);
+  }
+  if(fft_size < NSAMP_PER_IMG_BURST || fft_size > MFFT_SIZE || (fft_size & (fft_size-1))){
+    fprintf(stderr, "ERROR: FFT size %d should be a power of two from %d to %d!\n", fft_size, NSAMP_PER_IMG_BURST, MFFT_SIZE);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  if((uint64_t)fft_size*fft_size != NSAMP_PER_IMG){
+    fprintf(stderr, "ERROR: FFT size %d gives images of %d samples, knl_boxcar takes %d!\n", fft_size, fft_size*fft_size, NSAMP_PER_IMG);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  if(ndm < 1 || ndm > MDM){
+    fprintf(stderr, "ERROR: ndm %d should be from 1 to %d!\n", ndm, MDM);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  nimg          = ndm*ntime_per_cu;
+  nsamp_per_img = (uint64_t)fft_size*fft_size;
+  
+  ndata1 = MFFT_SIZE;
+  ndata2 = 2*nimg*nsamp_per_img;
+  ndata3 = nimg*nsamp_per_img;
+  
+  uv_data_t *in = NULL;
+  img_t *sw_out = NULL;
+  img_t *hw_out = NULL;
+  twiddle_t *twiddle = NULL;
+  stats_t *sw_stats = NULL;
+  stats_t *hw_stats = NULL;
+  char stage_name[NSTATS][32] = {"read_row", "turn_plane", "stream_img"};
+  const char *stage[NSTATS];
+  int k;
+  
+  for(k = 0; k < MFFT_STAGE; k++){
+    snprintf(stage_name[STATS_ROW_STAGE + k], sizeof(stage_name[0]), "row_stage%d", k);
+    snprintf(stage_name[STATS_COL_STAGE + k], sizeof(stage_name[0]), "col_stage%d", k);
+  }
+  for(k = 0; k < NSTATS; k++){
+    stage[k] = stage_name[k];
+  }
+  
+  in      = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(uv_data_t));
+  sw_out  = (img_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(img_t));
+  hw_out  = (img_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(img_t));
+  twiddle = (twiddle_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(twiddle_t));
+  sw_stats = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_stats = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  
+  fprintf(stdout, "INFO: %f MB memory used on host in total\n",
+	  (ndata2*DATA_WIDTH + 2*ndata3*IMG_WIDTH + ndata1*TWIDDLE_WIDTH)/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %f MB memory used on device in total\n",
+	  (ndata2*DATA_WIDTH + ndata3*IMG_WIDTH + ndata1*TWIDDLE_WIDTH)/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %f MB memory used on device for raw input\n",
+	  ndata2*DATA_WIDTH/(8*1024.*1024.));  
+  fprintf(stdout, "INFO: %f MB memory used on device for raw output\n",
+	  ndata3*IMG_WIDTH/(8*1024.*1024.));  
+
+  // Prepare input, only NSAMP_PER_UV_IN cells of a grid are filled as what knl_grid does
+  uint64_t i;
+  uint64_t j;
+  uint64_t loc;
+  srand(time(NULL));
+  memset(in, 0x00, ndata2*sizeof(uv_data_t));
+  for(i = 0; i < nimg; i++){
+    for(j = 0; j < NSAMP_PER_UV_IN; j++){
+      loc = i*nsamp_per_img + rand()%nsamp_per_img;
+      in[2*loc]   = (uv_data_t)(0.99*(rand()%DATA_RANGE));
+      in[2*loc+1] = (uv_data_t)(0.99*(rand()%DATA_RANGE));
+    }
+  }
+  make_twiddle(twiddle, MFFT_SIZE);
+  memset(sw_out, 0x00, ndata3*sizeof(img_t));
+  memset(hw_out, 0x00, ndata3*sizeof(img_t));
+  memset(hw_stats, 0x00, NSTATS*sizeof(stats_t));
+  
+  // Calculate on host
+  cl_float cpu_elapsed_time;
+  struct timespec host_start;
+  struct timespec host_finish;
+  clock_gettime(CLOCK_REALTIME, &host_start);
+  fft(in, sw_out, fft_size, nimg);
+  fft_stats(fft_size, nimg, sw_stats);
+  fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
+  clock_gettime(CLOCK_REALTIME, &host_finish);
+  cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
+
+  // Get platform ID and info
+  cl_int err;
+  cl_uint platforms;
+  cl_int get_platform_id = 0;
+  cl_platform_id platform_id;
+  cl_platform_id platform_ids[MAX_PALTFORMS];
+  char platform_name[PARAM_VALUE_SIZE];  
+  OCL_CHECK(err, err = clGetPlatformIDs(MAX_PALTFORMS, platform_ids, &platforms));
+  for(i = 0; i < platforms; i++){
+    OCL_CHECK(err, err = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_VENDOR, PARAM_VALUE_SIZE, (void *)platform_name, NULL));
+    if(strcmp(platform_name, "Xilinx") == 0){
+      platform_id = platform_ids[i];
+      get_platform_id = 1;
+      break;
+    }
+  }
+  if(get_platform_id ==0){
+    fprintf(stderr, "ERROR: Failed to get platform ID!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  
+  // Get device ID and info
+  cl_uint devices;
+  cl_int get_device_id = 0;
+  cl_device_id device_id;
+  cl_device_id device_ids[MAX_DEVICES];
+  char device_name[PARAM_VALUE_SIZE];
+  OCL_CHECK(err, err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ACCELERATOR, MAX_DEVICES, device_ids, &devices));
+  for(i = 0; i < devices; i++){
+    OCL_CHECK(err, err = clGetDeviceInfo(device_ids[i], CL_DEVICE_NAME, PARAM_VALUE_SIZE, device_name, 0));    
+    if(strstr(device_name, "u280")){
+      device_id = device_ids[i];
+      get_device_id = 1;
+      break;
+    }
+  }
+  if(get_device_id ==0){
+    fprintf(stderr, "ERROR: Failed to get device ID!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");   
+    return EXIT_FAILURE; 
+  }  
+  fprintf(stdout, "INFO: We will use %s!\n", device_name);
+
+  // Create context
+  cl_context context;
+  OCL_CHECK(err, context = clCreateContext(0, 1, &device_id, NULL, NULL, &err));
+  
+  // Create command queue, out of order so that the streaming kernels run at the same time
+  cl_command_queue queue;
+  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err));
+  
+  // Read kernel binary into memory
+  char *xclbin = argv[1];
+  unsigned char *binary = NULL;
+  size_t binary_size;
+  fprintf(stdout, "INFO: loading xclbin %s\n", xclbin);
+  binary_size = (int)load_file_to_memory(xclbin, (char **) &binary);
+  if (binary_size <= 0) {
+    fprintf(stderr, "ERROR: Failed to load kernel from xclbin: %s\n", xclbin);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Create program binary with kernel binary
+  cl_int status;
+  cl_program program;
+  OCL_CHECK(err, program = clCreateProgramWithBinary(context, 1, &device_id, &binary_size, (const unsigned char **) &binary, &status, &err));
+  free(binary);
+  
+  // Program the card with the program binary
+  OCL_CHECK(err, err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL));
+
+  // Create the kernel
+  cl_kernel knl_read;
+  cl_kernel knl_fft;
+  cl_kernel knl_write;
+  OCL_CHECK(err, knl_read  = clCreateKernel(program, "knl_read", &err));
+  OCL_CHECK(err, knl_fft   = clCreateKernel(program, "knl_fft", &err));
+  OCL_CHECK(err, knl_write = clCreateKernel(program, "knl_write", &err));
+
+  // Prepare device buffer
+  cl_mem buffer_in;
+  cl_mem buffer_twiddle;
+  cl_mem buffer_out;
+  cl_mem buffer_stats;
+  cl_mem pt[4];
+
+  OCL_CHECK(err, buffer_in      = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata2, in, &err));
+  OCL_CHECK(err, buffer_twiddle = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(twiddle_t)*ndata1, twiddle, &err));
+  OCL_CHECK(err, buffer_out     = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(img_t)*ndata3, hw_out, &err));
+  OCL_CHECK(err, buffer_stats   = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, hw_stats, &err));
+  if (!(buffer_in&&
+	buffer_twiddle&&
+	buffer_out&&
+	buffer_stats
+	)) {
+    fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Setup kernel arguments
+  // To use multiple banks, this has to be before any enqueue options (e.g., clEnqueueMigrateMemObjects)
+  pt[0] = buffer_in;
+  pt[1] = buffer_twiddle;
+  pt[2] = buffer_out;
+  pt[3] = buffer_stats;
+
+  OCL_CHECK(err, err = clSetKernelArg(knl_read, 0, sizeof(cl_mem), &buffer_in));
+  OCL_CHECK(err, err = clSetKernelArg(knl_read, 2, sizeof(cl_int), &fft_size));
+  OCL_CHECK(err, err = clSetKernelArg(knl_read, 3, sizeof(cl_int), &nimg));
+  
+  OCL_CHECK(err, err = clSetKernelArg(knl_fft, 1, sizeof(cl_mem), &buffer_twiddle));
+  OCL_CHECK(err, err = clSetKernelArg(knl_fft, 3, sizeof(cl_int), &fft_size));
+  OCL_CHECK(err, err = clSetKernelArg(knl_fft, 4, sizeof(cl_int), &nimg));
+  OCL_CHECK(err, err = clSetKernelArg(knl_fft, 5, sizeof(cl_mem), &buffer_stats));
+
+  OCL_CHECK(err, err = clSetKernelArg(knl_write, 1, sizeof(cl_mem), &buffer_out));
+  OCL_CHECK(err, err = clSetKernelArg(knl_write, 2, sizeof(cl_int), &fft_size));
+  OCL_CHECK(err, err = clSetKernelArg(knl_write, 3, sizeof(cl_int), &nimg));
+  
+  fprintf(stdout, "INFO: DONE SETUP KERNEL\n");
+
+  // Migrate host memory to device
+  cl_int inputs = 2;
+  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, inputs, pt, 0 ,0,NULL, NULL));
+  OCL_CHECK(err, err = clFinish(queue));
+  fprintf(stdout, "INFO: DONE MEMCPY FROM HOST TO KERNEL\n");
+
+  // Execute the kernel
+  struct timespec device_start;
+  struct timespec device_finish;
+  cl_float kernel_elapsed_time;
+  clock_gettime(CLOCK_REALTIME, &device_start);
+  OCL_CHECK(err, err = clEnqueueTask(queue, knl_read, 0, NULL, NULL));
+  OCL_CHECK(err, err = clEnqueueTask(queue, knl_fft, 0, NULL, NULL));
+  OCL_CHECK(err, err = clEnqueueTask(queue, knl_write, 0, NULL, NULL));
+  OCL_CHECK(err, err = clFinish(queue));
+  fprintf(stdout, "INFO: DONE KERNEL EXECUTION\n");
+  clock_gettime(CLOCK_REALTIME, &device_finish);
+  kernel_elapsed_time = (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
+
+  // Migrate data from device to host
+  cl_int outputs = 2;
+  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[2], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
+  OCL_CHECK(err, err = clFinish(queue));
+  fprintf(stdout, "INFO: DONE MEMCPY FROM KERNEL TO HOST\n");
+
+  // Check the result, the kernel is fixed point, so allow one LSB of difference
+  cl_int nmismatch = 0;
+  float res = 1.0/(1 << (IMG_WIDTH - IMG_INTEGER_WIDTH));
+  for(i = 0; i < ndata3; i++){
+    if(fabs(sw_out[i].to_float() - hw_out[i].to_float()) > res){
+      nmismatch++;
+    }
+  }
+  fprintf(stdout, "INFO: %d from %" PRIu64 ", %.0f%% of OUT is outside %f range\n", nmismatch, ndata3, 100*nmismatch/(float)ndata3, res);
+  
+  fprintf(stdout, "INFO: DONE RESULT CHECK\n");
+  
+  fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
+  fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
+  print_stats("Counters of CPU model", stage, sw_stats, NSTATS);
+  print_stats("Counters of kernel", stage, hw_stats, NSTATS);
+  fprintf(stdout, "INFO: Imaging time of CPU code is %E seconds per DM plane\n", cpu_elapsed_time/ndm);
+  fprintf(stdout, "INFO: Imaging time of kernel is %E seconds per DM plane\n", kernel_elapsed_time/ndm);
+  
+  // Cleanup
+  clReleaseMemObject(buffer_in);
+  clReleaseMemObject(buffer_twiddle);
+  clReleaseMemObject(buffer_out);
+  clReleaseMemObject(buffer_stats);
+  
+  free(in);
+  free(twiddle);
+  free(sw_out);
+  free(hw_out);
+  free(sw_stats);
+  free(hw_stats);
+  clReleaseProgram(program);
+  clReleaseKernel(knl_read);
+  clReleaseKernel(knl_fft);
+  clReleaseKernel(knl_write);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  fprintf(stdout, "INFO: DONE ALL\n");
+  
+  return EXIT_SUCCESS;
+}
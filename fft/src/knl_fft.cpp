@@ -0,0 +1,660 @@
+#include "fft.h"
+
+// Takes gridded UV planes from knl_grid and sends images to knl_boxcar
+// Row FFT, corner turn on chip and then column FFT, fft_size is given at run time up to MFFT_SIZE
+// knl_boxcar only takes fft_size^2 == NSAMP_PER_IMG, fft_img itself runs any size
+// FFTs run NSAMP_PER_BURST at a time, one per lane of a burst_fft, rows of a block of NSAMP_PER_BURST rows
+// and then columns of a group of NSAMP_PER_BURST columns, so every stage moves a burst per clock
+// All stages run concurrently for all images, tripcounts are given for one image
+extern "C" {
+  void knl_fft(
+               stream_uv &in_stream,
+               const burst_uv *twiddle,
+               fifo_img &out_stream,
+               int fft_size,
+               int nimg,
+               stats_t *stats
+               );
+
+  void read_twiddle(
+                    const burst_uv *twiddle,
+                    twiddle_t twiddle_row_re[MFFT_STAGE][MFFT_SIZE/2],
+                    twiddle_t twiddle_row_im[MFFT_STAGE][MFFT_SIZE/2],
+                    twiddle_t twiddle_col_re[MFFT_STAGE][MFFT_SIZE/2],
+                    twiddle_t twiddle_col_im[MFFT_STAGE][MFFT_SIZE/2]);
+
+  void fft_img(
+               stream_uv &in_stream,
+               twiddle_t twiddle_row_re[MFFT_STAGE][MFFT_SIZE/2],
+               twiddle_t twiddle_row_im[MFFT_STAGE][MFFT_SIZE/2],
+               twiddle_t twiddle_col_re[MFFT_STAGE][MFFT_SIZE/2],
+               twiddle_t twiddle_col_im[MFFT_STAGE][MFFT_SIZE/2],
+               fifo_img &out_stream,
+               int fft_size,
+               int nimg,
+               stats_t *stats);
+
+  void read_row(
+                int fft_size,
+                int nimg,
+                stream_uv &in_stream,
+                fifo_fft &out_fifo,
+                fifo_stats &stats_fifo);
+
+  void fft_stage(
+                 int stage,
+                 int fft_size,
+                 int nimg,
+                 twiddle_t twiddle_re[MFFT_SIZE/2],
+                 twiddle_t twiddle_im[MFFT_SIZE/2],
+                 fifo_fft &in_fifo,
+                 fifo_fft &out_fifo,
+                 fifo_stats &stats_fifo);
+
+  void turn_plane(
+                  int fft_size,
+                  int nimg,
+                  fifo_fft &in_fifo,
+                  fifo_fft &out_fifo,
+                  fifo_stats &stats_fifo);
+
+  void stream_img(
+                  int fft_size,
+                  int nimg,
+                  fifo_fft &in_fifo,
+                  fifo_img &out_stream,
+                  fifo_stats &stats_fifo);
+
+  void write_stats(
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats);
+
+  int log2_size(int fft_size);
+
+  int bit_reverse(
+                  int loc,
+                  int nstage);
+}
+
+void knl_fft(
+             stream_uv &in_stream,
+             const burst_uv *twiddle,
+             fifo_img &out_stream,
+             int fft_size,
+             int nimg,
+             stats_t *stats
+             ){
+#pragma HLS INTERFACE axis  port = in_stream
+#pragma HLS INTERFACE m_axi port = twiddle offset = slave bundle = gmem0
+#pragma HLS INTERFACE m_axi port = stats   offset = slave bundle = gmem1
+#pragma HLS INTERFACE axis  port = out_stream
+
+#pragma HLS INTERFACE s_axilite port = twiddle  bundle = control
+#pragma HLS INTERFACE s_axilite port = fft_size bundle = control
+#pragma HLS INTERFACE s_axilite port = nimg     bundle = control
+#pragma HLS INTERFACE s_axilite port = stats    bundle = control
+#pragma HLS INTERFACE s_axilite port = return   bundle = control
+
+#pragma HLS DATA_PACK variable = twiddle
+#pragma HLS DATA_PACK variable = out_stream
+#pragma HLS DATA_PACK variable = stats
+
+  // Every stage has its own copy, so that the stages run in parallel
+  twiddle_t twiddle_row_re[MFFT_STAGE][MFFT_SIZE/2];
+  twiddle_t twiddle_row_im[MFFT_STAGE][MFFT_SIZE/2];
+  twiddle_t twiddle_col_re[MFFT_STAGE][MFFT_SIZE/2];
+  twiddle_t twiddle_col_im[MFFT_STAGE][MFFT_SIZE/2];
+#pragma HLS ARRAY_PARTITION variable = twiddle_row_re complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = twiddle_row_im complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = twiddle_col_re complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = twiddle_col_im complete dim = 1
+
+  // knl_boxcar takes images of NSAMP_PER_IMG samples, other sizes move nothing
+  if((int64_t)fft_size*fft_size != NSAMP_PER_IMG){
+    nimg = 0;
+  }
+
+  read_twiddle(twiddle, twiddle_row_re, twiddle_row_im, twiddle_col_re, twiddle_col_im);
+
+  fft_img(in_stream, twiddle_row_re, twiddle_row_im, twiddle_col_re, twiddle_col_im, out_stream, fft_size, nimg, stats);
+}
+
+void read_twiddle(
+                  const burst_uv *twiddle,
+                  twiddle_t twiddle_row_re[MFFT_STAGE][MFFT_SIZE/2],
+                  twiddle_t twiddle_row_im[MFFT_STAGE][MFFT_SIZE/2],
+                  twiddle_t twiddle_col_re[MFFT_STAGE][MFFT_SIZE/2],
+                  twiddle_t twiddle_col_im[MFFT_STAGE][MFFT_SIZE/2]){
+  int i;
+  int j;
+  int k;
+  int loc;
+  twiddle_t re;
+  twiddle_t im;
+
+ loop_read_twiddle:
+  for(i = 0; i < NBURST_TWIDDLE; i++){
+#pragma HLS PIPELINE
+    for(j = 0; j < NSAMP_PER_BURST; j++){
+      loc = i*NSAMP_PER_BURST + j;
+      re.range() = twiddle[i].data[j](TWIDDLE_WIDTH-1, 0);
+      im.range() = twiddle[i].data[j](2*TWIDDLE_WIDTH-1, TWIDDLE_WIDTH);
+      for(k = 0; k < MFFT_STAGE; k++){
+        twiddle_row_re[k][loc] = re;
+        twiddle_row_im[k][loc] = im;
+        twiddle_col_re[k][loc] = re;
+        twiddle_col_im[k][loc] = im;
+      }
+    }
+  }
+}
+
+// Stages are a chain through FIFOs, stages beyond log2(fft_size) pass bursts through
+void fft_img(
+             stream_uv &in_stream,
+             twiddle_t twiddle_row_re[MFFT_STAGE][MFFT_SIZE/2],
+             twiddle_t twiddle_row_im[MFFT_STAGE][MFFT_SIZE/2],
+             twiddle_t twiddle_col_re[MFFT_STAGE][MFFT_SIZE/2],
+             twiddle_t twiddle_col_im[MFFT_STAGE][MFFT_SIZE/2],
+             fifo_img &out_stream,
+             int fft_size,
+             int nimg,
+             stats_t *stats){
+  int i;
+  fifo_fft row_fifo[MFFT_STAGE+1];
+  fifo_fft col_fifo[MFFT_STAGE+1];
+  fifo_stats stats_fifo[NSTATS];
+#pragma HLS STREAM variable = row_fifo
+#pragma HLS STREAM variable = col_fifo
+#pragma HLS STREAM variable = stats_fifo
+
+#pragma HLS DATAFLOW
+  read_row(fft_size, nimg, in_stream, row_fifo[0], stats_fifo[STATS_READ_ROW]);
+
+  for(i = 0; i < MFFT_STAGE; i++){
+#pragma HLS UNROLL
+    fft_stage(i, fft_size, nimg, twiddle_row_re[i], twiddle_row_im[i], row_fifo[i], row_fifo[i+1],
+              stats_fifo[STATS_ROW_STAGE + i]);
+  }
+
+  turn_plane(fft_size, nimg, row_fifo[MFFT_STAGE], col_fifo[0], stats_fifo[STATS_TURN_PLANE]);
+
+  for(i = 0; i < MFFT_STAGE; i++){
+#pragma HLS UNROLL
+    fft_stage(i, fft_size, nimg, twiddle_col_re[i], twiddle_col_im[i], col_fifo[i], col_fifo[i+1],
+              stats_fifo[STATS_COL_STAGE + i]);
+  }
+
+  stream_img(fft_size, nimg, col_fifo[MFFT_STAGE], out_stream, stats_fifo[STATS_STREAM_IMG]);
+
+  write_stats(stats_fifo, stats);
+}
+
+// Corner turn of a block of NSAMP_PER_BURST rows, so that a burst out is one column of the block, one sample per lane
+// Columns go out in bit reversed order, which is the input order of the FFT stages
+// Sample (row, col) of the block is in bank (row+col)%NSAMP_PER_BURST, so a row in and a column out both take all banks
+// Four buffers in a ring, a block is filled, waits one step and then goes out,
+// so a sample is read at least fft_size iterations after it is written and written again at least fft_size iterations after it is read
+void read_row(
+              int fft_size,
+              int nimg,
+              stream_uv &in_stream,
+              fifo_fft &out_fifo,
+              fifo_stats &stats_fifo){
+  int j;
+  int row;
+  int col;
+  int fill;
+  int drain;
+  int nfill;
+  int ndrain;
+  int nstage;
+  int nburst_per_row;
+  uint64_t step;
+  uint64_t nblock;
+  bool fill_bool;
+  bool drain_bool;
+  uv_t uv;
+  uv_data_t re;
+  uv_data_t im;
+  stream_t stream;
+  burst_fft burst;
+  stats_t stats = {0, 0, 0, 0};
+
+  const int mcycle   = MBURST_PER_UV + 2*MFFT_SIZE;
+  const int distance = FFT_DISTANCE;
+
+  uv_t block[4][NSAMP_PER_BURST][MFFT_SIZE];
+#pragma HLS ARRAY_PARTITION variable = block complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = block complete dim = 2
+
+  nstage         = log2_size(fft_size);
+  nburst_per_row = fft_size/NSAMP_PER_BURST;
+  nblock         = (uint64_t)nimg*nburst_per_row;
+
+  // Step s fills block s into buffer s%4 and drains block s-2 from buffer (s+2)%4, both take fft_size bursts
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+ loop_read_row:
+  while(step < nblock + 2){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = block inter distance = distance true
+    fill       = step%4;
+    drain      = (step+2)%4;
+    fill_bool  = (step < nblock) && (nfill < fft_size);
+    drain_bool = (step >= 2) && (ndrain < fft_size);
+
+    if(!fill_bool){
+      stats.stall_full++;
+    }
+    else if(in_stream.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      stream = in_stream.read();
+      row = nfill/nburst_per_row;
+      col = (nfill%nburst_per_row)*NSAMP_PER_BURST;
+      for(j = 0; j < NSAMP_PER_BURST; j++){     // For banks
+        block[fill][j][row*nburst_per_row + col/NSAMP_PER_BURST] =
+          stream.data(2*(((j - row)&(NSAMP_PER_BURST-1))+1)*DATA_WIDTH-1, 2*((j - row)&(NSAMP_PER_BURST-1))*DATA_WIDTH);
+      }
+      stats.active++;
+      nfill++;
+    }
+
+    if(drain_bool && !out_fifo.full()){
+      col = bit_reverse(ndrain, nstage);
+      for(j = 0; j < NSAMP_PER_BURST; j++){     // For rows
+        uv = block[drain][(j + col)&(NSAMP_PER_BURST-1)][j*nburst_per_row + col/NSAMP_PER_BURST];
+        re.range() = uv(DATA_WIDTH-1, 0);
+        im.range() = uv(2*DATA_WIDTH-1, DATA_WIDTH);
+        burst.re[j] = re;
+        burst.im[j] = im;
+      }
+      out_fifo.write(burst);
+      stats.burst++;
+      ndrain++;
+    }
+
+    if((step >= nblock || nfill == fft_size) && (step < 2 || ndrain == fft_size)){
+      step++;
+      nfill  = 0;
+      ndrain = 0;
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Radix-2 stage of NSAMP_PER_BURST FFTs, bursts b and b+half of a group of 2*half bursts are a butterfly
+// Explicit ping-pong over steps of whole groups, lower and upper halves are in their own buffers,
+// so a burst out reads both of its inputs in the same clock, and every stage is scaled by 1/2
+// A step is at least 2*FFT_DISTANCE bursts, so a word is read at least FFT_DISTANCE iterations after it is written
+// and written again at least FFT_DISTANCE iterations after it is read, also for the first stages
+void fft_stage(
+               int stage,
+               int fft_size,
+               int nimg,
+               twiddle_t twiddle_re[MFFT_SIZE/2],
+               twiddle_t twiddle_im[MFFT_SIZE/2],
+               fifo_fft &in_fifo,
+               fifo_fft &out_fifo,
+               fifo_stats &stats_fifo){
+  int j;
+  int half;
+  int ping;
+  int nfill;
+  int ndrain;
+  int nburst_per_step;
+  int loc;
+  int loc_twiddle;
+  uint64_t i;
+  uint64_t step;
+  uint64_t nstep;
+  uint64_t nburst;
+  bool fill_bool;
+  bool drain_bool;
+  fft_data_t t_re;
+  fft_data_t t_im;
+  twiddle_t w_re;
+  twiddle_t w_im;
+  burst_fft burst;
+  burst_fft lower;
+  burst_fft upper;
+  stats_t stats = {0, 0, 0, 0};
+
+  const int mburst   = MBURST_PER_UV;
+  const int mcycle   = MBURST_PER_UV + MFFT_SIZE;
+  const int distance = FFT_DISTANCE;
+
+  burst_fft buf_lower[2][MFFT_SIZE/2];
+  burst_fft buf_upper[2][MFFT_SIZE/2];
+#pragma HLS DATA_PACK variable = buf_lower
+#pragma HLS DATA_PACK variable = buf_upper
+#pragma HLS ARRAY_PARTITION variable = buf_lower complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = buf_upper complete dim = 1
+
+  half   = 1 << stage;
+  nburst = (uint64_t)nimg*fft_size*fft_size/NSAMP_PER_BURST;
+
+  if(stage >= log2_size(fft_size)){
+    i = 0;
+  loop_fft_bypass:
+    while(i < nburst){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
+#pragma HLS PIPELINE
+      if(in_fifo.empty()){
+        stats.stall_empty++;
+      }
+      else if(out_fifo.full()){
+        stats.stall_full++;
+      }
+      else{
+        out_fifo.write(in_fifo.read());
+        stats.active++;
+        stats.burst++;
+        i++;
+      }
+    }
+    stats_fifo.write(stats);
+    return;
+  }
+
+  // Burst b of a step is lower or upper by bit stage of b and goes to word (b/2 without bit stage-1 and below) + b%half
+  nburst_per_step = (2*half > 2*FFT_DISTANCE) ? 2*half : 2*FFT_DISTANCE;
+  nstep = nburst/nburst_per_step;
+
+  // Step s fills bursts of step s into buffer s%2 and drains step s-1 from the other buffer
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+ loop_fft_stage:
+  while(step <= nstep){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = buf_lower inter distance = distance true
+#pragma HLS DEPENDENCE variable = buf_upper inter distance = distance true
+    ping       = step%2;
+    fill_bool  = (step < nstep) && (nfill < nburst_per_step);
+    drain_bool = (step > 0) && (ndrain < nburst_per_step);
+
+    if(!fill_bool){
+      stats.stall_full++;
+    }
+    else if(in_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      burst = in_fifo.read();
+      loc   = ((nfill >> 1) & ~(half-1)) | (nfill & (half-1));
+      if(nfill & half){
+        buf_upper[ping][loc] = burst;
+      }
+      else{
+        buf_lower[ping][loc] = burst;
+      }
+      stats.active++;
+      nfill++;
+    }
+
+    if(drain_bool && !out_fifo.full()){
+      loc         = ((ndrain >> 1) & ~(half-1)) | (ndrain & (half-1));
+      loc_twiddle = (ndrain & (half-1)) << (MFFT_STAGE-1-stage);
+      lower = buf_lower[1-ping][loc];
+      upper = buf_upper[1-ping][loc];
+      w_re  = twiddle_re[loc_twiddle];
+      w_im  = twiddle_im[loc_twiddle];
+      for(j = 0; j < NSAMP_PER_BURST; j++){     // For lanes
+        t_re = upper.re[j]*w_re - upper.im[j]*w_im;
+        t_im = upper.re[j]*w_im + upper.im[j]*w_re;
+        if(ndrain & half){
+          burst.re[j] = (lower.re[j] - t_re) >> 1;
+          burst.im[j] = (lower.im[j] - t_im) >> 1;
+        }
+        else{
+          burst.re[j] = (lower.re[j] + t_re) >> 1;
+          burst.im[j] = (lower.im[j] + t_im) >> 1;
+        }
+      }
+      out_fifo.write(burst);
+      stats.burst++;
+      ndrain++;
+    }
+
+    if((step == nstep || nfill == nburst_per_step) && (step == 0 || ndrain == nburst_per_step)){
+      step++;
+      nfill  = 0;
+      ndrain = 0;
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Corner turn of a whole plane between row and column FFT
+// Bursts come in as one column of a block of rows and go out as one row of a group of columns, rows in bit reversed order
+// Sample (row, col) is in bank (row+col)%NSAMP_PER_BURST at row*fft_size/NSAMP_PER_BURST+col/NSAMP_PER_BURST
+// Explicit ping-pong, one plane is filled while the previous one goes out
+// The first row out of a plane is filled in its first block, so reads and writes of a word are more than FFT_DISTANCE iterations apart
+void turn_plane(
+                int fft_size,
+                int nimg,
+                fifo_fft &in_fifo,
+                fifo_fft &out_fifo,
+                fifo_stats &stats_fifo){
+  int j;
+  int row;
+  int col;
+  int ping;
+  int nstage;
+  int nburst_per_row;
+  int nburst_per_uv;
+  int nfill;
+  int ndrain;
+  int step;
+  fft_t sample;
+  burst_fft burst;
+  stats_t stats = {0, 0, 0, 0};
+
+  const int mcycle   = MBURST_PER_UV;
+  const int distance = FFT_DISTANCE;
+
+  fft_t plane[2][NSAMP_PER_BURST][MBURST_PER_UV];
+#pragma HLS RESOURCE variable = plane core = XPM_MEMORY uram
+#pragma HLS ARRAY_PARTITION variable = plane complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = plane complete dim = 2
+
+  nstage         = log2_size(fft_size);
+  nburst_per_row = fft_size/NSAMP_PER_BURST;
+  nburst_per_uv  = fft_size*nburst_per_row;
+
+  // Step s fills image s into buffer s%2 and drains image s-1 from the other buffer
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+ loop_turn_plane:
+  while(step <= nimg){
+#pragma HLS LOOP_TRIPCOUNT min = mcycle max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = plane inter distance = distance true
+    ping = step%2;
+
+    if(!((step < nimg) && (nfill < nburst_per_uv))){
+      stats.stall_full++;
+    }
+    else if(in_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      // Column col of rows row to row+NSAMP_PER_BURST-1
+      burst = in_fifo.read();
+      row = (nfill/fft_size)*NSAMP_PER_BURST;
+      col = nfill%fft_size;
+      for(j = 0; j < NSAMP_PER_BURST; j++){     // For banks
+        sample(FFT_DATA_WIDTH-1, 0)                = burst.re[(j - col)&(NSAMP_PER_BURST-1)].range();
+        sample(2*FFT_DATA_WIDTH-1, FFT_DATA_WIDTH) = burst.im[(j - col)&(NSAMP_PER_BURST-1)].range();
+        plane[ping][j][(row + ((j - col)&(NSAMP_PER_BURST-1)))*nburst_per_row + col/NSAMP_PER_BURST] = sample;
+      }
+      stats.active++;
+      nfill++;
+    }
+
+    if((step > 0) && (ndrain < nburst_per_uv) && !out_fifo.full()){
+      // Row row of columns col to col+NSAMP_PER_BURST-1
+      row = bit_reverse(ndrain%fft_size, nstage);
+      col = (ndrain/fft_size)*NSAMP_PER_BURST;
+      for(j = 0; j < NSAMP_PER_BURST; j++){     // For columns
+        sample = plane[1-ping][(row + j)&(NSAMP_PER_BURST-1)][row*nburst_per_row + col/NSAMP_PER_BURST];
+        burst.re[j].range() = sample(FFT_DATA_WIDTH-1, 0);
+        burst.im[j].range() = sample(2*FFT_DATA_WIDTH-1, FFT_DATA_WIDTH);
+      }
+      out_fifo.write(burst);
+      stats.burst++;
+      ndrain++;
+    }
+
+    if((step == nimg || nfill == nburst_per_uv) && (step == 0 || ndrain == nburst_per_uv)){
+      step++;
+      nfill  = 0;
+      ndrain = 0;
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Bursts come in as one row of a group of columns and the image goes out row by row
+// Explicit ping-pong, one image is filled while the previous one goes out
+// Rows go out from the top, which is filled first, so reads and writes of a word are more than FFT_DISTANCE iterations apart
+void stream_img(
+                int fft_size,
+                int nimg,
+                fifo_fft &in_fifo,
+                fifo_img &out_stream,
+                fifo_stats &stats_fifo){
+  int j;
+  int row;
+  int col;
+  int ping;
+  int nword_per_row;
+  int nburst_per_uv;
+  int nburst_per_img;
+  int nfill;
+  int ndrain;
+  int step;
+  img_t pixel;
+  img_word_t word;
+  burst_fft burst;
+  burst_img burst_out;
+  stats_t stats = {0, 0, 0, 0};
+
+  const int mcycle   = MBURST_PER_UV;
+  const int distance = FFT_DISTANCE;
+  const int nword_per_img_burst = NSAMP_PER_IMG_BURST/NSAMP_PER_BURST;
+
+  // A word is the image samples of one burst_fft, an image burst is nword_per_img_burst words
+  img_word_t img[2][MFFT_SIZE][MFFT_SIZE/NSAMP_PER_BURST];
+#pragma HLS RESOURCE variable = img core = XPM_MEMORY uram
+#pragma HLS ARRAY_PARTITION variable = img complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = img cyclic factor = nword_per_img_burst dim = 3
+
+  nword_per_row  = fft_size/NSAMP_PER_BURST;
+  nburst_per_uv  = fft_size*nword_per_row;
+  nburst_per_img = fft_size*fft_size/NSAMP_PER_IMG_BURST;
+
+  // Step s fills image s into buffer s%2 and sends image s-1 from the other buffer
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+ loop_stream_img:
+  while(step <= nimg){
+#pragma HLS LOOP_TRIPCOUNT min = mcycle max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = img inter distance = distance true
+    ping = step%2;
+
+    if(!((step < nimg) && (nfill < nburst_per_uv))){
+      stats.stall_full++;
+    }
+    else if(in_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      // Image is the real part
+      burst = in_fifo.read();
+      row = nfill%fft_size;
+      col = nfill/fft_size;
+      for(j = 0; j < NSAMP_PER_BURST; j++){
+        pixel = burst.re[j];
+        word((j+1)*IMG_WIDTH-1, j*IMG_WIDTH) = pixel.range();
+      }
+      img[ping][row][col] = word;
+      stats.active++;
+      nfill++;
+    }
+
+    if((step > 0) && (ndrain < nburst_per_img) && !out_stream.full()){
+      row = ndrain/(fft_size/NSAMP_PER_IMG_BURST);
+      col = (ndrain%(fft_size/NSAMP_PER_IMG_BURST))*nword_per_img_burst;
+      for(j = 0; j < NSAMP_PER_IMG_BURST; j++){
+        word = img[1-ping][row][col + j/NSAMP_PER_BURST];
+        burst_out.data[j].range() = word((j%NSAMP_PER_BURST+1)*IMG_WIDTH-1, (j%NSAMP_PER_BURST)*IMG_WIDTH);
+      }
+      out_stream.write(burst_out);
+      stats.burst++;
+      ndrain++;
+    }
+
+    if((step == nimg || nfill == nburst_per_uv) && (step == 0 || ndrain == nburst_per_img)){
+      step++;
+      nfill  = 0;
+      ndrain = 0;
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+void write_stats(
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats){
+  int i;
+
+  // Stages send one record each when they are done
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS PIPELINE
+    stats[i] = stats_fifo[i].read();
+  }
+}
+
+int log2_size(int fft_size){
+#pragma HLS INLINE
+  int i;
+  int nstage = 0;
+
+  for(i = 1; i <= MFFT_STAGE; i++){
+#pragma HLS UNROLL
+    if((1 << i) == fft_size){
+      nstage = i;
+    }
+  }
+
+  return nstage;
+}
+
+// Reverse the lowest nstage bits
+int bit_reverse(
+                int loc,
+                int nstage){
+#pragma HLS INLINE
+  int i;
+  int reverse = 0;
+
+  for(i = 0; i < MFFT_STAGE; i++){
+#pragma HLS UNROLL
+    if(i < nstage){
+      reverse = (reverse << 1) | ((loc >> i) & 1);
+    }
+  }
+
+  return reverse;
+}
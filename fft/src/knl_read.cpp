@@ -0,0 +1,58 @@
+#include "fft.h"
+
+// Feeds gridded UV planes from memory to knl_fft, stands for knl_grid in the test
+extern "C"{
+  void knl_read(
+                const burst_uv *in,
+                stream_uv &in_stream,
+                int fft_size,
+                int nimg);
+}
+
+void knl_read(
+              const burst_uv *in,
+              stream_uv &in_stream,
+              int fft_size,
+              int nimg){
+#pragma HLS INTERFACE m_axi port = in offset = slave bundle = gmem1
+#pragma HLS INTERFACE axis  port = in_stream
+
+#pragma HLS INTERFACE s_axilite port = in       bundle = control
+#pragma HLS INTERFACE s_axilite port = fft_size bundle = control
+#pragma HLS INTERFACE s_axilite port = nimg     bundle = control
+#pragma HLS INTERFACE s_axilite port = return   bundle = control
+
+#pragma HLS DATA_PACK variable = in
+  
+  const int mimg = MIMG;
+  const int mburst_per_uv = MBURST_PER_UV;
+  
+  int i;
+  int j;
+  int k;
+  int nburst_per_uv;
+  uint64_t loc;
+  burst_uv burst;
+  stream_t stream;
+  
+  nburst_per_uv = fft_size*fft_size/NSAMP_PER_BURST;
+  // knl_boxcar takes images of NSAMP_PER_IMG samples, other sizes move nothing
+  if((int64_t)fft_size*fft_size != NSAMP_PER_IMG){
+    nimg = 0;
+  }
+  
+  for(i = 0; i < nimg; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mimg
+  loop_read:
+    for(j = 0; j < nburst_per_uv; j++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv
+#pragma HLS PIPELINE
+      loc = (uint64_t)i*nburst_per_uv + j;
+      burst = in[loc];
+      for(k = 0; k < NSAMP_PER_BURST; k++){
+        stream.data(2*(k+1)*DATA_WIDTH-1, 2*k*DATA_WIDTH) = burst.data[k];
+      }
+      in_stream.write(stream);
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#include "fft.h"
+
+// Writes images from knl_fft to memory, stands for knl_boxcar in the test
+extern "C"{
+  void knl_write(
+                 fifo_img &out_stream,
+                 burst_img *out,
+                 int fft_size,
+                 int nimg);
+}
+
+void knl_write(
+               fifo_img &out_stream,
+               burst_img *out,
+               int fft_size,
+               int nimg){
+#pragma HLS INTERFACE axis  port = out_stream
+#pragma HLS INTERFACE m_axi port = out offset = slave bundle = gmem2
+
+#pragma HLS INTERFACE s_axilite port = out      bundle = control
+#pragma HLS INTERFACE s_axilite port = fft_size bundle = control
+#pragma HLS INTERFACE s_axilite port = nimg     bundle = control
+#pragma HLS INTERFACE s_axilite port = return   bundle = control
+
+#pragma HLS DATA_PACK variable = out
+#pragma HLS DATA_PACK variable = out_stream
+  
+  const int mimg = MIMG;
+  const int mburst_per_img = MBURST_PER_IMG;
+  
+  int i;
+  int j;
+  int nburst_per_img;
+  uint64_t loc;
+  
+  nburst_per_img = fft_size*fft_size/NSAMP_PER_IMG_BURST;
+  // knl_boxcar takes images of NSAMP_PER_IMG samples, other sizes move nothing
+  if((int64_t)fft_size*fft_size != NSAMP_PER_IMG){
+    nimg = 0;
+  }
+  
+  for(i = 0; i < nimg; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mimg
+  loop_write:
+    for(j = 0; j < nburst_per_img; j++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst_per_img
+#pragma HLS PIPELINE
+      loc = (uint64_t)i*nburst_per_img + j;
+      out[loc] = out_stream.read();
+    }
+  }
+}
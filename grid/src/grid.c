@@ -14,12 +14,14 @@ int grid(
 	 uv_data_t *out,
 	 int nuv_per_cu,         
          int nsamp_per_uv_in,
-         int nsamp_per_uv_out
+         int nsamp_per_uv_out,
+         int nuv_per_coord
 	 ){
   int i;
   int j;
   int loc_in;
   int loc_out;
+  int loc_coord;
 
   for(i = 0; i < nuv_per_cu; i++){
     for(j = 0; j < nsamp_per_uv_out; j++){
@@ -29,7 +31,8 @@ int grid(
     }
     
     for(j = 0; j < nsamp_per_uv_in; j++){
-      loc_out = i*nsamp_per_uv_out + coord[j];
+      loc_coord = (i/nuv_per_coord)*nsamp_per_uv_in + j; // Coordinates change every nuv_per_coord planes
+      loc_out = i*nsamp_per_uv_out + coord[loc_coord];
       loc_in  = i*nsamp_per_uv_in + j;
       
       out[2*loc_out]   = in[2*loc_in]  ;
@@ -40,7 +43,257 @@ int grid(
   return EXIT_SUCCESS;
 }
 
-int read_coord(char *fname, int flen, int *coord){
+static int compare_cell(const void *a, const void *b){
+  const int *pa = (const int *)a;
+  const int *pb = (const int *)b;
+  
+  if(pa[0] != pb[0]){
+    return pa[0] < pb[0] ? -1 : 1;
+  }
+  return pa[1] < pb[1] ? -1 : (pa[1] > pb[1]);
+}
+
+// Sort the coordinates once, so that grid_fast writes every plane in address order
+// If several samples go to the same cell, the last one wins as in grid()
+int grid_plan_create(
+                     grid_plan *plan,
+                     coord_t *coord,
+                     int ncoord,
+                     int nsamp_per_uv_in,
+                     int nuv_per_cu){
+  int i;
+  int j;
+  int n;
+  int loc;
+  int *pair = NULL;
+  
+  plan->ncoord      = ncoord;
+  plan->nuv_per_cu  = nuv_per_cu;
+  plan->ncell       = (int *)malloc(ncoord*sizeof(int));
+  plan->cell        = (int *)malloc(ncoord*(size_t)nsamp_per_uv_in*sizeof(int));
+  plan->samp        = (int *)malloc(ncoord*(size_t)nsamp_per_uv_in*sizeof(int));
+  plan->plane_coord = (int *)malloc(nuv_per_cu*sizeof(int));
+  pair = (int *)malloc(2*nsamp_per_uv_in*sizeof(int));
+  if(plan->ncell == NULL || plan->cell == NULL || plan->samp == NULL || plan->plane_coord == NULL || pair == NULL){
+    fprintf(stderr, "ERROR: Failed to allocate memory for the gridding plan\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  for(i = 0; i < ncoord; i++){
+    for(j = 0; j < nsamp_per_uv_in; j++){
+      pair[2*j]   = coord[i*nsamp_per_uv_in + j];
+      pair[2*j+1] = j;
+    }
+    qsort(pair, nsamp_per_uv_in, 2*sizeof(int), compare_cell);
+    
+    n = 0;
+    for(j = 0; j < nsamp_per_uv_in; j++){
+      if(j + 1 < nsamp_per_uv_in && pair[2*j] == pair[2*(j+1)]){
+        continue; // A later sample goes to the same cell
+      }
+      loc = i*nsamp_per_uv_in + n;
+      plan->cell[loc] = pair[2*j];
+      plan->samp[loc] = pair[2*j+1];
+      n++;
+    }
+    plan->ncell[i] = n;
+  }
+  
+  // Output is assumed to be zero filled before the first call of grid_fast
+  for(i = 0; i < nuv_per_cu; i++){
+    plan->plane_coord[i] = -1;
+  }
+  
+  free(pair);
+  return EXIT_SUCCESS;
+}
+
+int grid_plan_destroy(
+                      grid_plan *plan){
+  free(plan->ncell);
+  free(plan->cell);
+  free(plan->samp);
+  free(plan->plane_coord);
+  
+  return EXIT_SUCCESS;
+}
+
+// Multithreaded version of grid(), planes are spread across threads
+// Only cells occupied by the previous coordinate set of a plane are cleared, instead of the whole plane
+int grid_fast(
+              uv_data_t *in,
+              grid_plan *plan,
+              uv_data_t *out,
+              int nuv_per_cu,
+              int nsamp_per_uv_in,
+              int nsamp_per_uv_out,
+              int nuv_per_coord
+              ){
+  int i;
+  int j;
+  int coord_set;
+  int previous_set;
+  int *cell;
+  int *samp;
+  size_t loc_in;
+  size_t loc_out;
+  
+#pragma omp parallel for private(j, coord_set, previous_set, cell, samp, loc_in, loc_out) schedule(static)
+  for(i = 0; i < nuv_per_cu; i++){
+    coord_set    = i/nuv_per_coord;
+    previous_set = plan->plane_coord[i];
+    
+    if(previous_set != coord_set && previous_set >= 0){
+      cell = &plan->cell[previous_set*nsamp_per_uv_in];
+      for(j = 0; j < plan->ncell[previous_set]; j++){
+        loc_out = (size_t)i*nsamp_per_uv_out + cell[j];
+        out[2*loc_out]   = 0;
+        out[2*loc_out+1] = 0;
+      }
+    }
+    
+    cell = &plan->cell[coord_set*nsamp_per_uv_in];
+    samp = &plan->samp[coord_set*nsamp_per_uv_in];
+    for(j = 0; j < plan->ncell[coord_set]; j++){
+      loc_in  = (size_t)i*nsamp_per_uv_in + samp[j];
+      loc_out = (size_t)i*nsamp_per_uv_out + cell[j];
+      out[2*loc_out]   = in[2*loc_in];
+      out[2*loc_out+1] = in[2*loc_in+1];
+    }
+    plan->plane_coord[i] = coord_set;
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// TIME-DM-UV is the order knl_grid produces planes in, DM-TIME-UV is the corner turn the stages after it read
+int grid_layout_create(
+                       grid_layout *layout,
+                       int ndm,
+                       int ntime,
+                       int nburst_per_uv_out,
+                       int dm_major){
+  layout->ndm          = ndm;
+  layout->stride_burst = 1;
+  if(dm_major){
+    layout->stride_time = nburst_per_uv_out;
+    layout->stride_dm   = ntime*nburst_per_uv_out;
+  }
+  else{
+    layout->stride_dm   = nburst_per_uv_out;
+    layout->stride_time = ndm*nburst_per_uv_out;
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Scatter planes in knl_grid order to the layout, the same way as knl_write does
+int grid_layout_apply(
+                      uv_data_t *in,
+                      uv_data_t *out,
+                      grid_layout *layout,
+                      int nuv_per_cu,
+                      int nburst_per_uv_out){
+  int i;
+  int j;
+  int k;
+  size_t loc_in;
+  size_t loc_out;
+  
+#pragma omp parallel for private(j, k, loc_in, loc_out) schedule(static)
+  for(i = 0; i < nuv_per_cu; i++){
+    for(j = 0; j < nburst_per_uv_out; j++){
+      loc_in  = (size_t)i*nburst_per_uv_out + j;
+      loc_out = (size_t)(i%layout->ndm)*layout->stride_dm + (size_t)(i/layout->ndm)*layout->stride_time + (size_t)j*layout->stride_burst;
+      for(k = 0; k < 2*NSAMP_PER_BURST; k++){
+        out[2*loc_out*NSAMP_PER_BURST + k] = in[2*loc_in*NSAMP_PER_BURST + k];
+      }
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// What the counters of knl_grid come to if no stage waits
+// A step of the tile ping-pong takes as long as the longer of its scatter and stream, at least one iteration, and GRID_DISTANCE more
+int grid_stats(
+               coord_t *coord,
+               int nuv_per_cu,
+               int nuv_per_coord,
+               int nburst_per_uv_in,
+               int nburst_per_uv_out,
+               stats_t *stats){
+  int i;
+  int j;
+  int step;
+  int coord_set;
+  int nentry[MTILE];
+  uint64_t nfill;
+  uint64_t ndrain;
+  uint64_t niteration;
+  int nsamp_per_uv_in = nburst_per_uv_in*NSAMP_PER_BURST;
+  int ntile = (nburst_per_uv_out + MBURST_PER_TILE - 1)/MBURST_PER_TILE;
+  uint64_t ngroup = nuv_per_cu/NLANE;
+  
+  memset(stats, 0x00, NSTATS*sizeof(stats_t));
+  
+  stats[STATS_READ2FIFO].active    = ngroup*nburst_per_uv_in*NLANE;
+  stats[STATS_READ2FIFO].burst     = ngroup*nburst_per_uv_in*NLANE;
+  stats[STATS_FILL_BUFFER].active  = ngroup*nburst_per_uv_in;
+  stats[STATS_FILL_BUFFER].burst   = ngroup*nburst_per_uv_in*NLANE;
+  stats[STATS_SCATTER_TILE].burst  = ngroup*nburst_per_uv_in*NLANE;
+  stats[STATS_STREAM_TILE].burst   = ngroup*nburst_per_uv_out*NLANE;
+  
+  for(i = 0; i < ngroup; i++){
+    coord_set = i*NLANE/nuv_per_coord;
+    memset(nentry, 0x00, sizeof(nentry));
+    for(j = 0; j < nsamp_per_uv_in; j++){
+      nentry[coord[coord_set*nsamp_per_uv_in + j]/MSAMP_PER_TILE]++;
+    }
+    
+    for(step = 0; step <= ntile; step++){
+      nfill  = (step < ntile) ? nentry[step] : 0;
+      ndrain = 0;
+      if(step > 0){
+        ndrain = nburst_per_uv_out - (step - 1)*MBURST_PER_TILE;
+        ndrain = (ndrain > MBURST_PER_TILE) ? MBURST_PER_TILE : ndrain;
+      }
+      niteration = (nfill > ndrain) ? nfill : ndrain;
+      niteration = (niteration > 0 ? niteration : 1) + GRID_DISTANCE;
+      
+      stats[STATS_SCATTER_TILE].active      += nfill;
+      stats[STATS_SCATTER_TILE].stall_full  += niteration - nfill;
+      stats[STATS_STREAM_TILE].active       += ndrain;
+      stats[STATS_STREAM_TILE].stall_empty  += niteration - ndrain;
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  uint64_t niteration;
+  
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "utilisation");
+  for(i = 0; i < nstats; i++){
+    niteration = stats[i].active + stats[i].stall_empty + stats[i].stall_full;
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst,
+            niteration ? 100.0*stats[i].active/niteration : 0.0);
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+int read_coord(char *fname, int flen, int fft_size, int *coord){
   FILE *fp = NULL;
   char line[LINE_LENGTH];
   int i;
@@ -57,9 +310,38 @@ int read_coord(char *fname, int flen, int *coord){
   for(i = 0; i < flen; i++){
     fgets(line, LINE_LENGTH, fp);
     sscanf(line, "%d\t%d", &coord_i, &coord_j);
-    coord[i] = coord_i*MFFT_SIZE+coord_j;
+    coord[i] = coord_i*fft_size+coord_j;
   }
   
   fclose(fp);
   return EXIT_SUCCESS;
 }
+
+// Rotate the coordinates around the grid centre to mimic the earth rotation
+int rotate_coord(
+                 int *coord_in,
+                 int *coord_out,
+                 int nsamp_per_uv_in,
+                 int fft_size,
+                 float angle){
+  int i;
+  int coord_i;
+  int coord_j;
+  float centre = fft_size/2;
+  float u;
+  float v;
+  
+  for(i = 0; i < nsamp_per_uv_in; i++){
+    u = coord_in[i]/fft_size - centre;
+    v = coord_in[i]%fft_size - centre;
+    
+    coord_i = (int)roundf(centre + u*cosf(angle) - v*sinf(angle));
+    coord_j = (int)roundf(centre + u*sinf(angle) + v*cosf(angle));
+    coord_i = coord_i < 0 ? 0 : (coord_i > fft_size - 1 ? fft_size - 1 : coord_i);
+    coord_j = coord_j < 0 ? 0 : (coord_j > fft_size - 1 ? fft_size - 1 : coord_j);
+    
+    coord_out[i] = coord_i*fft_size+coord_j;
+  }
+  
+  return EXIT_SUCCESS;
+}
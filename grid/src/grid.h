@@ -11,6 +11,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <math.h>
+#include <inttypes.h>
 #include <ap_fixed.h>
 #include <ap_int.h>
 #include <assert.h>
@@ -20,10 +22,12 @@
 #define FLOAT     1
 //#define DATA_WIDTH     32     // We use float 32-bits complex numbers
 #define DATA_WIDTH     16       // We use ap_fixed 16-bits complex numbers
-#define MFFT_SIZE            256
-#define COORD_WIDTH    16       // Wider than the required width, but to 2^n
+#define MFFT_SIZE            1024     // Max FFT size at synthesis, the real one is given at runtime
+#define COORD_WIDTH    32       // Wider than the required width, but to 2^n
 #define BURST_WIDTH         512
 #define NSAMP_PER_BURST     (BURST_WIDTH/(2*DATA_WIDTH))
+#define NLANE               4        // Number of UV planes gridded in parallel, each has its own output stream
+#define BURST_LENGTH        16       // Beats read from one plane before read2fifo moves to the next lane
 
 #define MDM                 1024
 #define MTIME               256
@@ -34,6 +38,12 @@
 #define MBURST_PER_UV_OUT   (MSAMP_PER_UV_OUT/NSAMP_PER_BURST)
 #define MBURST_PER_UV_IN    (MSAMP_PER_UV_IN/NSAMP_PER_BURST)
 
+#define MSAMP_PER_TILE      65536    // 256^2, the part of grid on chip
+#define MBURST_PER_TILE     (MSAMP_PER_TILE/NSAMP_PER_BURST)
+#define MTILE               (MSAMP_PER_UV_OUT/MSAMP_PER_TILE)
+#define CELL_BITS           16       // log2(MSAMP_PER_TILE), an entry of the sorted coordinates is sample<<CELL_BITS | cell in tile
+#define GRID_DISTANCE       4        // Iterations at least between a write and a read of the same word of the tile ping-pong
+
 #define INTEGER_WIDTH       (DATA_WIDTH/2)
 
 #if DATA_WIDTH == 32
@@ -75,16 +85,110 @@ typedef hls::stream<burst_uv> fifo_uv;
 typedef ap_axiu<BURST_WIDTH, 0, 0, 0> stream_t; 
 typedef hls::stream<stream_t> stream_uv;
 
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ2FIFO     0
+#define STATS_FILL_BUFFER   1
+#define STATS_SCATTER_TILE  2
+#define STATS_STREAM_TILE   3
+#define NSTATS              4
+
+// Gridding plan for grid_fast, built once for a set of coordinates
+typedef struct grid_plan{
+  int ncoord;           // Number of coordinate sets
+  int nuv_per_cu;       // Number of UV planes of the output
+  int *ncell;           // Number of occupied cells of each coordinate set
+  int *cell;            // Occupied cells of each coordinate set in ascending order
+  int *samp;            // Input sample which goes to each occupied cell
+  int *plane_coord;     // Coordinate set which filled each output plane last time, -1 for empty
+}grid_plan;
+
+// Where knl_write puts the bursts of each gridded plane, strides are in bursts
+// Planes come out of knl_grid TIME-DM, plane i is time i/ndm and DM i%ndm
+// Bursts of a plane stay whole, so any layout with UV inside goes out without a separate transpose pass
+typedef struct grid_layout{
+  int ndm;              // Number of DMs, to split the plane index
+  int stride_dm;        // Output stride of DM
+  int stride_time;      // Output stride of time
+  int stride_burst;     // Output stride of UV bursts, 1 keeps the writes of a plane in full AXI bursts
+}grid_layout;
+
 int grid(
 	 uv_data_t *in,
 	 coord_t *coord,
 	 uv_data_t *out,
 	 int nuv_per_cu,
          int nsamp_per_uv_in,
-         int nsamp_per_uv_out
+         int nsamp_per_uv_out,
+         int nuv_per_coord
 	 );
 
+int grid_plan_create(
+                     grid_plan *plan,
+                     coord_t *coord,
+                     int ncoord,
+                     int nsamp_per_uv_in,
+                     int nuv_per_cu);
+
+int grid_plan_destroy(
+                      grid_plan *plan);
+
+int grid_fast(
+              uv_data_t *in,
+              grid_plan *plan,
+              uv_data_t *out,
+              int nuv_per_cu,
+              int nsamp_per_uv_in,
+              int nsamp_per_uv_out,
+              int nuv_per_coord
+              );
+
+int grid_layout_create(
+                       grid_layout *layout,
+                       int ndm,
+                       int ntime,
+                       int nburst_per_uv_out,
+                       int dm_major);
+
+int grid_layout_apply(
+                      uv_data_t *in,
+                      uv_data_t *out,
+                      grid_layout *layout,
+                      int nuv_per_cu,
+                      int nburst_per_uv_out);
+
+int grid_stats(
+               coord_t *coord,
+               int nuv_per_cu,
+               int nuv_per_coord,
+               int nburst_per_uv_in,
+               int nburst_per_uv_out,
+               stats_t *stats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);
+
 int read_coord(
 	       char *fname,
 	       int flen,
+               int fft_size,
 	       int *coord);
+
+int rotate_coord(
+                 int *coord_in,
+                 int *coord_out,
+                 int nsamp_per_uv_in,
+                 int fft_size,
+                 float angle);
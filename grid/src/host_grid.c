@@ -9,9 +9,9 @@
 
 int main(int argc, char* argv[]){
   // Check argument
-  if (argc != 2) {
+  if (argc != 2 && argc != 3) {
     fprintf(stderr, "ERROR: Failed to execute the program!\n");
-    fprintf(stderr, "USAGE: %s xclbin\n", argv[0]);
+    fprintf(stderr, "USAGE: %s xclbin [fft_size]\n", argv[0]);
     fprintf(stderr, "INFO: Please re-execute it with the above usage method!\n");
     return EXIT_FAILURE;
   }	
@@ -25,23 +25,47 @@ int main(int argc, char* argv[]){
   //cl_int ntime_per_cu = 256;
   cl_int ntime_per_cu = 1;
   cl_int nuv_per_cu;
-  cl_int fft_size = MFFT_SIZE;
+  cl_int fft_size = 256;
   cl_int nsamp_per_uv_in  = 4368;
   cl_int nsamp_per_uv_out;
   cl_int nburst_per_uv_in;
   cl_int nburst_per_uv_out;
+  cl_int nuv_per_coord = 16;         // Number of UV planes which share the same coordinates
+  cl_int ncoord;
+  cl_float angle_per_coord = 1.0E-3; // Earth rotation angle between two coordinate sets in radian
+  cl_int dm_major = 1;               // knl_write corner turns planes to DM-TIME-UV for the stages after gridding
   
   if(is_hw_emulation()){
-    ndm          = 1;
-    ntime_per_cu = 1;
-    fft_size     = 256;
+    ndm           = NLANE;
+    ntime_per_cu  = 2;
+    fft_size      = 256;
+    nuv_per_coord = NLANE;
   }
   if(is_sw_emulation()){
-    ndm          = 1;
-    ntime_per_cu = 1;
-    fft_size     = 256;
+    ndm           = NLANE;
+    ntime_per_cu  = 2;
+    fft_size      = 512;        // More than one tile
+    nuv_per_coord = NLANE;
+  }
+  if(argc == 3){
+    fft_size = atoi(argv[2]);
+  }
+  if(fft_size > MFFT_SIZE || fft_size <= 0){
+    fprintf(stderr, "ERROR: FFT size %d is not in the range (0, %d]!\n", fft_size, MFFT_SIZE);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
   }
   nuv_per_cu = ntime_per_cu*ndm;
+  
+  // Kernel grids NLANE planes in one go and every coordinate set has whole groups
+  if(nuv_per_cu <= 0 || nuv_per_coord <= 0 || nuv_per_cu%NLANE || nuv_per_coord%NLANE){
+    fprintf(stderr, "ERROR: %d UV planes with %d planes per coordinate set should both be multiples of %d!\n", nuv_per_cu, nuv_per_coord, NLANE);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  ncoord     = (nuv_per_cu + nuv_per_coord - 1)/nuv_per_coord;
   nsamp_per_uv_out = fft_size*fft_size;
   
   nsamp_per_uv_in   = nsamp_per_uv_in - nsamp_per_uv_in%NSAMP_PER_BURST;
@@ -50,24 +74,33 @@ int main(int argc, char* argv[]){
   nburst_per_uv_out = nsamp_per_uv_out/NSAMP_PER_BURST;
   //fprintf(stdout, "%d\t%d\n", nburst_per_uv_in, nburst_per_uv_out);
   
-  ndata1 = nsamp_per_uv_out;
+  ndata1 = ncoord*(uint64_t)nsamp_per_uv_in;
   ndata2 = 2*nuv_per_cu*(uint64_t)nsamp_per_uv_in;
   ndata3 = 2*nuv_per_cu*(uint64_t)nsamp_per_uv_out;
   
   uv_data_t  *in = NULL;
+  uv_data_t  *sw_grid = NULL;
+  uv_data_t  *ref_grid = NULL;
   uv_data_t  *sw_out = NULL;
   uv_data_t  *hw_out = NULL;
   coord_t *coord = NULL;
   cl_int   *coord_int = NULL;
+  stats_t  *sw_stats = NULL;
+  stats_t  *hw_stats = NULL;
+  const char *stage[NSTATS] = {"read2fifo", "fill_buffer", "scatter_tile", "stream_tile"};
   
   in        = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(uv_data_t));
+  sw_grid   = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
+  ref_grid  = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
   sw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
   hw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
   coord     = (coord_t *)aligned_alloc(MEM_ALIGNMENT,  ndata1*sizeof(coord_t));
   coord_int = (cl_int *)aligned_alloc(MEM_ALIGNMENT,    ndata1*sizeof(cl_int));  
+  sw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT,   NSTATS*sizeof(stats_t));
+  hw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT,   NSTATS*sizeof(stats_t));
   
   fprintf(stdout, "INFO: %f MB memory used on host in total\n",
-	  ((ndata2 + 2*ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH)/(8*1024.*1024.));
+	  ((ndata2 + 4*ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device in total\n",
 	  ((ndata2 + ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device for raw input\n",
@@ -83,25 +116,54 @@ int main(int argc, char* argv[]){
   for(i = 0; i < ndata2; i++){
     in[i] = (uv_data_t)(0.99*(rand()%DATA_RANGE));
   }
-  read_coord("/data/FRIGG_2/Workspace/coherent-craft-sdaccel/grid/src/coord.txt", ndata1, coord_int);
+  read_coord("/data/FRIGG_2/Workspace/coherent-craft-sdaccel/grid/src/coord.txt", nsamp_per_uv_in, fft_size, coord_int);
+  for(i = 1; i < ncoord; i++){
+    rotate_coord(coord_int, &coord_int[i*nsamp_per_uv_in], nsamp_per_uv_in, fft_size, i*angle_per_coord);
+  }
   for(i = 0; i < ndata1; i++){
     coord[i] = (coord_t)coord_int[i];
     //if(coord_int[i]!=0)
     //  fprintf(stdout, "%d\n", (int)coord[i]);
   }
+  memset(sw_grid, 0x00, ndata3*sizeof(uv_data_t));
   memset(sw_out, 0x00, ndata3*sizeof(uv_data_t));
   memset(hw_out, 0x00, ndata3*sizeof(uv_data_t));
+  memset(hw_stats, 0x00, NSTATS*sizeof(stats_t));
   
   // Calculate on host
+  grid_plan plan;
+  grid_plan_create(&plan, coord, ncoord, nsamp_per_uv_in, nuv_per_cu);
+  grid_layout layout;
+  grid_layout_create(&layout, ndm, nuv_per_cu/ndm, nburst_per_uv_out, dm_major);
+  fprintf(stdout, "INFO: Output layout is %s-UV\n", dm_major ? "DM-TIME" : "TIME-DM");
+  
   cl_float cpu_elapsed_time;
   struct timespec host_start;
   struct timespec host_finish;
   clock_gettime(CLOCK_REALTIME, &host_start);
-  grid(in, coord, sw_out, nuv_per_cu, nsamp_per_uv_in, nsamp_per_uv_out);
+  grid_fast(in, &plan, sw_grid, nuv_per_cu, nsamp_per_uv_in, nsamp_per_uv_out, nuv_per_coord);
+  grid_layout_apply(sw_grid, sw_out, &layout, nuv_per_cu, nburst_per_uv_out);
+  grid_stats(coord, nuv_per_cu, nuv_per_coord, nburst_per_uv_in, nburst_per_uv_out, sw_stats);
   fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
   clock_gettime(CLOCK_REALTIME, &host_finish);
   cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
 
+  // The plain gridder checks the fast one
+  uint64_t nmismatch = 0;
+  grid(in, coord, ref_grid, nuv_per_cu, nsamp_per_uv_in, nsamp_per_uv_out, nuv_per_coord);
+  for(i = 0; i < ndata3; i++){
+    if(ref_grid[i] != sw_grid[i]){
+      nmismatch++;
+    }
+  }
+  if(nmismatch){
+    fprintf(stderr, "ERROR: %" PRIu64 " values of grid_fast do not match grid!\n", nmismatch);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  fprintf(stdout, "INFO: grid_fast matches grid\n");
+
   // Get platform ID and info
   cl_int err;
   cl_uint platforms;
@@ -152,9 +214,9 @@ int main(int argc, char* argv[]){
   cl_context context;
   OCL_CHECK(err, context = clCreateContext(0, 1, &device_id, NULL, NULL, &err));
   
-  // Create command queue
+  // Create command queue, out of order so that the streaming kernels run at the same time
   cl_command_queue queue;
-  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err));
+  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err));
   
   // Read kernel binary into memory
   char *xclbin = argv[1];
@@ -178,24 +240,31 @@ int main(int argc, char* argv[]){
   // Program the card with the program binary
   OCL_CHECK(err, err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL));
 
-  // Create the kernel
+  // Create the kernel, one knl_write CU for each lane of knl_grid
   cl_kernel knl_grid;
-  cl_kernel knl_write;
+  cl_kernel knl_write[NLANE];
+  char cu_name[LINE_LENGTH];
   OCL_CHECK(err, knl_grid  = clCreateKernel(program, "knl_grid", &err));
-  OCL_CHECK(err, knl_write = clCreateKernel(program, "knl_write", &err));
+  for(i = 0; i < NLANE; i++){
+    sprintf(cu_name, "knl_write:{knl_write_%d}", (int)i+1);
+    OCL_CHECK(err, knl_write[i] = clCreateKernel(program, cu_name, &err));
+  }
 
   // Prepare device buffer
   cl_mem buffer_in;
   cl_mem buffer_coord;
   cl_mem buffer_out;
-  cl_mem pt[3];
+  cl_mem buffer_stats;
+  cl_mem pt[4];
 
   OCL_CHECK(err, buffer_in    = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata2, in, &err));
   OCL_CHECK(err, buffer_coord = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(coord_t)*ndata1, coord, &err));
   OCL_CHECK(err, buffer_out   = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata3, hw_out, &err));
+  OCL_CHECK(err, buffer_stats = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, hw_stats, &err));
   if (!(buffer_in&&
 	buffer_coord&&
-	buffer_out
+	buffer_out&&
+	buffer_stats
 	)) {
     fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
     fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
@@ -208,16 +277,27 @@ int main(int argc, char* argv[]){
   pt[0] = buffer_in;
   pt[1] = buffer_coord;
   pt[2] = buffer_out;
+  pt[3] = buffer_stats;
 
   OCL_CHECK(err, err = clSetKernelArg(knl_grid, 0, sizeof(cl_mem), &buffer_in));
   OCL_CHECK(err, err = clSetKernelArg(knl_grid, 1, sizeof(cl_mem), &buffer_coord)); 
   OCL_CHECK(err, err = clSetKernelArg(knl_grid, 3, sizeof(cl_int), &nuv_per_cu));
   OCL_CHECK(err, err = clSetKernelArg(knl_grid, 4, sizeof(cl_int), &nburst_per_uv_in));
   OCL_CHECK(err, err = clSetKernelArg(knl_grid, 5, sizeof(cl_int), &nburst_per_uv_out));
+  OCL_CHECK(err, err = clSetKernelArg(knl_grid, 6, sizeof(cl_int), &nuv_per_coord));
+  OCL_CHECK(err, err = clSetKernelArg(knl_grid, 7, sizeof(cl_mem), &buffer_stats));
 
-  OCL_CHECK(err, err = clSetKernelArg(knl_write, 0, sizeof(cl_int), &nuv_per_cu));
-  OCL_CHECK(err, err = clSetKernelArg(knl_write, 1, sizeof(cl_int), &nburst_per_uv_out));
-  OCL_CHECK(err, err = clSetKernelArg(knl_write, 3, sizeof(cl_mem), &buffer_out));
+  cl_int lane;
+  for(lane = 0; lane < NLANE; lane++){
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 0, sizeof(cl_int), &nuv_per_cu));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 1, sizeof(cl_int), &nburst_per_uv_out));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 3, sizeof(cl_mem), &buffer_out));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 4, sizeof(cl_int), &lane));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 5, sizeof(cl_int), &layout.ndm));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 6, sizeof(cl_int), &layout.stride_dm));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 7, sizeof(cl_int), &layout.stride_time));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write[lane], 8, sizeof(cl_int), &layout.stride_burst));
+  }
   
   //OCL_CHECK(err, err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer_out));
   
@@ -235,14 +315,16 @@ int main(int argc, char* argv[]){
   cl_float kernel_elapsed_time;
   clock_gettime(CLOCK_REALTIME, &device_start);
   OCL_CHECK(err, err = clEnqueueTask(queue, knl_grid, 0, NULL, NULL));
-  OCL_CHECK(err, err = clEnqueueTask(queue, knl_write, 0, NULL, NULL));
+  for(i = 0; i < NLANE; i++){
+    OCL_CHECK(err, err = clEnqueueTask(queue, knl_write[i], 0, NULL, NULL));
+  }
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE KERNEL EXECUTION\n");
   clock_gettime(CLOCK_REALTIME, &device_finish);
   kernel_elapsed_time = (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
 
   // Migrate data from device to host
-  cl_int outputs = 1;
+  cl_int outputs = 2;
   OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[2], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE MEMCPY FROM KERNEL TO HOST\n");
@@ -260,19 +342,29 @@ int main(int argc, char* argv[]){
   
   fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
   fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
+  print_stats("Counters of CPU model", stage, sw_stats, NSTATS);
+  print_stats("Counters of kernel", stage, hw_stats, NSTATS);
   
   // Cleanup
   clReleaseMemObject(buffer_in);
   clReleaseMemObject(buffer_coord);
   clReleaseMemObject(buffer_out);
+  clReleaseMemObject(buffer_stats);
   
+  grid_plan_destroy(&plan);
   free(in);
   free(coord);
+  free(sw_grid);
+  free(ref_grid);
   free(sw_out);
   free(coord_int);
+  free(sw_stats);
+  free(hw_stats);
   clReleaseProgram(program);
   clReleaseKernel(knl_grid);
-  clReleaseKernel(knl_write);
+  for(i = 0; i < NLANE; i++){
+    clReleaseKernel(knl_write[i]);
+  }
   clReleaseCommandQueue(queue);
   clReleaseContext(context);
 
@@ -5,70 +5,125 @@ extern "C" {
   void knl_grid(
 		const burst_uv *in,
 		const burst_coord *coord,
-		stream_uv &out_stream,
+		stream_uv out_stream[NLANE],
 		int nuv_per_cu,
                 int nburst_per_uv_in,
-                int nburst_per_uv_out
+                int nburst_per_uv_out,
+                int nuv_per_coord,
+                stats_t *stats
 		);
 
   void read2fifo(
                  int nuv_per_cu,
                  int nburst_per_uv_in,
                  const burst_uv *in,
-                 fifo_uv &in_fifo);
+                 fifo_uv in_fifo[NLANE],
+                 fifo_stats &stats_fifo);
   
   void grid(
             int nuv_per_cu,
             int nburst_per_uv_in,
             int nburst_per_uv_out,
+            int nuv_per_coord,
             const burst_coord *coord,
-            fifo_uv &in_fifo,
-            stream_uv &out_stream
+            fifo_uv in_fifo[NLANE],
+            stream_uv out_stream[NLANE],
+            fifo_stats &fill_stats_fifo,
+            fifo_stats &scatter_stats_fifo,
+            fifo_stats &stream_stats_fifo
             );
   
-  void read_coord(
+  void grid_coord_set(
+                      int nuv,
+                      int nburst_per_uv_in,
+                      int nburst_per_uv_next,
+                      int nburst_per_uv_out,
+                      int coord_set,
+                      const burst_coord *coord,
+                      coord_t *entry,
+                      int tile_offset[MTILE+1],
+                      coord_t *next_entry,
+                      int next_tile_offset[MTILE+1],
+                      fifo_uv in_fifo[NLANE],
+                      stream_uv out_stream[NLANE],
+                      fifo_stats &fill_stats_fifo,
+                      fifo_stats &scatter_stats_fifo,
+                      fifo_stats &stream_stats_fifo
+                      );
+  
+  void load_coord(
                   int nburst_per_uv_in,
+                  int coord_set,
                   const burst_coord *coord,
-                  coord_t *coord_buffer);
-  
-  void set_grid_bool(
-                     int nburst_per_uv_in,
-                     int nburst_per_uv_out,
-                     coord_t *coord_buffer,
-                     bool grid_bool[MBURST_PER_UV_OUT][NSAMP_PER_BURST]);
+                  coord_t *entry,
+                  int tile_offset[MTILE+1]);
   
-  void fill_buffer(
-                   fifo_uv &in_fifo,
+  void grid_planes(
+                   int nuv,
                    int nburst_per_uv_in,
-                   uv_t *buffer
+                   int nburst_per_uv_out,
+                   coord_t *entry,
+                   int tile_offset[MTILE+1],
+                   fifo_uv in_fifo[NLANE],
+                   stream_uv out_stream[NLANE],
+                   fifo_stats &fill_stats_fifo,
+                   fifo_stats &scatter_stats_fifo,
+                   fifo_stats &stream_stats_fifo
                    );
   
-  void buffer2grid(
+  void read_coord(
+                  int nburst_per_uv_in,
+                  int coord_set,
+                  const burst_coord *coord,
+                  coord_t *coord_buffer,
+                  int nentry[MTILE]);
+  
+  void sort_coord(
+                  int nburst_per_uv_in,
+                  coord_t *coord_buffer,
+                  int nentry[MTILE],
+                  coord_t *entry,
+                  int tile_offset[MTILE+1]);
+  
+  void fill_buffer(
+                   fifo_uv in_fifo[NLANE],
                    int nburst_per_uv_in,
-                   coord_t *coord_buffer,
-                   uv_t *buffer,
-                   uv_t grid[MBURST_PER_UV_OUT][NSAMP_PER_BURST]
+                   uv_t buffer[NLANE][MSAMP_PER_UV_IN],
+                   fifo_stats &stats_fifo
                    );
   
-  void stream_grid(
-                   uv_t grid[MBURST_PER_UV_OUT][NSAMP_PER_BURST],
-                   int nburst_per_uv_out,
-                   bool grid_bool[MBURST_PER_UV_OUT][NSAMP_PER_BURST],
-                   stream_uv &out_stream
+  void grid_tiles(
+                  int nburst_per_uv_in,
+                  int nburst_per_uv_out,
+                  coord_t *entry,
+                  int tile_offset[MTILE+1],
+                  uv_t buffer[NLANE][MSAMP_PER_UV_IN],
+                  stream_uv out_stream[NLANE],
+                  fifo_stats &scatter_stats_fifo,
+                  fifo_stats &stream_stats_fifo
+                  );
+
+  void write_stats(
+                   int nuv_per_cu,
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats
                    );
 }
 
 void knl_grid(
 	      const burst_uv *in,
 	      const burst_coord *coord,
-              stream_uv &out_stream,
+              stream_uv out_stream[NLANE],
 	      int nuv_per_cu,
               int nburst_per_uv_in,
-              int nburst_per_uv_out
+              int nburst_per_uv_out,
+              int nuv_per_coord,
+              stats_t *stats
 	      )
 {
-#pragma HLS INTERFACE m_axi port = in    offset = slave bundle = gmem0 
+#pragma HLS INTERFACE m_axi port = in    offset = slave bundle = gmem0 max_read_burst_length = BURST_LENGTH
 #pragma HLS INTERFACE m_axi port = coord offset = slave bundle = gmem1 
+#pragma HLS INTERFACE m_axi port = stats offset = slave bundle = gmem2 
 #pragma HLS INTERFACE axis  port = out_stream
   
 #pragma HLS INTERFACE s_axilite port = in         bundle = control
@@ -76,226 +131,547 @@ void knl_grid(
 #pragma HLS INTERFACE s_axilite port = nuv_per_cu bundle = control
 #pragma HLS INTERFACE s_axilite port = nburst_per_uv_in  bundle = control
 #pragma HLS INTERFACE s_axilite port = nburst_per_uv_out bundle = control
+#pragma HLS INTERFACE s_axilite port = nuv_per_coord     bundle = control
+#pragma HLS INTERFACE s_axilite port = stats      bundle = control
   
 #pragma HLS INTERFACE s_axilite port = return bundle = control
   
 #pragma HLS DATA_PACK variable = in
 #pragma HLS DATA_PACK variable = coord
+#pragma HLS DATA_PACK variable = stats
 
-  fifo_uv in_fifo;
-#pragma HLS STREAM variable=in_fifo
+  const int lane_depth = 2*BURST_LENGTH;
+  
+  // One input FIFO and one output stream for each lane
+  // A lane FIFO holds the burst being read for it and the one fill_buffer still drains
+  fifo_uv in_fifo[NLANE];
+  fifo_stats stats_fifo[NSTATS]; // Counters of each stage
+#pragma HLS STREAM variable=in_fifo depth=lane_depth
+#pragma HLS STREAM variable=stats_fifo
 #pragma HLS DATAFLOW
   
   read2fifo(
             nuv_per_cu,
             nburst_per_uv_in,
             in,
-            in_fifo);
+            in_fifo,
+            stats_fifo[STATS_READ2FIFO]);
   
   grid(
        nuv_per_cu,
        nburst_per_uv_in,
        nburst_per_uv_out,
+       nuv_per_coord,
        coord,
        in_fifo,
-       out_stream
+       out_stream,
+       stats_fifo[STATS_FILL_BUFFER],
+       stats_fifo[STATS_SCATTER_TILE],
+       stats_fifo[STATS_STREAM_TILE]
        );
+
+  write_stats(
+              nuv_per_cu,
+              stats_fifo,
+              stats
+              );
 }
 
 void read2fifo(
                int nuv_per_cu,
                int nburst_per_uv_in,
                const burst_uv *in,
-               fifo_uv &in_fifo){
-  const int muv = MUV;
-  const int mburst_per_uv_in = MBURST_PER_UV_IN;
+               fifo_uv in_fifo[NLANE],
+               fifo_stats &stats_fifo){
+  const int mlane = MUV/NLANE;
+  const int mburst_per_group = MBURST_PER_UV_IN*NLANE;
 
   int i;
   int j;
+  int k;
+  int beat;
+  int nbeat;
+  int burst_start;
   int loc;
+  stats_t stats = {0, 0, 0, 0};
 
-  for(i = 0; i < nuv_per_cu; i++){
-#pragma HLS LOOP_TRIPCOUNT max=muv
+  // Lanes of a group take turns, each reads BURST_LENGTH consecutive beats of its own plane
+  // so that every turn is one AXI burst, the last turn of a plane may be shorter
+  for(i = 0; i < nuv_per_cu/NLANE; i++){
+#pragma HLS LOOP_TRIPCOUNT max=mlane
+    j           = 0;
+    k           = 0;
+    beat        = 0;
+    burst_start = 0;
+    nbeat       = (nburst_per_uv_in < BURST_LENGTH) ? nburst_per_uv_in : BURST_LENGTH;
   loop_read2fifo:
-    for(j = 0; j < nburst_per_uv_in; j++){
-#pragma HLS LOOP_TRIPCOUNT max=mburst_per_uv_in
+    while(j < nburst_per_uv_in*NLANE){
+#pragma HLS LOOP_TRIPCOUNT max=mburst_per_group
 #pragma HLS PIPELINE
-      loc = i*nburst_per_uv_in + j;
-      in_fifo.write(in[loc]);
+      // Count the cycles blocked by the gridding instead of waiting on the write
+      if(in_fifo[k].full()){
+        stats.stall_full++;
+      }
+      else{
+        loc = (i*NLANE + k)*nburst_per_uv_in + burst_start + beat;
+        in_fifo[k].write(in[loc]);
+        stats.active++;
+        stats.burst++;
+        j++;
+        
+        if(beat == nbeat - 1){
+          beat = 0;
+          if(k == NLANE - 1){
+            k = 0;
+            burst_start += BURST_LENGTH;
+            nbeat = (nburst_per_uv_in - burst_start < BURST_LENGTH) ? nburst_per_uv_in - burst_start : BURST_LENGTH;
+          }
+          else{
+            k++;
+          }
+        }
+        else{
+          beat++;
+        }
+      }
     }
   }
+  stats_fifo.write(stats);
 }
 
 void grid(
           int nuv_per_cu,
           int nburst_per_uv_in,
           int nburst_per_uv_out,
+          int nuv_per_coord,
           const burst_coord *coord,
-          fifo_uv &in_fifo,
-          stream_uv &out_stream
+          fifo_uv in_fifo[NLANE],
+          stream_uv out_stream[NLANE],
+          fifo_stats &fill_stats_fifo,
+          fifo_stats &scatter_stats_fifo,
+          fifo_stats &stream_stats_fifo
           ){
   int i;
+  int nuv;
+  int nburst_per_uv_next;
+  int ncoord = (nuv_per_cu + nuv_per_coord - 1)/nuv_per_coord;
   
   const int muv = MUV;
-  const int mburst_per_uv_out = MBURST_PER_UV_OUT;
-  const int mburst_per_uv_in = MBURST_PER_UV_IN;
 
-  uv_t buffer[MSAMP_PER_UV_IN];
-  uv_t grid[MBURST_PER_UV_OUT][NSAMP_PER_BURST];
-  coord_t coord_buffer[MSAMP_PER_UV_IN];
-  bool grid_bool[MBURST_PER_UV_OUT][NSAMP_PER_BURST];
+  // Two coordinate sets sorted by tile, one is used by the gridding while the other one is loaded
+  coord_t entry0[MSAMP_PER_UV_IN];
+  coord_t entry1[MSAMP_PER_UV_IN];
+  int tile_offset0[MTILE+1];
+  int tile_offset1[MTILE+1];
   
-  const int nsamp_per_burst = NSAMP_PER_BURST;
+#pragma HLS ARRAY_PARTITION variable = tile_offset0 complete
+#pragma HLS ARRAY_PARTITION variable = tile_offset1 complete
   
-//#pragma HLS ARRAY_RESHAPE variable = grid complete dim =2
-//#pragma HLS ARRAY_RESHAPE variable = grid_bool  complete dim =2
-//#pragma HLS ARRAY_RESHAPE variable = buffer cyclic factor = nsamp_per_burst
-//#pragma HLS ARRAY_RESHAPE variable = coord_buffer cyclic factor = nsamp_per_burst
+  load_coord(nburst_per_uv_in, 0, coord, entry0, tile_offset0);
   
-#pragma HLS ARRAY_PARTITION variable = grid complete dim =2
-#pragma HLS ARRAY_PARTITION variable = grid_bool  complete dim =2
-#pragma HLS ARRAY_PARTITION variable = buffer cyclic factor = nsamp_per_burst
+  for(i = 0; i < ncoord; i++){
+#pragma HLS LOOP_TRIPCOUNT max = muv
+    nuv = nuv_per_cu - i*nuv_per_coord;
+    if(nuv > nuv_per_coord){
+      nuv = nuv_per_coord;
+    }
+    nburst_per_uv_next = (i + 1 < ncoord) ? nburst_per_uv_in : 0; // Nothing to prefetch for the last set
+    
+    // Swap the role of two coordinate sets every other time
+    if(i%2 == 0){
+      grid_coord_set(nuv, nburst_per_uv_in, nburst_per_uv_next, nburst_per_uv_out, i, coord,
+                     entry0, tile_offset0, entry1, tile_offset1,
+                     in_fifo, out_stream, fill_stats_fifo, scatter_stats_fifo, stream_stats_fifo);
+    }
+    else{
+      grid_coord_set(nuv, nburst_per_uv_in, nburst_per_uv_next, nburst_per_uv_out, i, coord,
+                     entry1, tile_offset1, entry0, tile_offset0,
+                     in_fifo, out_stream, fill_stats_fifo, scatter_stats_fifo, stream_stats_fifo);
+    }
+  }
+}
+
+void grid_coord_set(
+                    int nuv,
+                    int nburst_per_uv_in,
+                    int nburst_per_uv_next,
+                    int nburst_per_uv_out,
+                    int coord_set,
+                    const burst_coord *coord,
+                    coord_t *entry,
+                    int tile_offset[MTILE+1],
+                    coord_t *next_entry,
+                    int next_tile_offset[MTILE+1],
+                    fifo_uv in_fifo[NLANE],
+                    stream_uv out_stream[NLANE],
+                    fifo_stats &fill_stats_fifo,
+                    fifo_stats &scatter_stats_fifo,
+                    fifo_stats &stream_stats_fifo
+                    ){
+  // Prefetch the next coordinate set while the current one is in use
+#pragma HLS DATAFLOW
+  load_coord(nburst_per_uv_next, coord_set + 1, coord, next_entry, next_tile_offset);
+  grid_planes(nuv, nburst_per_uv_in, nburst_per_uv_out, entry, tile_offset, in_fifo, out_stream,
+              fill_stats_fifo, scatter_stats_fifo, stream_stats_fifo);
+}
+
+// Coordinates are sorted by tile once per set, so that a tile only visits its own samples
+void load_coord(
+                int nburst_per_uv_in,
+                int coord_set,
+                const burst_coord *coord,
+                coord_t *entry,
+                int tile_offset[MTILE+1]){
+  const int nsamp_per_burst = NSAMP_PER_BURST;
+  
+  coord_t coord_buffer[MSAMP_PER_UV_IN];
+  int nentry[MTILE];
 #pragma HLS ARRAY_PARTITION variable = coord_buffer cyclic factor = nsamp_per_burst
+#pragma HLS ARRAY_PARTITION variable = nentry complete
   
-  read_coord(nburst_per_uv_in, coord, coord_buffer);
-  set_grid_bool(nburst_per_uv_in, nburst_per_uv_out, coord_buffer, grid_bool);
+  // No set comes after the last one, so the buffer it would go to is left alone
+  if(nburst_per_uv_in == 0){
+    return;
+  }
   
-  for(i = 0; i < nuv_per_cu; i++){
-#pragma HLS LOOP_TRIPCOUNT max = muv
+  read_coord(nburst_per_uv_in, coord_set, coord, coord_buffer, nentry);
+  sort_coord(nburst_per_uv_in, coord_buffer, nentry, entry, tile_offset);
+}
+
+void grid_planes(
+                 int nuv,
+                 int nburst_per_uv_in,
+                 int nburst_per_uv_out,
+                 coord_t *entry,
+                 int tile_offset[MTILE+1],
+                 fifo_uv in_fifo[NLANE],
+                 stream_uv out_stream[NLANE],
+                 fifo_stats &fill_stats_fifo,
+                 fifo_stats &scatter_stats_fifo,
+                 fifo_stats &stream_stats_fifo
+                 ){
+  int i;
+  
+  const int mlane = MUV/NLANE;
+
+  uv_t buffer[NLANE][MSAMP_PER_UV_IN];
+  
+  const int nsamp_per_burst = NSAMP_PER_BURST;
+  
+//#pragma HLS ARRAY_RESHAPE variable = buffer cyclic factor = nsamp_per_burst dim =2
+  
+#pragma HLS ARRAY_PARTITION variable = buffer complete dim =1
+#pragma HLS ARRAY_PARTITION variable = buffer cyclic factor = nsamp_per_burst dim =2
+  
+  // NLANE planes go through the chain together and share one coordinate lookup
+  for(i = 0; i < nuv/NLANE; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mlane
 #pragma HLS DATAFLOW
-    fill_buffer(in_fifo, nburst_per_uv_in, buffer);
-    buffer2grid(nburst_per_uv_in, coord_buffer, buffer, grid);
-    stream_grid(grid, nburst_per_uv_out, grid_bool, out_stream);
-    fprintf(stdout, "HERE\t%d\n", i);
+    fill_buffer(in_fifo, nburst_per_uv_in, buffer, fill_stats_fifo);
+    grid_tiles(nburst_per_uv_in, nburst_per_uv_out, entry, tile_offset, buffer, out_stream,
+               scatter_stats_fifo, stream_stats_fifo);
   }
 }
 
-void read_coord(
+// Only two tiles of the grid are on chip, tiles are streamed out in address order
+// Explicit ping-pong, tile s is scattered into one buffer while tile s-1 goes out of the other one,
+// the drain writes zeros back, so a buffer is clear again for the next tile
+// Both buffers are left alone for GRID_DISTANCE iterations before they swap
+void grid_tiles(
                 int nburst_per_uv_in,
-                const burst_coord *coord,
-                coord_t *coord_buffer){
-  int i;
+                int nburst_per_uv_out,
+                coord_t *entry,
+                int tile_offset[MTILE+1],
+                uv_t buffer[NLANE][MSAMP_PER_UV_IN],
+                stream_uv out_stream[NLANE],
+                fifo_stats &scatter_stats_fifo,
+                fifo_stats &stream_stats_fifo
+                ){
   int j;
-  int loc;
-
-  const int mburst_per_uv_in = MBURST_PER_UV_IN;
+  int k;
+  int step;
+  int ping;
+  int nfill;
+  int ndrain;
+  int nwait;
+  int nscatter;
+  int nentry;
+  int nburst_per_tile;
+  uint cell;
+  uint samp;
+  bool fill_bool;
+  bool drain_bool;
+  bool ready;
+  coord_t value;
+  ap_uint<BURST_WIDTH> burst;
+  stream_t stream;
+  stats_t scatter_stats = {0, 0, 0, 0};
+  stats_t stream_stats = {0, 0, 0, 0};
+  int ntile = (nburst_per_uv_out + MBURST_PER_TILE - 1)/MBURST_PER_TILE;
   
- loop_read_coord:
-  for(i = 0; i < nburst_per_uv_in; i++){
-#pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv_in
+  const int mcycle   = (MTILE + 1)*(MBURST_PER_TILE + GRID_DISTANCE);
+  const int distance = GRID_DISTANCE;
+  
+  // Cells no sample goes to have to be zero, the buffers start zero and every drain clears what it reads
+  static uv_t grid[2][NLANE][MBURST_PER_TILE][NSAMP_PER_BURST];
+  
+//#pragma HLS ARRAY_RESHAPE variable = grid complete dim =4
+#pragma HLS ARRAY_PARTITION variable = grid complete dim =1
+#pragma HLS ARRAY_PARTITION variable = grid complete dim =2
+#pragma HLS ARRAY_PARTITION variable = grid complete dim =4
+  
+  // Step s scatters tile s into buffer s%2 and streams tile s-1 from the other buffer
+  step     = 0;
+  nfill    = 0;
+  ndrain   = 0;
+  nwait    = 0;
+  nscatter = 0;
+ loop_grid_tiles:
+  while(step <= ntile){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mcycle
 #pragma HLS PIPELINE
-    for(j = 0; j < NSAMP_PER_BURST; j++){
-      loc = i*NSAMP_PER_BURST+j;
-      coord_buffer[loc] = coord[i].data[j];
+#pragma HLS DEPENDENCE variable = grid inter distance = distance true
+    ping            = step%2;
+    nentry          = (step < ntile) ? tile_offset[step+1] - tile_offset[step] : 0;
+    nburst_per_tile = nburst_per_uv_out - (step - 1)*MBURST_PER_TILE;
+    if(nburst_per_tile > MBURST_PER_TILE){
+      nburst_per_tile = MBURST_PER_TILE;
     }
-  }  
+    fill_bool  = (step < ntile) && (nfill < nentry);
+    drain_bool = (step > 0) && (ndrain < nburst_per_tile);
+    
+    // On-chip to on-chip, the scatter only waits on the stream of the tile before
+    if(!fill_bool){
+      scatter_stats.stall_full++;
+    }
+    else{
+      value = entry[tile_offset[step] + nfill];
+      samp  = value >> CELL_BITS;
+      cell  = value & (MSAMP_PER_TILE - 1);
+      for(k = 0; k < NLANE; k++){
+        grid[ping][k][cell/NSAMP_PER_BURST][cell%NSAMP_PER_BURST] = buffer[k][samp];
+      }
+      scatter_stats.active++;
+      if(nscatter%NSAMP_PER_BURST == NSAMP_PER_BURST - 1){
+        scatter_stats.burst += NLANE;
+      }
+      nscatter++;
+      nfill++;
+    }
+    
+    // Downstream back pressure on any lane stalls the stream
+    ready = true;
+    for(k = 0; k < NLANE; k++){
+      ready = ready && !out_stream[k].full();
+    }
+    
+    if(!drain_bool){
+      stream_stats.stall_empty++;
+    }
+    else if(!ready){
+      stream_stats.stall_full++;
+    }
+    else{
+      for(k = 0; k < NLANE; k++){
+        for(j = 0; j < NSAMP_PER_BURST; j++){
+          burst(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH) = grid[1-ping][k][ndrain][j];
+          grid[1-ping][k][ndrain][j] = 0;
+        }
+        
+        stream.data = burst;
+        out_stream[k].write(stream);
+      }
+      stream_stats.active++;
+      stream_stats.burst += NLANE;
+      ndrain++;
+    }
+    
+    if((step == ntile || nfill == nentry) && (step == 0 || ndrain == nburst_per_tile)){
+      if(nwait == GRID_DISTANCE){
+        step++;
+        nfill  = 0;
+        ndrain = 0;
+        nwait  = 0;
+      }
+      else{
+        nwait++;
+      }
+    }
+  }
+  scatter_stats_fifo.write(scatter_stats);
+  stream_stats_fifo.write(stream_stats);
 }
 
 void fill_buffer(
-                 fifo_uv &in_fifo,
+                 fifo_uv in_fifo[NLANE],
                  int nburst_per_uv_in,
-                 uv_t *buffer
+                 uv_t buffer[NLANE][MSAMP_PER_UV_IN],
+                 fifo_stats &stats_fifo
                  ){
   int i;
   int j;
+  int k;
   int loc;
+  bool ready;
   burst_uv burst;
+  stats_t stats = {0, 0, 0, 0};
   const int mburst_per_uv_in = MBURST_PER_UV_IN;
   
+  i = 0;
  loop_fill_buffer:
-  for(i = 0; i < nburst_per_uv_in; i++){
+  while(i < nburst_per_uv_in){
 #pragma HLS LOOP_TRIPCOUNT max=mburst_per_uv_in
 #pragma HLS PIPELINE
+    // All lanes move together, so one empty lane stalls the stage
+    ready = true;
+    for(k = 0; k < NLANE; k++){
+      ready = ready && !in_fifo[k].empty();
+    }
     
-    burst = in_fifo.read();
+    if(!ready){
+      stats.stall_empty++;
+    }
+    else{
+      for(k = 0; k < NLANE; k++){
+        burst = in_fifo[k].read();
+        for(j = 0; j < NSAMP_PER_BURST; j++){
+          loc = i*NSAMP_PER_BURST+j;
+          buffer[k][loc] = burst.data[j];
+        }
+      }
+      stats.active++;
+      stats.burst += NLANE;
+      i++;
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Counts the samples of each tile on the way in
+void read_coord(
+                int nburst_per_uv_in,
+                int coord_set,
+                const burst_coord *coord,
+                coord_t *coord_buffer,
+                int nentry[MTILE]){
+  int i;
+  int j;
+  int t;
+  int n;
+  int loc;
+  burst_coord burst;
+
+  const int mburst_per_uv_in = MBURST_PER_UV_IN;
+  
+  for(t = 0; t < MTILE; t++){
+#pragma HLS UNROLL
+    nentry[t] = 0;
+  }
+  
+ loop_read_coord:
+  for(i = 0; i < nburst_per_uv_in; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv_in
+#pragma HLS PIPELINE
+    burst = coord[coord_set*nburst_per_uv_in + i];
     for(j = 0; j < NSAMP_PER_BURST; j++){
       loc = i*NSAMP_PER_BURST+j;
-      buffer[loc] = burst.data[j];
+      coord_buffer[loc] = burst.data[j];
     }
-  }
+    for(t = 0; t < MTILE; t++){
+      n = 0;
+      for(j = 0; j < NSAMP_PER_BURST; j++){
+        n += (burst.data[j]/MSAMP_PER_TILE == t);
+      }
+      nentry[t] += n;
+    }
+  }  
 }
 
-void buffer2grid(
-                 int nburst_per_uv_in,
-                 coord_t *coord_buffer,
-                 uv_t *buffer,
-                 uv_t grid[MBURST_PER_UV_OUT][NSAMP_PER_BURST]
-                 ){
+// Counting sort, samples of tile t go to entry[tile_offset[t]] on in input order,
+// so that the last of several samples to the same cell still wins
+void sort_coord(
+                int nburst_per_uv_in,
+                coord_t *coord_buffer,
+                int nentry[MTILE],
+                coord_t *entry,
+                int tile_offset[MTILE+1]){
   int i;
-  uint loc_i;
-  uint loc_j;
+  int t;
   uint coord;
+  int next[MTILE];
+#pragma HLS ARRAY_PARTITION variable = next complete
+
   const int msamp_per_uv_in = MSAMP_PER_UV_IN;
   
- loop_buffer2grid:
+  tile_offset[0] = 0;
+  for(t = 0; t < MTILE; t++){
+#pragma HLS UNROLL
+    next[t]          = tile_offset[t];
+    tile_offset[t+1] = tile_offset[t] + nentry[t];
+  }
+  
+ loop_sort_coord:
   for(i = 0; i < nburst_per_uv_in*NSAMP_PER_BURST; i++){
 #pragma HLS LOOP_TRIPCOUNT max = msamp_per_uv_in
 #pragma HLS PIPELINE
     coord = coord_buffer[i];
-    loc_i = coord/NSAMP_PER_BURST;
-    loc_j = coord%NSAMP_PER_BURST;
-    grid[loc_i][loc_j] = buffer[i];
+    t     = coord/MSAMP_PER_TILE;
+    entry[next[t]] = ((coord_t)i << CELL_BITS) | (coord%MSAMP_PER_TILE);
+    next[t]++;
   }
 }
 
-void stream_grid(
-                 uv_t grid[MBURST_PER_UV_OUT][NSAMP_PER_BURST],
-                 int nburst_per_uv_out,
-                 bool grid_bool[MBURST_PER_UV_OUT][NSAMP_PER_BURST],
-                 stream_uv &out_stream
+void write_stats(
+                 int nuv_per_cu,
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats
                  ){
   int i;
-  int j;
-  uint coord;
-  int loc_coord;
-  
-  ap_uint<BURST_WIDTH> burst;
-  stream_t stream;
-  const int mburst_per_uv_out = MBURST_PER_UV_OUT;
-
- loop_grid:
-  for(i = 0; i < nburst_per_uv_out; i++){
-#pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv_out
-#pragma HLS PIPELINE
-    for(j = 0; j < NSAMP_PER_BURST; j++){
-      burst(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH) = grid_bool[i][j]*grid[i][j];
-    }
-    
-    stream.data = burst;
-    out_stream.write(stream);
-  }  
-}
-
-void set_grid_bool(
-                   int nburst_per_uv_in,
-                   int nburst_per_uv_out,
-                   coord_t *coord_buffer,
-                   bool grid_bool[MBURST_PER_UV_OUT][NSAMP_PER_BURST]){  
-  int i;
-  int j;
-  uint loc_i;
-  uint loc_j;
-  uint coord;
+  bool finish;
+  int nrecord[NSTATS];
+  int count[NSTATS];
+  stats_t record;
+  stats_t total[NSTATS];
+#pragma HLS ARRAY_PARTITION variable = nrecord complete
+#pragma HLS ARRAY_PARTITION variable = count   complete
+#pragma HLS ARRAY_PARTITION variable = total   complete
 
-  const int msamp_per_uv_in = MSAMP_PER_UV_IN;
-  const int mburst_per_uv_out = MBURST_PER_UV_OUT;
+  // Stages send one record per call
+  nrecord[STATS_READ2FIFO]    = 1;
+  nrecord[STATS_FILL_BUFFER]  = nuv_per_cu/NLANE;
+  nrecord[STATS_SCATTER_TILE] = nuv_per_cu/NLANE;
+  nrecord[STATS_STREAM_TILE]  = nuv_per_cu/NLANE;
+  
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS UNROLL
+    count[i] = 0;
+    total[i].active      = 0;
+    total[i].stall_empty = 0;
+    total[i].stall_full  = 0;
+    total[i].burst       = 0;
+  }
 
- loop_reset_grid_bool:
-  for(i = 0; i < nburst_per_uv_out; i++){
+  // Read without blocking, a stage which is done early must not wait on the others
+  finish = false;
+ loop_collect_stats:
+  while(!finish){
 #pragma HLS PIPELINE
-#pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv_out
-    for(j = 0; j < NSAMP_PER_BURST; j++){
-      grid_bool[i][j] = false;
+    finish = true;
+    for(i = 0; i < NSTATS; i++){
+      if(count[i] < nrecord[i] && stats_fifo[i].read_nb(record)){
+        total[i].active      += record.active;
+        total[i].stall_empty += record.stall_empty;
+        total[i].stall_full  += record.stall_full;
+        total[i].burst       += record.burst;
+        count[i]++;
+      }
+      finish = finish && (count[i] == nrecord[i]);
     }
   }
-
- loop_set_grid_bool:
-  for(i = 0; i < nburst_per_uv_in*NSAMP_PER_BURST; i++){
+  
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
 #pragma HLS PIPELINE
-#pragma HLS LOOP_TRIPCOUNT max = msamp_per_uv_in
-    coord = coord_buffer[i];
-    loc_i = coord/NSAMP_PER_BURST;
-    loc_j = coord%NSAMP_PER_BURST;
-    grid_bool[loc_i][loc_j] = true;
+    stats[i] = total[i];
   }
 }
@@ -5,14 +5,27 @@ extern "C"{
                  int nuv_per_cu,
                  int nburst_per_uv_out,
                  stream_uv &out_stream,
-                 burst_uv *out);
+                 burst_uv *out,
+                 int lane,
+                 int ndm,
+                 int stride_dm,
+                 int stride_time,
+                 int stride_burst);
 }
 
+// One CU for each lane of knl_grid, the lane tells which planes it writes
+// Planes go to the layout given by the strides (see grid_layout), so the output can be corner turned here
+// With stride_burst 1 the bursts of a plane are still contiguous and the writes stay in full AXI bursts
 void knl_write(                 
                int nuv_per_cu,
                int nburst_per_uv_out,
                stream_uv &out_stream,
-               burst_uv *out){
+               burst_uv *out,
+               int lane,
+               int ndm,
+               int stride_dm,
+               int stride_time,
+               int stride_burst){
 
 #pragma HLS INTERFACE m_axi port = out      offset = slave bundle = gmem2
 #pragma HLS INTERFACE axis  port = out_stream
@@ -20,23 +33,31 @@ void knl_write(
 #pragma HLS INTERFACE s_axilite port = nuv_per_cu        bundle = control
 #pragma HLS INTERFACE s_axilite port = nburst_per_uv_out bundle = control
 #pragma HLS INTERFACE s_axilite port = out               bundle = control
+#pragma HLS INTERFACE s_axilite port = lane              bundle = control
+#pragma HLS INTERFACE s_axilite port = ndm               bundle = control
+#pragma HLS INTERFACE s_axilite port = stride_dm         bundle = control
+#pragma HLS INTERFACE s_axilite port = stride_time       bundle = control
+#pragma HLS INTERFACE s_axilite port = stride_burst      bundle = control
 #pragma HLS INTERFACE s_axilite port = return            bundle = control
 
-  const int muv = MUV;
+  const int mlane = MUV/NLANE;
   const int mburst_per_uv_out = MBURST_PER_UV_OUT;
   
   int i;
   int j;
   int k;
-  int loc;
+  int plane;
+  uint64_t loc;
   burst_uv burst;
   stream_t stream;
 
 #pragma HLS DATA_PACK variable=out
 #pragma HLS DATA_PACK variable=burst
   
-  for(i = 0; i < nuv_per_cu; i++){
-#pragma HLS LOOP_TRIPCOUNT max = muv
+  for(i = 0; i < nuv_per_cu/NLANE; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mlane
+    plane = i*NLANE + lane;
+    loc   = (uint64_t)(plane%ndm)*stride_dm + (uint64_t)(plane/ndm)*stride_time;
   loop_write:
     for(j = 0; j < nburst_per_uv_out; j++){
 #pragma HLS LOOP_TRIPCOUNT max = mburst_per_uv_out
@@ -45,8 +66,8 @@ void knl_write(
       for(k = 0; k < NSAMP_PER_BURST; k++){
         burst.data[k] = stream.data(2*(k+1)*DATA_WIDTH-1, 2*k*DATA_WIDTH);
       }
-      loc = i*nburst_per_uv_out + j;
       out[loc] = burst;
+      loc += stride_burst;
     }
   }
 }
@@ -0,0 +1,663 @@
+#include "permute.h"
+
+// Permute up to NAXIS axes, output axis i is input axis perm[i]
+// The fastest axis of both sides is padded to whole bursts in memory and edge tiles are masked
+// Tiles are up to TILE_WIDTH rows of up to BURST_LENGTH bursts, sized from the axes so that edge tiles carry little padding
+// The plan is built before the dataflow region, which only gets scalars
+extern "C" {
+  void knl_permute(
+                   const burst_uv *in,
+                   burst_uv *out,
+                   int naxis0,
+                   int naxis1,
+                   int naxis2,
+                   int naxis3,
+                   int perm0,
+                   int perm1,
+                   int perm2,
+                   int perm3,
+                   stats_t *stats
+                   );
+
+  void plan_permute(
+                    int naxis0,
+                    int naxis1,
+                    int naxis2,
+                    int naxis3,
+                    int perm0,
+                    int perm1,
+                    int perm2,
+                    int perm3,
+                    permute_plan &plan);
+
+  void permute_memory(
+                      const burst_uv *in,
+                      burst_uv *out,
+                      int flip,
+                      int nouter0,
+                      int nouter1,
+                      int ntile_row,
+                      int ntile_col,
+                      int tile_nrow,
+                      int tile_nburst,
+                      int nrow_in,
+                      int ncol_in,
+                      int stride0_in,
+                      int stride1_in,
+                      int stride_row_in,
+                      int nrow_out,
+                      int ncol_out,
+                      int stride0_out,
+                      int stride1_out,
+                      int stride_row_out,
+                      stats_t *stats);
+
+  void read2fifo(
+                 int nouter0,
+                 int nouter1,
+                 int ntile_row,
+                 int ntile_col,
+                 int tile_nrow,
+                 int tile_nburst,
+                 int nrow,
+                 int ncol,
+                 int stride0,
+                 int stride1,
+                 int stride_row,
+                 const burst_uv *in,
+                 fifo_uv &in_fifo,
+                 fifo_stats &stats_fifo);
+
+  void permute(
+               int ntile,
+               int flip,
+               int tile_nrow,
+               int tile_nburst,
+               fifo_uv &in_fifo,
+               fifo_uv &out_fifo,
+               fifo_stats &fill_stats_fifo,
+               fifo_stats &permute_stats_fifo);
+
+  void mask_burst(
+                  burst_uv &burst,
+                  int nsamp_valid);
+
+  void write_from_fifo(
+                       int flip,
+                       int nouter0,
+                       int nouter1,
+                       int ntile_row,
+                       int ntile_col,
+                       int tile_nrow,
+                       int tile_nburst,
+                       int nrow,
+                       int ncol,
+                       int stride0,
+                       int stride1,
+                       int stride_row,
+                       fifo_uv &out_fifo,
+                       burst_uv *out,
+                       fifo_stats &stats_fifo);
+
+  void next_burst(
+                  int nouter1,
+                  int ntile_row,
+                  int ntile_col,
+                  int nrow,
+                  int nburst,
+                  int &i,
+                  int &j,
+                  int &k,
+                  int &l,
+                  int &m,
+                  int &n);
+
+  void write_stats(
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats);
+}
+
+void knl_permute(
+                 const burst_uv *in,
+                 burst_uv *out,
+                 int naxis0,
+                 int naxis1,
+                 int naxis2,
+                 int naxis3,
+                 int perm0,
+                 int perm1,
+                 int perm2,
+                 int perm3,
+                 stats_t *stats
+                 )
+{
+  const int burst_length      = BURST_LENGTH;
+
+#pragma HLS INTERFACE m_axi port = in    offset = slave bundle = gmem0 max_read_burst_length =burst_length
+#pragma HLS INTERFACE m_axi port = out   offset = slave bundle = gmem1 max_write_burst_length=burst_length
+#pragma HLS INTERFACE m_axi port = stats offset = slave bundle = gmem2
+
+#pragma HLS INTERFACE s_axilite port = in     bundle = control
+#pragma HLS INTERFACE s_axilite port = out    bundle = control
+#pragma HLS INTERFACE s_axilite port = stats  bundle = control
+
+#pragma HLS INTERFACE s_axilite port = naxis0 bundle = control
+#pragma HLS INTERFACE s_axilite port = naxis1 bundle = control
+#pragma HLS INTERFACE s_axilite port = naxis2 bundle = control
+#pragma HLS INTERFACE s_axilite port = naxis3 bundle = control
+#pragma HLS INTERFACE s_axilite port = perm0  bundle = control
+#pragma HLS INTERFACE s_axilite port = perm1  bundle = control
+#pragma HLS INTERFACE s_axilite port = perm2  bundle = control
+#pragma HLS INTERFACE s_axilite port = perm3  bundle = control
+#pragma HLS INTERFACE s_axilite port = return bundle = control
+
+#pragma HLS DATA_PACK variable = in
+#pragma HLS DATA_PACK variable = out
+#pragma HLS DATA_PACK variable = stats
+
+  permute_plan plan;
+
+  plan_permute(
+               naxis0,
+               naxis1,
+               naxis2,
+               naxis3,
+               perm0,
+               perm1,
+               perm2,
+               perm3,
+               plan);
+
+  // A flip turns the tile, output rows are then the columns of the input tile
+  permute_memory(
+                 in,
+                 out,
+                 plan.flip,
+                 plan.naxis[plan.outer[0]],
+                 plan.naxis[plan.outer[1]],
+                 plan.ntile_row,
+                 plan.ntile_col,
+                 plan.tile_nrow,
+                 plan.tile_nburst,
+                 plan.naxis[plan.row_in],
+                 plan.naxis[NAXIS-1],
+                 plan.stride_in[plan.outer[0]],
+                 plan.stride_in[plan.outer[1]],
+                 plan.stride_in[plan.row_in],
+                 plan.naxis[plan.row_out],
+                 plan.flip ? plan.naxis[plan.row_in] : plan.naxis[NAXIS-1],
+                 plan.stride_out[plan.outer[0]],
+                 plan.stride_out[plan.outer[1]],
+                 plan.stride_out[plan.row_out],
+                 stats);
+}
+
+void permute_memory(
+                    const burst_uv *in,
+                    burst_uv *out,
+                    int flip,
+                    int nouter0,
+                    int nouter1,
+                    int ntile_row,
+                    int ntile_col,
+                    int tile_nrow,
+                    int tile_nburst,
+                    int nrow_in,
+                    int ncol_in,
+                    int stride0_in,
+                    int stride1_in,
+                    int stride_row_in,
+                    int nrow_out,
+                    int ncol_out,
+                    int stride0_out,
+                    int stride1_out,
+                    int stride_row_out,
+                    stats_t *stats){
+  fifo_uv in_fifo;
+  fifo_uv out_fifo;
+  fifo_stats stats_fifo[NSTATS]; // Counters of each stage
+  int ntile = nouter0*nouter1*ntile_row*ntile_col;
+  const int nburst_per_tran = BURST_LENGTH*BURST_LENGTH;
+#pragma HLS STREAM variable = in_fifo  depth = nburst_per_tran
+#pragma HLS STREAM variable = out_fifo depth = nburst_per_tran
+#pragma HLS STREAM variable = stats_fifo
+
+#pragma HLS DATAFLOW
+
+  read2fifo(
+            nouter0,
+            nouter1,
+            ntile_row,
+            ntile_col,
+            tile_nrow,
+            tile_nburst,
+            nrow_in,
+            ncol_in,
+            stride0_in,
+            stride1_in,
+            stride_row_in,
+            in,
+            in_fifo,
+            stats_fifo[STATS_READ2FIFO]);
+
+  permute(
+          ntile,
+          flip,
+          tile_nrow,
+          tile_nburst,
+          in_fifo,
+          out_fifo,
+          stats_fifo[STATS_FILL_TILE],
+          stats_fifo[STATS_PERMUTE_TILE]);
+
+  write_from_fifo(
+                  flip,
+                  nouter0,
+                  nouter1,
+                  ntile_row,
+                  ntile_col,
+                  tile_nrow,
+                  tile_nburst,
+                  nrow_out,
+                  ncol_out,
+                  stride0_out,
+                  stride1_out,
+                  stride_row_out,
+                  out_fifo,
+                  out,
+                  stats_fifo[STATS_WRITE_FROM_FIFO]);
+
+  write_stats(
+              stats_fifo,
+              stats);
+}
+
+// The plan is shared with the host, a bad perm gives an empty plan and the kernel only sends its counters
+void plan_permute(
+                  int naxis0,
+                  int naxis1,
+                  int naxis2,
+                  int naxis3,
+                  int perm0,
+                  int perm1,
+                  int perm2,
+                  int perm3,
+                  permute_plan &plan){
+  int naxis[NAXIS];
+  int perm[NAXIS];
+#pragma HLS ARRAY_PARTITION variable = naxis complete
+#pragma HLS ARRAY_PARTITION variable = perm  complete
+
+  naxis[0] = naxis0;
+  naxis[1] = naxis1;
+  naxis[2] = naxis2;
+  naxis[3] = naxis3;
+  perm[0]  = perm0;
+  perm[1]  = perm1;
+  perm[2]  = perm2;
+  perm[3]  = perm3;
+
+  permute_plan_create(naxis, perm, &plan);
+}
+
+void read2fifo(
+               int nouter0,
+               int nouter1,
+               int ntile_row,
+               int ntile_col,
+               int tile_nrow,
+               int tile_nburst,
+               int nrow,
+               int ncol,
+               int stride0,
+               int stride1,
+               int stride_row,
+               const burst_uv *in,
+               fifo_uv &in_fifo,
+               fifo_stats &stats_fifo){
+  int i;
+  int j;
+  int k;
+  int l;
+  int m;
+  int n;
+  int loc_burst;
+  int row;
+  int burst_col;
+  bool valid;
+  uint64_t nread;
+  burst_uv burst;
+  stats_t stats = {0, 0, 0, 0};
+  int nburst = (ncol + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  uint64_t ntotal = (uint64_t)nouter0*nouter1*ntile_row*ntile_col*tile_nrow*tile_nburst;
+
+  const int mburst = MPERMUTE_BURST;
+
+  // One flat loop over outer axes, tiles, rows of a tile and bursts of a row, the fastest counter goes first
+  i     = 0;
+  j     = 0;
+  k     = 0;
+  l     = 0;
+  m     = 0;
+  n     = 0;
+  nread = 0;
+ loop_read2fifo:
+  while(nread < ntotal){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
+#pragma HLS PIPELINE
+    if(in_fifo.full()){
+      stats.stall_full++;
+    }
+    else{
+      // Edge tiles are filled up with zeros, so the rest of the chain always sees full tiles
+      row       = k*tile_nrow+m;
+      burst_col = l*tile_nburst+n;
+      valid     = (row < nrow) && (burst_col < nburst);
+      loc_burst = i*stride0 +
+        j*stride1 +
+        row*stride_row +
+        burst_col;
+      if(valid){
+        burst = in[loc_burst];
+        stats.burst++;
+      }
+      mask_burst(burst, valid ? ncol - burst_col*NSAMP_PER_BURST : 0);
+      in_fifo.write(burst);
+      stats.active++;
+      nread++;
+      
+      next_burst(nouter1, ntile_row, ntile_col, tile_nrow, tile_nburst, i, j, k, l, m, n);
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Explicit ping-pong, step s fills tile s into buffer s%2 and sends tile s-1 out of the other buffer
+// The tile is sent by columns if the fastest axis changes, otherwise by rows,
+// a turned tile has a row per input column and tile_nrow is whole bursts then
+// Both buffers are left alone for PERMUTE_DISTANCE iterations before they swap, tiles can be as small as one burst
+void permute(
+             int ntile,
+             int flip,
+             int tile_nrow,
+             int tile_nburst,
+             fifo_uv &in_fifo,
+             fifo_uv &out_fifo,
+             fifo_stats &fill_stats_fifo,
+             fifo_stats &permute_stats_fifo){
+  int n1;
+  int step;
+  int ping;
+  int nfill;
+  int ndrain;
+  int nwait;
+  int m;
+  int n;
+  int loc_tile;
+  int nburst_per_tile;
+  int nburst_out;
+  bool fill_bool;
+  bool drain_bool;
+  burst_uv fill_burst;
+  burst_uv drain_burst;
+  stats_t fill_stats = {0, 0, 0, 0};
+  stats_t permute_stats = {0, 0, 0, 0};
+
+  const int mburst          = MPERMUTE_BURST;
+  const int distance        = PERMUTE_DISTANCE;
+  const int nsamp_per_burst = NSAMP_PER_BURST;
+
+  uv_t uv_tile[2][TILE_WIDTH][TILE_WIDTH];
+#pragma HLS ARRAY_PARTITION variable = uv_tile    complete dim =1
+#pragma HLS ARRAY_PARTITION variable = uv_tile    cyclic factor = nsamp_per_burst dim =2
+#pragma HLS ARRAY_PARTITION variable = uv_tile    cyclic factor = nsamp_per_burst dim =3
+
+  nburst_per_tile = tile_nrow*tile_nburst;
+  nburst_out      = flip ? tile_nrow/NSAMP_PER_BURST : tile_nburst;
+
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+  nwait  = 0;
+ loop_permute:
+  while(step <= ntile){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = uv_tile inter distance = distance true
+    ping       = step%2;
+    fill_bool  = (step < ntile) && (nfill < nburst_per_tile);
+    drain_bool = (step > 0) && (ndrain < nburst_per_tile);
+    
+    if(!fill_bool){
+      fill_stats.stall_full++;
+    }
+    else if(in_fifo.empty()){
+      fill_stats.stall_empty++;
+    }
+    else{
+      fill_burst = in_fifo.read();
+      m = nfill/tile_nburst;
+      n = nfill%tile_nburst;
+      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){
+        loc_tile = n*NSAMP_PER_BURST+n1;
+        uv_tile[ping][m][loc_tile] = fill_burst.data[n1];
+      }
+      fill_stats.active++;
+      fill_stats.burst++;
+      nfill++;
+    }
+    
+    if(!drain_bool){
+      permute_stats.stall_empty++;
+    }
+    else if(out_fifo.full()){
+      permute_stats.stall_full++;
+    }
+    else{
+      m = ndrain/nburst_out;
+      n = ndrain%nburst_out;
+      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){
+        loc_tile = n*NSAMP_PER_BURST+n1;
+        drain_burst.data[n1] = flip ? uv_tile[1-ping][loc_tile][m] : uv_tile[1-ping][m][loc_tile];
+      }
+      out_fifo.write(drain_burst);
+      permute_stats.active++;
+      permute_stats.burst++;
+      ndrain++;
+    }
+    
+    if((step == ntile || nfill == nburst_per_tile) && (step == 0 || ndrain == nburst_per_tile)){
+      if(nwait == PERMUTE_DISTANCE){
+        step++;
+        nfill  = 0;
+        ndrain = 0;
+        nwait  = 0;
+      }
+      else{
+        nwait++;
+      }
+    }
+  }
+  fill_stats_fifo.write(fill_stats);
+  permute_stats_fifo.write(permute_stats);
+}
+
+void write_from_fifo(
+                     int flip,
+                     int nouter0,
+                     int nouter1,
+                     int ntile_row,
+                     int ntile_col,
+                     int tile_nrow,
+                     int tile_nburst,
+                     int nrow,
+                     int ncol,
+                     int stride0,
+                     int stride1,
+                     int stride_row,
+                     fifo_uv &out_fifo,
+                     burst_uv *out,
+                     fifo_stats &stats_fifo){
+  int i;
+  int j;
+  int k;
+  int l;
+  int m;
+  int n;
+  int loc_burst;
+  int row;
+  int burst_col;
+  uint64_t nwrite;
+  burst_uv burst;
+  stats_t stats = {0, 0, 0, 0};
+  int nburst     = (ncol + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  int nrow_out   = flip ? tile_nburst*NSAMP_PER_BURST : tile_nrow;
+  int nburst_out = flip ? tile_nrow/NSAMP_PER_BURST : tile_nburst;
+  uint64_t ntotal = (uint64_t)nouter0*nouter1*ntile_row*ntile_col*nrow_out*nburst_out;
+
+  const int mburst = MPERMUTE_BURST;
+
+  // Same walk as read2fifo, with the rows and bursts of a tile on the output side
+  i      = 0;
+  j      = 0;
+  k      = 0;
+  l      = 0;
+  m      = 0;
+  n      = 0;
+  nwrite = 0;
+ loop_write_from_fifo:
+  while(nwrite < ntotal){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
+#pragma HLS PIPELINE
+    if(out_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      // A flip swaps the tile indices, bursts outside of the data are dropped
+      row       = (flip ? l : k)*nrow_out+m;
+      burst_col = (flip ? k : l)*nburst_out+n;
+      loc_burst = i*stride0 +
+        j*stride1 +
+        row*stride_row +
+        burst_col;
+      burst = out_fifo.read();
+      if((row < nrow) && (burst_col < nburst)){
+        out[loc_burst] = burst;
+        stats.burst++;
+      }
+      stats.active++;
+      nwrite++;
+      
+      next_burst(nouter1, ntile_row, ntile_col, nrow_out, nburst_out, i, j, k, l, m, n);
+    }
+  }
+  stats_fifo.write(stats);
+}
+
+// Step the counters of the tile walk to the next burst, the fastest one first
+void next_burst(
+                int nouter1,
+                int ntile_row,
+                int ntile_col,
+                int nrow,
+                int nburst,
+                int &i,
+                int &j,
+                int &k,
+                int &l,
+                int &m,
+                int &n){
+#pragma HLS INLINE
+  if(n < nburst - 1){
+    n++;
+    return;
+  }
+  n = 0;
+  if(m < nrow - 1){
+    m++;
+    return;
+  }
+  m = 0;
+  if(l < ntile_col - 1){
+    l++;
+    return;
+  }
+  l = 0;
+  if(k < ntile_row - 1){
+    k++;
+    return;
+  }
+  k = 0;
+  if(j < nouter1 - 1){
+    j++;
+    return;
+  }
+  j = 0;
+  i++;
+}
+
+void write_stats(
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats){
+  int i;
+  bool finish;
+  int nrecord[NSTATS];
+  int count[NSTATS];
+  stats_t record;
+  stats_t total[NSTATS];
+#pragma HLS ARRAY_PARTITION variable = nrecord complete
+#pragma HLS ARRAY_PARTITION variable = count   complete
+#pragma HLS ARRAY_PARTITION variable = total   complete
+
+  // Stages send one record each when they are done
+  nrecord[STATS_READ2FIFO]       = 1;
+  nrecord[STATS_FILL_TILE]       = 1;
+  nrecord[STATS_PERMUTE_TILE]    = 1;
+  nrecord[STATS_WRITE_FROM_FIFO] = 1;
+
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS UNROLL
+    count[i] = 0;
+    total[i].active      = 0;
+    total[i].stall_empty = 0;
+    total[i].stall_full  = 0;
+    total[i].burst       = 0;
+  }
+
+  finish = false;
+ loop_collect_stats:
+  while(!finish){
+#pragma HLS PIPELINE
+    finish = true;
+    for(i = 0; i < NSTATS; i++){
+      if(count[i] < nrecord[i] && stats_fifo[i].read_nb(record)){
+        total[i].active      += record.active;
+        total[i].stall_empty += record.stall_empty;
+        total[i].stall_full  += record.stall_full;
+        total[i].burst       += record.burst;
+        count[i]++;
+      }
+      finish = finish && (count[i] == nrecord[i]);
+    }
+  }
+
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS PIPELINE
+    stats[i] = total[i];
+  }
+}
+
+void mask_burst(
+                burst_uv &burst,
+                int nsamp_valid){
+#pragma HLS INLINE
+  int i;
+
+  for(i = 0; i < NSAMP_PER_BURST; i++){
+#pragma HLS UNROLL
+    if(i >= nsamp_valid){
+      burst.data[i] = 0;
+    }
+  }
+}
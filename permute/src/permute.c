@@ -0,0 +1,113 @@
+/*
+******************************************************************************
+** PERMUTE CODE FILE
+******************************************************************************
+*/
+
+#include "permute.h"
+#include "util_sdaccel.h"
+
+// Output axis i is input axis perm[i], the fastest axis of both sides is padded to whole bursts
+int permute(
+            uv_data_t *in,
+            uv_data_t *out,
+            const int naxis[NAXIS],
+            const int perm[NAXIS]){
+  int i;
+  int j;
+  int k;
+  int m;
+  int nout[NAXIS];
+  size_t stride_in[NAXIS];
+  size_t stride[NAXIS];
+  size_t pitch_in  = (size_t)(naxis[NAXIS-1] + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
+  size_t pitch_out = (size_t)(naxis[perm[NAXIS-1]] + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
+  size_t loc_in;
+  size_t loc_out;
+
+  stride_in[NAXIS-1] = 1;
+  stride_in[NAXIS-2] = pitch_in;
+  for(i = NAXIS-3; i >= 0; i--){
+    stride_in[i] = stride_in[i+1]*naxis[i+1];
+  }
+
+  // Input stride of each output axis
+  for(i = 0; i < NAXIS; i++){
+    nout[i]   = naxis[perm[i]];
+    stride[i] = stride_in[perm[i]];
+  }
+
+#pragma omp parallel for collapse(2) private(k, m, loc_in, loc_out) schedule(static)
+  for(i = 0; i < nout[0]; i++){
+    for(j = 0; j < nout[1]; j++){
+      for(k = 0; k < nout[2]; k++){
+        loc_in  = i*stride[0] + j*stride[1] + k*stride[2];
+        loc_out = (((size_t)i*nout[1] + j)*nout[2] + k)*pitch_out;
+        for(m = 0; m < nout[3]; m++){
+          out[2*(loc_out + m)]   = in[2*(loc_in + m*stride[3])];
+          out[2*(loc_out + m)+1] = in[2*(loc_in + m*stride[3])+1];
+        }
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Counters of knl_permute if the FIFOs never run empty or full
+// Edge tiles go through the tile stages in full, but only their valid bursts reach memory
+// The tile stages take ntile+1 steps of a tile and PERMUTE_DISTANCE iterations each,
+// the fill idles in the last step and the permute in the first one, an empty step is one iteration
+int permute_stats(
+                  const int naxis[NAXIS],
+                  const int perm[NAXIS],
+                  stats_t *stats){
+  permute_plan plan;
+  uint64_t ntile;
+  uint64_t nrow_in  = 1;
+  uint64_t nrow_out = 1;
+  int i;
+
+  if(permute_plan_create(naxis, perm, &plan) != EXIT_SUCCESS){
+    return EXIT_FAILURE;
+  }
+  ntile = (uint64_t)naxis[plan.outer[0]]*naxis[plan.outer[1]]*plan.ntile_row*plan.ntile_col;
+  for(i = 0; i < NAXIS-1; i++){
+    nrow_in  *= naxis[i];
+    nrow_out *= naxis[perm[i]];
+  }
+
+  for(i = 0; i < NSTATS; i++){
+    stats[i].active      = ntile*plan.tile_nrow*plan.tile_nburst;
+    stats[i].stall_empty = 0;
+    stats[i].stall_full  = 0;
+    stats[i].burst       = ntile*plan.tile_nrow*plan.tile_nburst;
+  }
+  stats[STATS_FILL_TILE].stall_full     = (ntile > 0) ? plan.tile_nrow*plan.tile_nburst : 1;
+  stats[STATS_FILL_TILE].stall_full    += (ntile + 1)*PERMUTE_DISTANCE;
+  stats[STATS_PERMUTE_TILE].stall_empty = stats[STATS_FILL_TILE].stall_full;
+  stats[STATS_READ2FIFO].burst          = nrow_in*plan.nburst_in;
+  stats[STATS_WRITE_FROM_FIFO].burst    = nrow_out*plan.nburst_out;
+
+  return EXIT_SUCCESS;
+}
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  uint64_t niteration;
+
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "utilisation");
+  for(i = 0; i < nstats; i++){
+    niteration = stats[i].active + stats[i].stall_empty + stats[i].stall_full;
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst,
+            niteration ? 100.0*stats[i].active/niteration : 0.0);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,208 @@
+/*
+******************************************************************************
+** PERMUTE CODE HEADER FILE
+******************************************************************************
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <ap_fixed.h>
+#include <ap_int.h>
+#include <assert.h>
+#include <hls_stream.h>
+#include <inttypes.h>
+
+#define BURST_LENGTH        16
+#define FLOAT     1
+//#define DATA_WIDTH     32     // We use float 32-bits complex numbers
+#define DATA_WIDTH     16       // We use ap_fixed 16-bits complex numbers
+
+#define BURST_WIDTH    512
+#define NSAMP_PER_BURST (BURST_WIDTH/(2*DATA_WIDTH))
+#define TILE_WIDTH      (BURST_LENGTH*NSAMP_PER_BURST)
+
+#define NAXIS               4        // Max number of axes, unused leading axes have extent 1
+#define MSAMP_PER_AXIS      4368     // Max extent of an axis
+#define MTILE_PER_AXIS      ((MSAMP_PER_AXIS + TILE_WIDTH - 1)/TILE_WIDTH)
+#define MPERMUTE_BURST      (MTILE_PER_AXIS*MTILE_PER_AXIS*TILE_WIDTH*BURST_LENGTH) // Bursts of the tiles of one plane of the largest axes, only a trip count for reports
+#define PERMUTE_DISTANCE    4        // Iterations between the last access of a tile buffer and its first access in the next step
+
+#define INTEGER_WIDTH       (DATA_WIDTH/2)      // Integer width of data
+#if DATA_WIDTH == 32
+#define DATA_RANGE          4096
+#if FLOAT == 1
+typedef float uv_data_t;
+#else
+typedef int uv_data_t;
+#endif
+
+#elif DATA_WIDTH == 16
+#define DATA_RANGE          127
+#if FLOAT == 1
+typedef ap_fixed<DATA_WIDTH, INTEGER_WIDTH> uv_data_t; // The size of this should be DATA_WIDTH
+#else
+typedef ap_int<DATA_WIDTH> uv_data_t; // The size of this should be DATA_WIDTH
+#endif
+#endif
+
+typedef ap_uint<2*DATA_WIDTH> uv_t;
+
+#define MAX_PALTFORMS       16
+#define MAX_DEVICES         16
+#define PARAM_VALUE_SIZE    1024
+#define MEM_ALIGNMENT       4096  // memory alignment on device
+#define LINE_LENGTH         4096
+
+typedef struct burst_uv{
+  uv_t data[NSAMP_PER_BURST];
+}burst_uv; // The size of this should be 512; BURST_DATA_WIDTH
+
+typedef hls::stream<burst_uv> fifo_uv;
+
+// How a permutation is done with tiles, axes are counted from the slowest one
+// Input axis perm[i] becomes output axis i, the fastest axis of both sides is padded to whole bursts
+// If the fastest axis changes, a tile is a block of both fastest axes and it is transposed,
+// otherwise a tile is a block of rows of the fastest axis and it goes through as it is
+// Tiles are up to TILE_WIDTH rows of up to BURST_LENGTH bursts, an axis is split into tiles of equal size
+typedef struct permute_plan{
+  int naxis[NAXIS];       // Extent of input axes
+  int flip;               // 1 if the fastest axis changes
+  int row_in;             // Input axis along the tile rows on read, columns are always the fastest input axis
+  int row_out;            // Input axis along the tile rows on write, columns are always the fastest output axis
+  int outer[2];           // Input axes outside of tiles, slowest first in output order
+  int ntile_row;          // Number of tiles along row_in
+  int ntile_col;          // Number of tiles along the fastest input axis
+  int tile_nrow;          // Rows of a tile on read, whole bursts if the tile is transposed
+  int tile_nburst;        // Bursts per row of a tile on read
+  int nburst_in;          // Bursts per row of the input
+  int nburst_out;         // Bursts per row of the output
+  int stride_in[NAXIS];   // Input stride of each input axis in bursts, the fastest axis is indexed by bursts
+  int stride_out[NAXIS];  // Output stride of each input axis in bursts, the fastest axis is indexed by bursts
+}permute_plan;
+
+// Plan of a permutation, used by knl_permute before its dataflow region and by the host model
+// Axes out of [1, MSAMP_PER_AXIS] or a perm which is not a permutation give an empty plan, which moves nothing
+static inline int permute_plan_create(
+                                      const int naxis[NAXIS],
+                                      const int perm[NAXIS],
+                                      permute_plan *plan){
+  int i;
+  int n;
+  int stride;
+  int used;
+  int fastest_out;
+  bool valid;
+
+  // Check before any perm[i] is used as an index
+  used  = 0;
+  valid = true;
+  for(i = 0; i < NAXIS; i++){
+#pragma HLS UNROLL
+    if(perm[i] < 0 || perm[i] >= NAXIS || naxis[i] < 1 || naxis[i] > MSAMP_PER_AXIS){
+      valid = false;
+    }
+    else{
+      used |= 1<<perm[i];
+    }
+  }
+  if(!valid || used != (1<<NAXIS) - 1){
+    memset(plan, 0x00, sizeof(permute_plan));
+    return EXIT_FAILURE;
+  }
+
+  fastest_out      = perm[NAXIS-1];
+  plan->flip       = (fastest_out != NAXIS-1);
+  plan->nburst_in  = (naxis[NAXIS-1] + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  plan->nburst_out = (naxis[fastest_out] + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  for(i = 0; i < NAXIS; i++){
+#pragma HLS UNROLL
+    plan->naxis[i] = naxis[i];
+  }
+
+  // Without a flip, rows go along the fastest output axis with more than one sample, so tiles are not mostly padding
+  if(plan->flip){
+    plan->row_in  = fastest_out;
+    plan->row_out = NAXIS-1;
+  }
+  else{
+    plan->row_in = perm[NAXIS-2];
+    for(i = 0; i < NAXIS-1; i++){
+#pragma HLS UNROLL
+      if(naxis[perm[i]] > 1){
+        plan->row_in = perm[i];
+      }
+    }
+    plan->row_out = plan->row_in;
+  }
+  // Fewest tiles along each axis and then the smallest tile which covers the axis with them
+  plan->ntile_row   = (naxis[plan->row_in] + TILE_WIDTH - 1)/TILE_WIDTH;
+  plan->ntile_col   = (plan->nburst_in + BURST_LENGTH - 1)/BURST_LENGTH;
+  plan->tile_nrow   = (naxis[plan->row_in] + plan->ntile_row - 1)/plan->ntile_row;
+  plan->tile_nburst = (plan->nburst_in + plan->ntile_col - 1)/plan->ntile_col;
+  if(plan->flip){
+    plan->tile_nrow = (plan->tile_nrow + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
+  }
+
+  n = 0;
+  for(i = 0; i < NAXIS; i++){
+#pragma HLS UNROLL
+    if(perm[i] != plan->row_in && perm[i] != NAXIS-1){
+      plan->outer[n] = perm[i];
+      n++;
+    }
+  }
+
+  stride = 1;
+  for(i = NAXIS-1; i >= 0; i--){
+#pragma HLS UNROLL
+    plan->stride_in[i] = stride;
+    stride *= (i == NAXIS-1) ? plan->nburst_in : naxis[i];
+  }
+  stride = 1;
+  for(i = NAXIS-1; i >= 0; i--){
+#pragma HLS UNROLL
+    plan->stride_out[perm[i]] = stride;
+    stride *= (i == NAXIS-1) ? plan->nburst_out : naxis[perm[i]];
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ2FIFO        0
+#define STATS_FILL_TILE        1
+#define STATS_PERMUTE_TILE     2
+#define STATS_WRITE_FROM_FIFO  3
+#define NSTATS                 4
+
+int permute(
+            uv_data_t *in,
+            uv_data_t *out,
+            const int naxis[NAXIS],
+            const int perm[NAXIS]);
+
+int permute_stats(
+                  const int naxis[NAXIS],
+                  const int perm[NAXIS],
+                  stats_t *stats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);
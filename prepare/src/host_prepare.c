@@ -52,6 +52,9 @@ int main(int argc, char* argv[]){
   data_t *sw_average_pol2 = NULL;
   data_t *hw_average_pol1 = NULL;
   data_t *hw_average_pol2 = NULL;
+  stats_t *sw_stats = NULL;
+  stats_t *hw_stats = NULL;
+  const char *stage[NSTATS] = {"read_in", "set_average_out", "write_out"};
 
   in_pol1  = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(data_t));
   in_pol2  = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(data_t));
@@ -64,6 +67,8 @@ int main(int argc, char* argv[]){
   sw_average_pol2 = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(data_t));
   hw_average_pol1 = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(data_t));
   hw_average_pol2 = (data_t *)aligned_alloc(MEM_ALIGNMENT, ndata1*sizeof(data_t));
+  sw_stats        = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_stats        = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
   
   fprintf(stdout, "INFO: %f MB memory used on host in total\n",
 	  (4*ndata2 + 7*ndata1)*sizeof(data_t)/(1024.*1024.));
@@ -86,6 +91,7 @@ int main(int argc, char* argv[]){
     cal_pol2[i] = (data_t)(0.99*(rand()%DATA_RANGE));
     sky[i]      = (data_t)(0.99*(rand()%DATA_RANGE));
   }
+  memset(hw_stats, 0x00, NSTATS*sizeof(stats_t));
   
   // Calculate on host
   cl_float cpu_elapsed_time;
@@ -93,6 +99,7 @@ int main(int argc, char* argv[]){
   struct timespec host_finish;
   clock_gettime(CLOCK_REALTIME, &host_start);
   prepare(in_pol1, in_pol2, cal_pol1, cal_pol2, sky, sw_out, sw_average_pol1, sw_average_pol2, nsamp_per_time, ntime_per_cu);
+  prepare_stats(nburst_per_time, ntime_per_cu, sw_stats);
   fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
   clock_gettime(CLOCK_REALTIME, &host_finish);
   cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
@@ -186,7 +193,8 @@ int main(int argc, char* argv[]){
   cl_mem buffer_out;
   cl_mem buffer_average_pol1;
   cl_mem buffer_average_pol2;
-  cl_mem pt[8];
+  cl_mem buffer_stats;
+  cl_mem pt[9];
 
   OCL_CHECK(err, buffer_in_pol1      = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata2, in_pol1, &err));
   OCL_CHECK(err, buffer_in_pol2      = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata2, in_pol2, &err));
@@ -196,6 +204,7 @@ int main(int argc, char* argv[]){
   OCL_CHECK(err, buffer_out          = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata2, hw_out, &err));
   OCL_CHECK(err, buffer_average_pol1 = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata1, hw_average_pol1, &err));
   OCL_CHECK(err, buffer_average_pol2 = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data_t)*ndata1, hw_average_pol2, &err));
+  OCL_CHECK(err, buffer_stats        = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, hw_stats, &err));
   if (!(buffer_in_pol1&&
 	buffer_in_pol2&&
 	buffer_out&&
@@ -203,7 +212,8 @@ int main(int argc, char* argv[]){
 	buffer_cal_pol1&&
 	buffer_cal_pol2&&
 	buffer_average_pol1&&
-	buffer_average_pol2
+	buffer_average_pol2&&
+	buffer_stats
 	)) {
     fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
     fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
@@ -221,6 +231,7 @@ int main(int argc, char* argv[]){
   pt[5] = buffer_out;
   pt[6] = buffer_average_pol1;
   pt[7] = buffer_average_pol2;
+  pt[8] = buffer_stats;
 
   OCL_CHECK(err, err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_in_pol1));
   OCL_CHECK(err, err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_in_pol2)); 
@@ -232,6 +243,7 @@ int main(int argc, char* argv[]){
   OCL_CHECK(err, err = clSetKernelArg(kernel, 7, sizeof(cl_mem), &buffer_average_pol2));
   OCL_CHECK(err, err = clSetKernelArg(kernel, 8, sizeof(cl_int), &nburst_per_time));
   OCL_CHECK(err, err = clSetKernelArg(kernel, 9, sizeof(cl_int), &ntime_per_cu));
+  OCL_CHECK(err, err = clSetKernelArg(kernel, 10, sizeof(cl_mem), &buffer_stats));
   
   fprintf(stdout, "INFO: DONE SETUP KERNEL\n");
 
@@ -253,7 +265,7 @@ int main(int argc, char* argv[]){
   kernel_elapsed_time = (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
 
   // Migrate data from device to host
-  cl_int outputs = 3;
+  cl_int outputs = 4;
   OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[5], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE MEMCPY FROM KERNEL TO HOST\n");
@@ -304,6 +316,8 @@ int main(int argc, char* argv[]){
   fprintf(stdout, "INFO: DONE RESULT CHECK\n");
   fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
   fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
+  print_stats("Counters of CPU model", stage, sw_stats, NSTATS);
+  print_stats("Counters of kernel", stage, hw_stats, NSTATS);
     
   // Cleanup
   clReleaseMemObject(buffer_in_pol1);
@@ -314,6 +328,7 @@ int main(int argc, char* argv[]){
   clReleaseMemObject(buffer_out);
   clReleaseMemObject(buffer_average_pol1);
   clReleaseMemObject(buffer_average_pol2);
+  clReleaseMemObject(buffer_stats);
   
   free(in_pol1);
   free(in_pol2);
@@ -326,6 +341,8 @@ int main(int argc, char* argv[]){
   free(sw_average_pol2);
   free(hw_average_pol1);
   free(hw_average_pol2);
+  free(sw_stats);
+  free(hw_stats);
   
   clReleaseProgram(program);
   clReleaseKernel(kernel);
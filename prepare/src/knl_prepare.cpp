@@ -12,7 +12,8 @@ extern "C" {
 		   burst_t *average1,
 		   burst_t *average2,
 		   int nburst_per_time,
-		   int ntime_per_cu
+		   int ntime_per_cu,
+		   stats_t *stats
 		   );
   
   void initialize_prepare(
@@ -38,7 +39,8 @@ extern "C" {
                const burst_t *in1,
                const burst_t *in2,
                fifo_t &in1_fifo,
-               fifo_t &in2_fifo);
+               fifo_t &in2_fifo,
+               fifo_stats &stats_fifo);
   
   void process(
                int nburst_per_time,
@@ -50,7 +52,8 @@ extern "C" {
                burst_t *average2,
                fifo_t &in1_fifo,
                fifo_t &in2_fifo,
-               fifo_t &out_fifo);
+               fifo_t &out_fifo,
+               fifo_stats &stats_fifo);
   
   void calculate_average_out(
                              int ntime_per_cu,
@@ -61,7 +64,8 @@ extern "C" {
                              data_t *average2_tile,
                              fifo_t &in1_fifo,
                              fifo_t &in2_fifo,
-                             fifo_t &out_fifo);
+                             fifo_t &out_fifo,
+                             fifo_stats &stats_fifo);
   
   void reset_average(
                      data_t *average1_tile,
@@ -76,13 +80,20 @@ extern "C" {
                      data_t *average2_tile,
                      fifo_t &in1_fifo,
                      fifo_t &in2_fifo,
-                     fifo_t &out_fifo);
+                     fifo_t &out_fifo,
+                     fifo_stats &stats_fifo);
     
   void write_out(
                  int nburst_per_time,
                  int ntime_per_cu,
                  fifo_t &out_fifo,
-                 burst_t *out);
+                 burst_t *out,
+                 fifo_stats &stats_fifo);
+
+  void write_stats(
+                   int nburst_per_time,
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats);
 }
 
 void knl_prepare(
@@ -95,7 +106,8 @@ void knl_prepare(
 		 burst_t *average1,
 		 burst_t *average2,
 		 int nburst_per_time,
-		 int ntime_per_cu
+		 int ntime_per_cu,
+		 stats_t *stats
 		 )
 {
   // Setup the interface, max_*_burst_length defines the max burst length (UG902 for detail)
@@ -107,6 +119,7 @@ void knl_prepare(
 #pragma HLS INTERFACE m_axi port = out      offset = slave bundle = gmem5 max_write_burst_length=64
 #pragma HLS INTERFACE m_axi port = average1 offset = slave bundle = gmem6 max_write_burst_length=64
 #pragma HLS INTERFACE m_axi port = average2 offset = slave bundle = gmem7 max_write_burst_length=64
+#pragma HLS INTERFACE m_axi port = stats    offset = slave bundle = gmem8
 
 #pragma HLS INTERFACE s_axilite port = in1         bundle = control
 #pragma HLS INTERFACE s_axilite port = in2         bundle = control
@@ -118,6 +131,7 @@ void knl_prepare(
 #pragma HLS INTERFACE s_axilite port = average2    bundle = control
 #pragma HLS INTERFACE s_axilite port = nburst_per_time bundle = control
 #pragma HLS INTERFACE s_axilite port = ntime_per_cu    bundle = control
+#pragma HLS INTERFACE s_axilite port = stats       bundle = control
     
 #pragma HLS INTERFACE s_axilite port = return bundle = control
     
@@ -130,14 +144,17 @@ void knl_prepare(
 #pragma HLS DATA_PACK variable = out
 #pragma HLS DATA_PACK variable = average1
 #pragma HLS DATA_PACK variable = average2
+#pragma HLS DATA_PACK variable = stats
 
 #pragma HLS DATAFLOW
   static fifo_t in1_fifo;
   static fifo_t in2_fifo;
   static fifo_t out_fifo;
+  static fifo_stats stats_fifo[NSTATS]; // Counters of each stage
 #pragma HLS STREAM variable=in1_fifo
 #pragma HLS STREAM variable=in2_fifo
 #pragma HLS STREAM variable=out_fifo
+#pragma HLS STREAM variable=stats_fifo
   
   read_in(
           nburst_per_time,
@@ -145,7 +162,8 @@ void knl_prepare(
           in1,
           in2,
           in1_fifo,
-          in2_fifo);
+          in2_fifo,
+          stats_fifo[STATS_READ_IN]);
   
   process(
           nburst_per_time,
@@ -157,13 +175,20 @@ void knl_prepare(
           average2,
           in1_fifo,
           in2_fifo,
-          out_fifo);
+          out_fifo,
+          stats_fifo[STATS_SET_AVERAGE_OUT]);
   
   write_out(
             nburst_per_time,
             ntime_per_cu,
             out_fifo,
-            out);
+            out,
+            stats_fifo[STATS_WRITE_OUT]);
+
+  write_stats(
+              nburst_per_time,
+              stats_fifo,
+              stats);
 }
 
 void read_in(
@@ -172,29 +197,44 @@ void read_in(
              const burst_t *in1,
              const burst_t *in2,
              fifo_t &in1_fifo,
-             fifo_t &in2_fifo){
+             fifo_t &in2_fifo,
+             fifo_stats &stats_fifo){
   
   int i;
   int j;
   int m;
   int loc;
+  stats_t stats = {0, 0, 0, 0};
   const int mtime_per_cu    = MTIME_PER_CU;
   const int mtran_per_time  = MCHAN*MBASELINE/TILE_WIDTH;
+  const int burst_length    = BURST_LENGTH;
   
   int ntran_per_time = nburst_per_time/BURST_LENGTH;
   for(i = 0; i < ntran_per_time; i++){
 #pragma HLS LOOP_TRIPCOUNT  max=mtran_per_time    
     for(j = 0; j < ntime_per_cu; j++){
 #pragma HLS LOOP_TRIPCOUNT max=mtime_per_cu
+      m = 0;
     loop_read_in:
-      for(m = 0; m < BURST_LENGTH; m++){
+      while(m < BURST_LENGTH){
+#pragma HLS LOOP_TRIPCOUNT min=burst_length max=burst_length
 #pragma HLS PIPELINE
-        loc = j*nburst_per_time + i*BURST_LENGTH + m;
-        in1_fifo.write(in1[loc]);
-        in2_fifo.write(in2[loc]);
+        // Count the cycles blocked by the processing instead of waiting on the write
+        if(in1_fifo.full() || in2_fifo.full()){
+          stats.stall_full++;
+        }
+        else{
+          loc = j*nburst_per_time + i*BURST_LENGTH + m;
+          in1_fifo.write(in1[loc]);
+          in2_fifo.write(in2[loc]);
+          stats.active++;
+          stats.burst += 2;
+          m++;
+        }
       }
     }
   }
+  stats_fifo.write(stats);
 }
 
 void process(
@@ -207,7 +247,8 @@ void process(
              burst_t *average2,
              fifo_t &in1_fifo,
              fifo_t &in2_fifo,
-             fifo_t &out_fifo){
+             fifo_t &out_fifo,
+             fifo_stats &stats_fifo){
 
   int i;
   int j;
@@ -244,7 +285,7 @@ void process(
 #pragma HLS LOOP_TRIPCOUNT  max=mtran_per_time
 #pragma HLS DATAFLOW
     initialize_prepare(i, cal1, cal2, sky, cal1_tile, cal2_tile, sky_tile);
-    calculate_average_out(ntime_per_cu, cal1_tile, cal2_tile, sky_tile, average1_tile, average2_tile, in1_fifo, in2_fifo, out_fifo);
+    calculate_average_out(ntime_per_cu, cal1_tile, cal2_tile, sky_tile, average1_tile, average2_tile, in1_fifo, in2_fifo, out_fifo, stats_fifo);
     write_average(i, average1_tile, average2_tile, average1, average2);        
   }  
 }
@@ -253,13 +294,16 @@ void write_out(
                int nburst_per_time,
                int ntime_per_cu,
                fifo_t &out_fifo,
-               burst_t *out){
+               burst_t *out,
+               fifo_stats &stats_fifo){
   int i;
   int j;
   int m;
   int loc;
+  stats_t stats = {0, 0, 0, 0};
   const int mtime_per_cu    = MTIME_PER_CU;
   const int mtran_per_time  = MCHAN*MBASELINE/TILE_WIDTH;
+  const int burst_length    = BURST_LENGTH;
   int ntran_per_time = nburst_per_time/BURST_LENGTH;
   
   for(i = 0; i < ntran_per_time; i++){
@@ -268,13 +312,24 @@ void write_out(
   loop_write_out:
     for(j = 0; j < ntime_per_cu; j++){
 #pragma HLS LOOP_TRIPCOUNT max=mtime_per_cu
-      for(m = 0; m < BURST_LENGTH; m++){
+      m = 0;
+      while(m < BURST_LENGTH){
+#pragma HLS LOOP_TRIPCOUNT min=burst_length max=burst_length
 #pragma HLS PIPELINE
-        loc = j*nburst_per_time + i*BURST_LENGTH + m;
-        out[loc]=out_fifo.read();
+        if(out_fifo.empty()){
+          stats.stall_empty++;
+        }
+        else{
+          loc = j*nburst_per_time + i*BURST_LENGTH + m;
+          out[loc]=out_fifo.read();
+          stats.active++;
+          stats.burst++;
+          m++;
+        }
       }
     }
   }
+  stats_fifo.write(stats);
 }
 
 void initialize_prepare(
@@ -341,9 +396,10 @@ void calculate_average_out(
                            data_t *average2_tile,
                            fifo_t &in1_fifo,
                            fifo_t &in2_fifo,
-                           fifo_t &out_fifo){
+                           fifo_t &out_fifo,
+                           fifo_stats &stats_fifo){
   reset_average(average1_tile, average2_tile);
-  set_average_out(ntime_per_cu, cal1_tile, cal2_tile, sky_tile, average1_tile, average2_tile, in1_fifo, in2_fifo, out_fifo);
+  set_average_out(ntime_per_cu, cal1_tile, cal2_tile, sky_tile, average1_tile, average2_tile, in1_fifo, in2_fifo, out_fifo, stats_fifo);
 }
 
 void reset_average(
@@ -373,7 +429,8 @@ void set_average_out(
                      data_t *average2_tile,
                      fifo_t &in1_fifo,
                      fifo_t &in2_fifo,
-                     fifo_t &out_fifo){
+                     fifo_t &out_fifo,
+                     fifo_stats &stats_fifo){
   int j;
   int m;
   int n;
@@ -382,32 +439,100 @@ void set_average_out(
   burst_t in1_burst;
   burst_t in2_burst;
   burst_t out_burst;
+  stats_t stats = {0, 0, 0, 0};
   const int mtime_per_cu = MTIME_PER_CU;
+  const int burst_length = BURST_LENGTH;
 
   for(j = 0; j < ntime_per_cu; j++){
 #pragma HLS LOOP_TRIPCOUNT max=mtime_per_cu
+    m = 0;
   loop_process:
-    for(m = 0; m < BURST_LENGTH; m++){
+    while(m < BURST_LENGTH){
+#pragma HLS LOOP_TRIPCOUNT min=burst_length max=burst_length
 #pragma HLS PIPELINE
-      in1_burst = in1_fifo.read();
-      in2_burst = in2_fifo.read();
+      if(in1_fifo.empty() || in2_fifo.empty()){
+        stats.stall_empty++;
+      }
+      else if(out_fifo.full()){
+        stats.stall_full++;
+      }
+      else{
+        in1_burst = in1_fifo.read();
+        in2_burst = in2_fifo.read();
       
-      for(n = 0; n < NSAMP_PER_BURST; n++){
-        loc = 2*m*NSAMP_PER_BURST+2*n;
+        for(n = 0; n < NSAMP_PER_BURST; n++){
+          loc = 2*m*NSAMP_PER_BURST+2*n;
         
-        average1_tile[loc]   += in1_burst.data[2*n];
-        average2_tile[loc]   += in2_burst.data[2*n];
-        average1_tile[loc+1] += in1_burst.data[2*n+1];
-        average2_tile[loc+1] += in2_burst.data[2*n+1];
+          average1_tile[loc]   += in1_burst.data[2*n];
+          average2_tile[loc]   += in2_burst.data[2*n];
+          average1_tile[loc+1] += in1_burst.data[2*n+1];
+          average2_tile[loc+1] += in2_burst.data[2*n+1];
         
-        out_burst.data[2*n] = in1_burst.data[2*n]*cal1_tile[loc] - in1_burst.data[2*n+1]*cal1_tile[loc+1] + 
-          in2_burst.data[2*n]*cal2_tile[loc] - in2_burst.data[2*n+1]*cal2_tile[loc+1] - 
-          sky_tile[loc];          
-        out_burst.data[2*n+1] = in1_burst.data[2*n]*cal1_tile[loc+1] + in1_burst.data[2*n+1]*cal1_tile[loc] + 
-            in2_burst.data[2*n]*cal2_tile[loc+1] + in2_burst.data[2*n+1]*cal2_tile[loc] - 
-          sky_tile[loc+1];
+          out_burst.data[2*n] = in1_burst.data[2*n]*cal1_tile[loc] - in1_burst.data[2*n+1]*cal1_tile[loc+1] + 
+            in2_burst.data[2*n]*cal2_tile[loc] - in2_burst.data[2*n+1]*cal2_tile[loc+1] - 
+            sky_tile[loc];          
+          out_burst.data[2*n+1] = in1_burst.data[2*n]*cal1_tile[loc+1] + in1_burst.data[2*n+1]*cal1_tile[loc] + 
+              in2_burst.data[2*n]*cal2_tile[loc+1] + in2_burst.data[2*n+1]*cal2_tile[loc] - 
+            sky_tile[loc+1];
+        }
+        out_fifo.write(out_burst);
+        stats.active++;
+        stats.burst++;
+        m++;
       }
-      out_fifo.write(out_burst);
     }
   }
+  stats_fifo.write(stats);
+}
+
+void write_stats(
+                 int nburst_per_time,
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats){
+  int i;
+  bool finish;
+  int nrecord[NSTATS];
+  int count[NSTATS];
+  stats_t record;
+  stats_t total[NSTATS];
+#pragma HLS ARRAY_PARTITION variable = nrecord complete
+#pragma HLS ARRAY_PARTITION variable = count   complete
+#pragma HLS ARRAY_PARTITION variable = total   complete
+
+  // Stages send one record per call
+  nrecord[STATS_READ_IN]         = 1;
+  nrecord[STATS_SET_AVERAGE_OUT] = nburst_per_time/BURST_LENGTH;
+  nrecord[STATS_WRITE_OUT]       = 1;
+  
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS UNROLL
+    count[i] = 0;
+    total[i].active      = 0;
+    total[i].stall_empty = 0;
+    total[i].stall_full  = 0;
+    total[i].burst       = 0;
+  }
+
+  finish = false;
+ loop_collect_stats:
+  while(!finish){
+#pragma HLS PIPELINE
+    finish = true;
+    for(i = 0; i < NSTATS; i++){
+      if(count[i] < nrecord[i] && stats_fifo[i].read_nb(record)){
+        total[i].active      += record.active;
+        total[i].stall_empty += record.stall_empty;
+        total[i].stall_full  += record.stall_full;
+        total[i].burst       += record.burst;
+        count[i]++;
+      }
+      finish = finish && (count[i] == nrecord[i]);
+    }
+  }
+  
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS PIPELINE
+    stats[i] = total[i];
+  }
 }
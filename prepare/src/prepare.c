@@ -73,3 +73,42 @@ int prepare(
   
   return EXIT_SUCCESS;
 }
+
+// Counters of a launch without stalls
+int prepare_stats(
+                  int nburst_per_time,
+                  int ntime_per_cu,
+                  stats_t *stats){
+  uint64_t nburst = (uint64_t)(nburst_per_time/BURST_LENGTH)*BURST_LENGTH*ntime_per_cu;
+  
+  memset(stats, 0x00, NSTATS*sizeof(stats_t));
+  
+  stats[STATS_READ_IN].active         = nburst;
+  stats[STATS_READ_IN].burst          = 2*nburst;
+  stats[STATS_SET_AVERAGE_OUT].active = nburst;
+  stats[STATS_SET_AVERAGE_OUT].burst  = nburst;
+  stats[STATS_WRITE_OUT].active       = nburst;
+  stats[STATS_WRITE_OUT].burst        = nburst;
+  
+  return EXIT_SUCCESS;
+}
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  uint64_t niteration;
+  
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "utilisation");
+  for(i = 0; i < nstats; i++){
+    niteration = stats[i].active + stats[i].stall_empty + stats[i].stall_full;
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst,
+            niteration ? 100.0*stats[i].active/niteration : 0.0);
+  }
+  
+  return EXIT_SUCCESS;
+}
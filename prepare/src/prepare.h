@@ -14,6 +14,7 @@
 #include <complex>
 #include <ap_fixed.h>
 #include <math.h>
+#include <inttypes.h>
 #include <hls_stream.h>
 
 //#define FLOAT          1
@@ -71,6 +72,22 @@ typedef struct burst_t{
 
 typedef hls::stream<burst_t> fifo_t;
 
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ_IN          0
+#define STATS_SET_AVERAGE_OUT  1
+#define STATS_WRITE_OUT        2
+#define NSTATS                 3
+
 int prepare(data_t *in_pol1,
 	    data_t *in_pol2,
 	    data_t *cal_pol1,
@@ -81,3 +98,14 @@ int prepare(data_t *in_pol1,
 	    data_t *average_pol2,
 	    int nsamp_per_time,
 	    int ntime_per_cu);
+
+int prepare_stats(
+                  int nburst_per_time,
+                  int ntime_per_cu,
+                  stats_t *stats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);
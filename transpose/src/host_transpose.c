@@ -21,47 +21,86 @@ int main(int argc, char* argv[]){
   uint64_t ndata1;
   uint64_t ndata2;
   uint64_t ndata3;
+  uint64_t ndata4[NCU];
+  uint64_t offset4[NCU];
+  uint64_t ndata5[NCU];
   cl_int nsamp_per_uv_in  = 4368;
   //cl_int nsamp_per_uv_out = 3552;
   //cl_int nsamp_per_uv_out = 3328;
   //cl_int ndm_per_cu       = 1024;
   //cl_int ntime_per_cu     = 256;
   //cl_int ndm_per_cu       = 2*TILE_WIDTH;
-  cl_int ndm_per_cu       = 1024;
+  cl_int ndm              = 1024;
   //cl_int nsamp_per_uv_out = 3*TILE_WIDTH;
-  cl_int nsamp_per_uv_out = 3328;
+  cl_int nsamp_per_uv_out = 3567;
   cl_int ntime_per_cu     = 256;
 
+  // Sizes which are not multiples of TILE_WIDTH or NSAMP_PER_BURST, to exercise the edge tiles
   if(is_hw_emulation()){
-    ndm_per_cu       = 2*TILE_WIDTH;
-    nsamp_per_uv_out = 2*TILE_WIDTH;
+    ndm              = TILE_WIDTH + 40;
+    nsamp_per_uv_out = TILE_WIDTH + 7;
     ntime_per_cu     = 2;
   }
   if(is_sw_emulation()){
-    ndm_per_cu       = 2*TILE_WIDTH;
-    nsamp_per_uv_out = 2*TILE_WIDTH;
+    ndm              = TILE_WIDTH + 40;
+    nsamp_per_uv_out = TILE_WIDTH + 7;
     ntime_per_cu     = 2;
   }
-  ndm_per_cu = ndm_per_cu - ndm_per_cu%TILE_WIDTH;
-  nsamp_per_uv_out = nsamp_per_uv_out - nsamp_per_uv_out%TILE_WIDTH;
   
-  cl_int nburst_dm        = ndm_per_cu/NSAMP_PER_BURST;
-  cl_int nburst_per_uv_out = nsamp_per_uv_out/NSAMP_PER_BURST;
+  // Rows are padded to whole bursts in memory
+  cl_int nburst_dm         = (ndm + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  cl_int nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+
+  // DM tiles are split across CUs, each CU reads its DM slice from its own input buffer
+  // and writes the output rows of its slice into its own buffer
+  cl_int j;
+  cl_int ncu = 0;
+  cl_int ndm_per_cu[NCU];
+  cl_int dm_offset[NCU];
+  cl_int nburst_dm_cu[NCU];
+  cl_int dm_offset_cu = 0; // A CU input starts at its own first DM
+  cl_int ntran_dm        = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  cl_int ntran_dm_per_cu = (ntran_dm + NCU - 1)/NCU;
+  for(j = 0; j < NCU; j++){
+    dm_offset[j]  = j*ntran_dm_per_cu*TILE_WIDTH;
+    ndm_per_cu[j] = (j + 1)*ntran_dm_per_cu*TILE_WIDTH < ndm ? ntran_dm_per_cu*TILE_WIDTH : ndm - dm_offset[j];
+    nburst_dm_cu[j] = (ndm_per_cu[j] + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+    if(ndm_per_cu[j] > 0){
+      ncu++;
+    }
+  }
+  fprintf(stdout, "INFO: %d CUs, %d DM tiles per CU\n", ncu, ntran_dm_per_cu);
 
   ndata1 = 2*nsamp_per_uv_out;
-  ndata2 = 2*ntime_per_cu*ndm_per_cu*(uint64_t)nsamp_per_uv_in;
-  ndata3 = 2*ntime_per_cu*ndm_per_cu*(uint64_t)nsamp_per_uv_out;
+  ndata2 = 2*ntime_per_cu*nburst_dm*NSAMP_PER_BURST*(uint64_t)nsamp_per_uv_in;
+  ndata3 = 2*ntime_per_cu*ndm*(uint64_t)nburst_per_uv_out*NSAMP_PER_BURST;
+  // Output rows are in DM order, so the buffer of each CU is a part of hw_out
+  for(j = 0; j < ncu; j++){
+    ndata4[j]  = 2*ntime_per_cu*ndm_per_cu[j]*(uint64_t)nburst_per_uv_out*NSAMP_PER_BURST;
+    offset4[j] = 2*ntime_per_cu*dm_offset[j]*(uint64_t)nburst_per_uv_out*NSAMP_PER_BURST;
+    ndata5[j]  = 2*ntime_per_cu*nburst_dm_cu[j]*NSAMP_PER_BURST*(uint64_t)nsamp_per_uv_in;
+  }
   
   uv_data_t *in = NULL;
+  uv_data_t *in_cu[NCU];
   uv_data_t *sw_out = NULL;
   uv_data_t *hw_out = NULL;
+  stats_t *sw_stats = NULL;
+  stats_t *hw_stats = NULL;
+  stats_t cu_stats[NSTATS];
+  const char *stage[NSTATS] = {"read2fifo", "fill_tile", "transpose_tile", "write_from_fifo"};
   
   in        = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(uv_data_t));
   sw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
   hw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
+  sw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NCU*NSTATS*sizeof(stats_t));
+  for(j = 0; j < ncu; j++){
+    in_cu[j] = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata5[j]*sizeof(uv_data_t));
+  }
   
   fprintf(stdout, "INFO: %f MB memory used on host in total\n",
-	  ((ndata2 + 2*ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH1)/(8*1024.*1024.));
+	  ((2*ndata2 + 2*ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH1)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device in total\n",
 	  ((ndata2 + ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH1)/(8*1024.*1024.));
   fprintf(stdout, "INFO: %f MB memory used on device for raw input\n",
@@ -83,15 +122,35 @@ int main(int argc, char* argv[]){
   for(i = 0; i < ndata2; i++){
     in[i] = (uv_data_t)(0.99*(rand()%DATA_RANGE));
   }
+  
+  // Every CU gets a copy of its DM slice, so that the CUs read from their own pseudo-channels
+  // Slices start at a multiple of TILE_WIDTH DMs, so they start at a whole burst
+  uint64_t row;
+  uint64_t k;
+  uint64_t nsamp_row_cu;
+  for(j = 0; j < ncu; j++){
+    nsamp_row_cu = 2*(uint64_t)nburst_dm_cu[j]*NSAMP_PER_BURST;
+    for(row = 0; row < (uint64_t)ntime_per_cu*nsamp_per_uv_in; row++){
+      for(k = 0; k < nsamp_row_cu; k++){
+        in_cu[j][row*nsamp_row_cu + k] = in[row*2*nburst_dm*NSAMP_PER_BURST + 2*dm_offset[j] + k];
+      }
+    }
+  }
   memset(sw_out, 0x00, ndata3*sizeof(uv_data_t));
   memset(hw_out, 0x00, ndata3*sizeof(uv_data_t));
+  memset(hw_stats, 0x00, NCU*NSTATS*sizeof(stats_t));
   
   // Calculate on host
   cl_float cpu_elapsed_time;
   struct timespec host_start;
   struct timespec host_finish;
   clock_gettime(CLOCK_REALTIME, &host_start);
-  transpose(in, sw_out, nsamp_per_uv_out, ntime_per_cu, ndm_per_cu);
+  transpose_fast(in, sw_out, nsamp_per_uv_out, ntime_per_cu, ndm);
+  memset(sw_stats, 0x00, NSTATS*sizeof(stats_t));
+  for(j = 0; j < ncu; j++){
+    transpose_stats(nsamp_per_uv_out, ntime_per_cu, ndm_per_cu[j], cu_stats);
+    add_stats(sw_stats, cu_stats, NSTATS);
+  }
   fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
   clock_gettime(CLOCK_REALTIME, &host_finish);
   cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
@@ -172,41 +231,60 @@ int main(int argc, char* argv[]){
   // Program the card with the program binary
   OCL_CHECK(err, err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL));
 
-  // Create the kernel
-  cl_kernel kernel;
-  OCL_CHECK(err, kernel = clCreateKernel(program, "knl_transpose", &err));
+  // Create the kernel, one handle per CU, so that each CU gets its own buffers
+  // The HBM pseudo-channels of each CU are given with the connectivity at link time
+  cl_kernel kernel[NCU];
+  char kernel_name[LINE_LENGTH];
+  for(j = 0; j < ncu; j++){
+    sprintf(kernel_name, "knl_transpose:{knl_transpose_%d}", j + 1);
+    OCL_CHECK(err, kernel[j] = clCreateKernel(program, kernel_name, &err));
+  }
 
   // Prepare device buffer
-  cl_mem buffer_in;
-  cl_mem buffer_out;
-  cl_mem pt[2];
+  // The input, the output and the counters of each CU are in its own pseudo-channels
+  // A CU starts its output at a multiple of TILE_WIDTH rows, so its part of hw_out stays aligned for CL_MEM_USE_HOST_PTR
+  cl_mem buffer_in[NCU];
+  cl_mem buffer_out[NCU];
+  cl_mem buffer_stats[NCU];
+  cl_mem pt[3*NCU];
 
-  OCL_CHECK(err, buffer_in    = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata2, in, &err));
-  OCL_CHECK(err, buffer_out   = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata3, hw_out, &err));
-  if (!(buffer_in&&
-	buffer_out
-	)) {
-    fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
-    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
-    fprintf(stderr, "ERROR: Test failed ...!\n");
-    return EXIT_FAILURE;
+  for(j = 0; j < ncu; j++){
+    OCL_CHECK(err, buffer_in[j]    = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata5[j], in_cu[j], &err));
+    OCL_CHECK(err, buffer_out[j]   = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata4[j], &hw_out[offset4[j]], &err));
+    OCL_CHECK(err, buffer_stats[j] = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, &hw_stats[j*NSTATS], &err));
+    if (!(buffer_in[j]&&
+          buffer_out[j]&&
+          buffer_stats[j]
+          )) {
+      fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
+      fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+      fprintf(stderr, "ERROR: Test failed ...!\n");
+      return EXIT_FAILURE;
+    }
   }
 
   // Setup kernel arguments
   // To use multiple banks, this has to be before any enqueue options (e.g., clEnqueueMigrateMemObjects)
-  pt[0] = buffer_in;
-  pt[1] = buffer_out;
-
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer_in));
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer_out));
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 2, sizeof(cl_int), &nburst_per_uv_out));
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 3, sizeof(cl_int), &ntime_per_cu));
-  OCL_CHECK(err, err = clSetKernelArg(kernel, 4, sizeof(cl_int), &nburst_dm));
+  // The inputs go first in pt, then the outputs and the counters of each CU
+  for(j = 0; j < ncu; j++){
+    pt[j]         = buffer_in[j];
+    pt[ncu + j]   = buffer_out[j];
+    pt[2*ncu + j] = buffer_stats[j];
+    
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 0, sizeof(cl_mem), &buffer_in[j]));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 1, sizeof(cl_mem), &buffer_out[j]));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 2, sizeof(cl_int), &nsamp_per_uv_out));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 3, sizeof(cl_int), &ntime_per_cu));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 4, sizeof(cl_int), &ndm_per_cu[j]));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 5, sizeof(cl_int), &dm_offset_cu));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 6, sizeof(cl_int), &nburst_dm_cu[j]));
+    OCL_CHECK(err, err = clSetKernelArg(kernel[j], 7, sizeof(cl_mem), &buffer_stats[j]));
+  }
   
   fprintf(stdout, "INFO: DONE SETUP KERNEL\n");
 
   // Migrate host memory to device
-  cl_int inputs = 1;
+  cl_int inputs = ncu;
   OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, inputs, pt, 0 ,0,NULL, NULL));
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE MEMCPY FROM HOST TO KERNEL\n");
@@ -216,15 +294,17 @@ int main(int argc, char* argv[]){
   struct timespec device_finish;
   cl_float kernel_elapsed_time;
   clock_gettime(CLOCK_REALTIME, &device_start);
-  OCL_CHECK(err, err = clEnqueueTask(queue, kernel, 0, NULL, NULL));
+  for(j = 0; j < ncu; j++){
+    OCL_CHECK(err, err = clEnqueueTask(queue, kernel[j], 0, NULL, NULL));
+  }
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE KERNEL EXECUTION\n");
   clock_gettime(CLOCK_REALTIME, &device_finish);
   kernel_elapsed_time = (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
 
   // Migrate data from device to host
-  cl_int outputs = 1;
-  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[1], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
+  cl_int outputs = 2*ncu;
+  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[ncu], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
   OCL_CHECK(err, err = clFinish(queue));
   fprintf(stdout, "INFO: DONE MEMCPY FROM KERNEL TO HOST\n");
 
@@ -242,16 +322,41 @@ int main(int argc, char* argv[]){
   
   fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
   fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
+  fprintf(stdout, "INFO: Aggregate bandwidth of %d CUs is %f GB/s\n", ncu,
+          ((uint64_t)nsamp_per_uv_out*nburst_dm + (uint64_t)ndm*nburst_per_uv_out)*ntime_per_cu*BURST_WIDTH/(8*kernel_elapsed_time*1.0E9));
+  
+  // Counters of all CUs are summed up
+  for(j = 1; j < ncu; j++){
+    add_stats(hw_stats, &hw_stats[j*NSTATS], NSTATS);
+  }
+  print_stats("Counters of CPU model", stage, sw_stats, NSTATS);
+  print_stats("Counters of kernel", stage, hw_stats, NSTATS);
+  
+  // Gaps between tiles show up as cycles of the launch in which the tile engine fills nothing
+  // Software emulation counts polls of a thread instead of cycles, so there is nothing to compare
+  if(!is_sw_emulation()){
+    fprintf(stdout, "INFO: The tile engine fills in %f of the %" PRIu64 " cycles of the launches, the model takes %" PRIu64 " cycles\n",
+            hw_stats[STATS_FILL_TILE].active/(double)hw_stats[STATS_FILL_TILE].cycle, hw_stats[STATS_FILL_TILE].cycle,
+            sw_stats[STATS_FILL_TILE].cycle);
+  }
   
   // Cleanup
-  clReleaseMemObject(buffer_in);
-  clReleaseMemObject(buffer_out);
+  for(j = 0; j < ncu; j++){
+    clReleaseMemObject(buffer_in[j]);
+    clReleaseMemObject(buffer_out[j]);
+    clReleaseMemObject(buffer_stats[j]);
+    clReleaseKernel(kernel[j]);
+  }
   
   free(in);
+  for(j = 0; j < ncu; j++){
+    free(in_cu[j]);
+  }
   free(sw_out);
   free(hw_out);
+  free(sw_stats);
+  free(hw_stats);
   clReleaseProgram(program);
-  clReleaseKernel(kernel);
   clReleaseCommandQueue(queue);
   clReleaseContext(context);
 
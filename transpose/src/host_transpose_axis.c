@@ -0,0 +1,359 @@
+/*
+******************************************************************************
+** MAIN FUNCTION
+******************************************************************************
+*/
+
+#include "util_sdaccel.h"
+#include "transpose.h"
+
+int main(int argc, char* argv[]){
+  // Check argument
+  if (argc != 2) {
+    fprintf(stderr, "ERROR: Failed to execute the program!\n");
+    fprintf(stderr, "USAGE: %s xclbin\n", argv[0]);
+    fprintf(stderr, "INFO: Please re-execute it with the above usage method!\n");
+    return EXIT_FAILURE;
+  }	
+
+  // 4368 UV;
+  // Prepare host buffers
+  uint64_t ndata1;
+  uint64_t ndata2;
+  uint64_t ndata3;
+  cl_int nsamp_per_uv_in  = 4368;
+  //cl_int nsamp_per_uv_out = 3552;
+  //cl_int nsamp_per_uv_out = 3328;
+  //cl_int ndm_per_cu       = 1024;
+  //cl_int ntime_per_cu     = 256;
+  //cl_int ndm_per_cu       = 2*TILE_WIDTH;
+  cl_int ndm_per_cu       = 1024;
+  //cl_int nsamp_per_uv_out = 3*TILE_WIDTH;
+  cl_int nsamp_per_uv_out = 3567;
+  cl_int ntime_per_cu     = 256;
+
+  // Sizes which are not multiples of TILE_WIDTH or NSAMP_PER_BURST, to exercise the edge tiles
+  if(is_hw_emulation()){
+    ndm_per_cu       = TILE_WIDTH + 40;
+    nsamp_per_uv_out = TILE_WIDTH + 7;
+    ntime_per_cu     = 2;
+  }
+  if(is_sw_emulation()){
+    ndm_per_cu       = TILE_WIDTH + 40;
+    nsamp_per_uv_out = TILE_WIDTH + 7;
+    ntime_per_cu     = 2;
+  }
+  
+  // Rows are padded to whole bursts in memory
+  cl_int nburst_dm         = (ndm_per_cu + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  cl_int nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+
+  ndata1 = 2*nsamp_per_uv_out;
+  ndata2 = 2*ntime_per_cu*nburst_dm*NSAMP_PER_BURST*(uint64_t)nsamp_per_uv_in;
+  ndata3 = 2*ntime_per_cu*ndm_per_cu*(uint64_t)nburst_per_uv_out*NSAMP_PER_BURST;
+  
+  // Bursts on the input and output streams
+  cl_int nburst_in  = nsamp_per_uv_out*ntime_per_cu*nburst_dm;
+  cl_int nburst_out = ndm_per_cu*ntime_per_cu*nburst_per_uv_out;
+
+  // Blocks go through the two stage buffers in turn, launch l stages block l and sends block l-1 out
+  // All blocks are the same input here, it is the turns of the buffers which are tested
+  cl_int nblock = 2;
+  
+  uv_data_t *in = NULL;
+  uv_data_t *sw_out = NULL;
+  uv_data_t *hw_out = NULL;
+  stats_t *sw_stats = NULL;
+  stats_t *hw_stats = NULL;
+  stats_t *sw_total = NULL;
+  stats_t *hw_total = NULL;
+  const char *stage[NSTATS] = {"read2fifo", "fill_tile", "transpose_tile", "stripe2stream"};
+  
+  in        = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata2*sizeof(uv_data_t));
+  sw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
+  hw_out    = (uv_data_t *)aligned_alloc(MEM_ALIGNMENT, ndata3*sizeof(uv_data_t));
+  sw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_stats  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  sw_total  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  hw_total  = (stats_t *)aligned_alloc(MEM_ALIGNMENT, NSTATS*sizeof(stats_t));
+  
+  fprintf(stdout, "INFO: %f MB memory used on host in total\n",
+	  ((ndata2 + 2*ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH1)/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %f MB memory used on device in total\n",
+	  ((ndata2 + ndata3)*DATA_WIDTH + ndata1*COORD_WIDTH1)/(8*1024.*1024.));
+  fprintf(stdout, "INFO: %f MB memory used on device for raw input\n",
+	  ndata2*DATA_WIDTH/(8*1024.*1024.));  
+  fprintf(stdout, "INFO: %f MB memory used on device for raw output\n",
+	  ndata3*DATA_WIDTH/(8*1024.*1024.));  
+  fprintf(stdout, "INFO: %f MB memory used on device for staging\n",
+	  2*nburst_in*(uint64_t)BURST_WIDTH/(8*1024.*1024.));  
+
+  FILE *fp=NULL;
+  char current_dir[LINE_LENGTH];
+  char fname[LINE_LENGTH];
+
+  sprintf(current_dir, "/data/FRIGG_2/Workspace/coherent-craft-sdaccel/transpose/src");
+  sprintf(fname, "%s/error.txt", current_dir);
+  fp = fopen(fname, "w");
+
+  // Prepare input
+  uint64_t i;
+  srand(time(NULL));
+  for(i = 0; i < ndata2; i++){
+    in[i] = (uv_data_t)(0.99*(rand()%DATA_RANGE));
+  }
+  memset(sw_out, 0x00, ndata3*sizeof(uv_data_t));
+  memset(hw_out, 0x00, ndata3*sizeof(uv_data_t));
+  memset(hw_stats, 0x00, NSTATS*sizeof(stats_t));
+  memset(sw_total, 0x00, NSTATS*sizeof(stats_t));
+  memset(hw_total, 0x00, NSTATS*sizeof(stats_t));
+  
+  // Calculate on host
+  cl_float cpu_elapsed_time;
+  struct timespec host_start;
+  struct timespec host_finish;
+  clock_gettime(CLOCK_REALTIME, &host_start);
+  transpose_fast(in, sw_out, nsamp_per_uv_out, ntime_per_cu, ndm_per_cu);
+  fprintf(stdout, "INFO: DONE HOST EXECUTION\n");
+  clock_gettime(CLOCK_REALTIME, &host_finish);
+  cpu_elapsed_time = (host_finish.tv_sec - host_start.tv_sec) + (host_finish.tv_nsec - host_start.tv_nsec)/1.0E9L;
+
+  // Get platform ID and info
+  cl_int err;
+  cl_uint platforms;
+  cl_int get_platform_id = 0;
+  cl_platform_id platform_id;
+  cl_platform_id platform_ids[MAX_PALTFORMS];
+  char platform_name[PARAM_VALUE_SIZE];  
+  OCL_CHECK(err, err = clGetPlatformIDs(MAX_PALTFORMS, platform_ids, &platforms));
+  for(i = 0; i < platforms; i++){
+    OCL_CHECK(err, err = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_VENDOR, PARAM_VALUE_SIZE, (void *)platform_name, NULL));
+    if(strcmp(platform_name, "Xilinx") == 0){
+      platform_id = platform_ids[i];
+      get_platform_id = 1;
+      break;
+    }
+  }
+  if(get_platform_id ==0){
+    fprintf(stderr, "ERROR: Failed to get platform ID!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+  
+  // Get device ID and info
+  cl_uint devices;
+  cl_int get_device_id = 0;
+  cl_device_id device_id;
+  cl_device_id device_ids[MAX_DEVICES];
+  char device_name[PARAM_VALUE_SIZE];
+  OCL_CHECK(err, err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ACCELERATOR, MAX_DEVICES, device_ids, &devices));
+  for(i = 0; i < devices; i++){
+    OCL_CHECK(err, err = clGetDeviceInfo(device_ids[i], CL_DEVICE_NAME, PARAM_VALUE_SIZE, device_name, 0));    
+    if(strstr(device_name, "u280")){
+      device_id = device_ids[i];
+      get_device_id = 1;
+      break;
+    }
+  }
+  if(get_device_id ==0){
+    fprintf(stderr, "ERROR: Failed to get device ID!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");   
+    return EXIT_FAILURE; 
+  }  
+  fprintf(stdout, "INFO: We will use %s!\n", device_name);
+
+  // Create context
+  cl_context context;
+  OCL_CHECK(err, context = clCreateContext(0, 1, &device_id, NULL, NULL, &err));
+  
+  // Create command queue, out of order so that the streaming kernels run at the same time
+  cl_command_queue queue;
+  OCL_CHECK(err, queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err));
+  
+  // Read kernel binary into memory
+  char *xclbin = argv[1];
+  unsigned char *binary = NULL;
+  size_t binary_size;
+  fprintf(stdout, "INFO: loading xclbin %s\n", xclbin);
+  binary_size = (int)load_file_to_memory(xclbin, (char **) &binary);
+  if (binary_size <= 0) {
+    fprintf(stderr, "ERROR: Failed to load kernel from xclbin: %s\n", xclbin);
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Create program binary with kernel binary
+  cl_int status;
+  cl_program program;
+  OCL_CHECK(err, program = clCreateProgramWithBinary(context, 1, &device_id, &binary_size, (const unsigned char **) &binary, &status, &err));
+  free(binary);
+  
+  // Program the card with the program binary
+  OCL_CHECK(err, err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL));
+
+  // Create the kernel
+  cl_kernel knl_read;
+  cl_kernel knl_transpose_axis;
+  cl_kernel knl_write;
+  OCL_CHECK(err, knl_read           = clCreateKernel(program, "knl_read", &err));
+  OCL_CHECK(err, knl_transpose_axis = clCreateKernel(program, "knl_transpose_axis", &err));
+  OCL_CHECK(err, knl_write          = clCreateKernel(program, "knl_write", &err));
+
+  // Prepare device buffer
+  // The stage buffers only live on the device, they go to HBM with the connectivity given at link time
+  // Both of them are filled and drained in turn, so both stage ports have to reach both of them
+  cl_mem buffer_in;
+  cl_mem buffer_out;
+  cl_mem buffer_stats;
+  cl_mem buffer_stage[2];
+  cl_mem pt[3];
+
+  OCL_CHECK(err, buffer_in    = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata2, in, &err));
+  OCL_CHECK(err, buffer_out   = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(uv_data_t)*ndata3, hw_out, &err));
+  OCL_CHECK(err, buffer_stats = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, sizeof(stats_t)*NSTATS, hw_stats, &err));
+  OCL_CHECK(err, buffer_stage[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, (uint64_t)BURST_WIDTH/8*nburst_in, NULL, &err));
+  OCL_CHECK(err, buffer_stage[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, (uint64_t)BURST_WIDTH/8*nburst_in, NULL, &err));
+  if (!(buffer_in&&
+	buffer_out&&
+	buffer_stats&&
+	buffer_stage[0]&&
+	buffer_stage[1]
+	)) {
+    fprintf(stderr, "ERROR: Failed to allocate device memory!\n");
+    fprintf(stderr, "ERROR: Please look into the file \"%s\" above line [%d]!\n", __FILE__, __LINE__);
+    fprintf(stderr, "ERROR: Test failed ...!\n");
+    return EXIT_FAILURE;
+  }
+
+  // Setup kernel arguments
+  // To use multiple banks, this has to be before any enqueue options (e.g., clEnqueueMigrateMemObjects)
+  pt[0] = buffer_in;
+  pt[1] = buffer_out;
+  pt[2] = buffer_stats;
+
+  cl_int launch;
+  cl_int stage_mode   = STAGE_FILL;
+  cl_int nburst_read  = nburst_in;
+  cl_int nburst_write = 0;
+  
+  OCL_CHECK(err, err = clSetKernelArg(knl_read, 0, sizeof(cl_mem), &buffer_in));
+  OCL_CHECK(err, err = clSetKernelArg(knl_read, 2, sizeof(cl_int), &nburst_read));
+  
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 2, sizeof(cl_mem), &buffer_stage[0]));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 3, sizeof(cl_mem), &buffer_stage[1]));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 4, sizeof(cl_int), &nsamp_per_uv_out));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 5, sizeof(cl_int), &ntime_per_cu));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 6, sizeof(cl_int), &ndm_per_cu));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 7, sizeof(cl_int), &stage_mode));
+  OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 8, sizeof(cl_mem), &buffer_stats));
+  
+  OCL_CHECK(err, err = clSetKernelArg(knl_write, 1, sizeof(cl_mem), &buffer_out));
+  OCL_CHECK(err, err = clSetKernelArg(knl_write, 2, sizeof(cl_int), &nburst_write));
+  
+  fprintf(stdout, "INFO: DONE SETUP KERNEL\n");
+
+  // Migrate host memory to device
+  cl_int inputs = 1;
+  OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, inputs, pt, 0 ,0,NULL, NULL));
+  OCL_CHECK(err, err = clFinish(queue));
+  fprintf(stdout, "INFO: DONE MEMCPY FROM HOST TO KERNEL\n");
+
+  // Execute the kernels, one launch per block and one more to send the last block out
+  // The three kernels of a launch stream to each other, so they run at the same time
+  struct timespec device_start;
+  struct timespec device_finish;
+  cl_float kernel_elapsed_time = 0;
+  uint64_t row;
+  uint64_t loc_sw;
+  cl_int tile;
+  cl_int ndm_tile;
+  cl_int nsamp_per_row = nburst_per_uv_out*NSAMP_PER_BURST;
+  cl_int outputs = 2;
+  for(launch = 0; launch <= nblock; launch++){
+    stage_mode   = (launch < nblock ? STAGE_FILL : 0) | (launch > 0 ? STAGE_DRAIN : 0);
+    nburst_read  = (stage_mode & STAGE_FILL)  ? nburst_in  : 0;
+    nburst_write = (stage_mode & STAGE_DRAIN) ? nburst_out : 0;
+    OCL_CHECK(err, err = clSetKernelArg(knl_read, 2, sizeof(cl_int), &nburst_read));
+    OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 2, sizeof(cl_mem), &buffer_stage[launch%2]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 3, sizeof(cl_mem), &buffer_stage[1-launch%2]));
+    OCL_CHECK(err, err = clSetKernelArg(knl_transpose_axis, 7, sizeof(cl_int), &stage_mode));
+    OCL_CHECK(err, err = clSetKernelArg(knl_write, 2, sizeof(cl_int), &nburst_write));
+    
+    clock_gettime(CLOCK_REALTIME, &device_start);
+    OCL_CHECK(err, err = clEnqueueTask(queue, knl_read, 0, NULL, NULL));
+    OCL_CHECK(err, err = clEnqueueTask(queue, knl_transpose_axis, 0, NULL, NULL));
+    OCL_CHECK(err, err = clEnqueueTask(queue, knl_write, 0, NULL, NULL));
+    OCL_CHECK(err, err = clFinish(queue));
+    clock_gettime(CLOCK_REALTIME, &device_finish);
+    kernel_elapsed_time += (device_finish.tv_sec - device_start.tv_sec) + (device_finish.tv_nsec - device_start.tv_nsec)/1.0E9L;
+    
+    // Migrate data from device to host
+    OCL_CHECK(err, err = clEnqueueMigrateMemObjects(queue, outputs, &pt[1], CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL));
+    OCL_CHECK(err, err = clFinish(queue));
+    add_stats(hw_total, hw_stats, NSTATS);
+    transpose_axis_stats(nsamp_per_uv_out, ntime_per_cu, (stage_mode & STAGE_DRAIN) ? ndm_per_cu : 0, sw_stats);
+    add_stats(sw_total, sw_stats, NSTATS);
+    
+    //// Check the result
+    // The stream comes in stripe order, DM tile, time and then DM in the tile, only the last DM tile can be short
+    if(stage_mode & STAGE_DRAIN){
+      for(i=0;i<ndata3/2;i++){
+        row      = i/nsamp_per_row;
+        tile     = row/(TILE_WIDTH*ntime_per_cu);
+        ndm_tile = ndm_per_cu - tile*TILE_WIDTH;
+        ndm_tile = (ndm_tile < TILE_WIDTH) ? ndm_tile : TILE_WIDTH;
+        row      = row%(TILE_WIDTH*ntime_per_cu);
+        loc_sw   = ((tile*TILE_WIDTH + row%ndm_tile)*ntime_per_cu + row/ndm_tile)*nsamp_per_row + i%nsamp_per_row;
+        if((sw_out[2*loc_sw] != hw_out[2*i])||(sw_out[2*loc_sw+1] != hw_out[2*i+1])){
+          fprintf(fp, "ERROR: Test failed in block %d at %d (%f %f) (%f %f)\n", launch - 1, i, sw_out[2*loc_sw].to_float(), sw_out[2*loc_sw+1].to_float(), hw_out[2*i].to_float(), hw_out[2*i+1].to_float());
+        }
+      }
+    }
+  }
+  fprintf(stdout, "INFO: DONE KERNEL EXECUTION\n");
+  
+  fclose(fp);
+  
+  fprintf(stdout, "INFO: DONE RESULT CHECK\n");
+  
+  fprintf(stdout, "INFO: Elapsed time of CPU code is %E seconds\n", cpu_elapsed_time);
+  fprintf(stdout, "INFO: Elapsed time of kernel is %E seconds\n", kernel_elapsed_time);
+  print_stats("Counters of CPU model", stage, sw_total, NSTATS);
+  print_stats("Counters of kernel", stage, hw_total, NSTATS);
+  
+  // Gaps between tiles show up as cycles of the launch in which the tile engine fills nothing
+  // Software emulation counts polls of a thread instead of cycles, so there is nothing to compare
+  if(!is_sw_emulation()){
+    fprintf(stdout, "INFO: The tile engine fills in %f of the %" PRIu64 " cycles of the launches, the model takes %" PRIu64 " cycles\n",
+            hw_total[STATS_FILL_TILE].active/(double)hw_total[STATS_FILL_TILE].cycle, hw_total[STATS_FILL_TILE].cycle,
+            sw_total[STATS_FILL_TILE].cycle);
+  }
+  
+  // Cleanup
+  clReleaseMemObject(buffer_in);
+  clReleaseMemObject(buffer_out);
+  clReleaseMemObject(buffer_stats);
+  clReleaseMemObject(buffer_stage[0]);
+  clReleaseMemObject(buffer_stage[1]);
+  
+  free(in);
+  free(sw_out);
+  free(hw_out);
+  free(sw_stats);
+  free(hw_stats);
+  free(sw_total);
+  free(hw_total);
+  clReleaseProgram(program);
+  clReleaseKernel(knl_read);
+  clReleaseKernel(knl_transpose_axis);
+  clReleaseKernel(knl_write);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  fprintf(stdout, "INFO: DONE ALL\n");
+  
+  return EXIT_SUCCESS;
+}
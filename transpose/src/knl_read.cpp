@@ -0,0 +1,41 @@
+#include "transpose.h"
+
+// Feeds UV data from memory to knl_transpose_axis, stands for knl_grid in the test
+extern "C"{
+  void knl_read(
+                const burst_uv *in,
+                stream_uv &in_stream,
+                int nburst);
+}
+
+void knl_read(
+              const burst_uv *in,
+              stream_uv &in_stream,
+              int nburst){
+#pragma HLS INTERFACE m_axi port = in offset = slave bundle = gmem1
+#pragma HLS INTERFACE axis  port = in_stream
+
+#pragma HLS INTERFACE s_axilite port = in     bundle = control
+#pragma HLS INTERFACE s_axilite port = nburst bundle = control
+#pragma HLS INTERFACE s_axilite port = return bundle = control
+
+#pragma HLS DATA_PACK variable = in
+  
+  const int mburst = MSAMP_PER_UV_OUT*MTIME_PER_CU*MBURST_DM;
+  
+  int i;
+  int j;
+  burst_uv burst;
+  stream_t stream;
+  
+ loop_read:
+  for(i = 0; i < nburst; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst
+#pragma HLS PIPELINE
+    burst = in[i];
+    for(j = 0; j < NSAMP_PER_BURST; j++){
+      stream.data(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH) = burst.data[j];
+    }
+    in_stream.write(stream);
+  }
+}
@@ -1,266 +1,862 @@
 #include "transpose.h"
 
 // Order is assumed to be UT-TIME-DM
+// Any UV and DM count works, rows are padded to whole bursts in memory and edge tiles are masked
+// Several CUs can split the DM range, each one reads its DM slice from dm_offset on in place, rows of the input are nburst_dm bursts,
+// and writes the output rows of its slice to its own buffer
 extern "C" {  
   void knl_transpose(
                      const burst_uv *in,
                      burst_uv *out,
-                     int nburst_per_uv_out,
+                     int nsamp_per_uv_out,
                      int ntime_per_cu,
-                     int nburst_dm
+                     int ndm,
+                     int dm_offset,
+                     int nburst_dm,
+                     stats_t *stats
                      );
   
+  void knl_transpose_axis(
+                          stream_uv &in_stream,
+                          stream_uv &out_stream,
+                          burst_uv *stage_fill,
+                          const burst_uv *stage_drain,
+                          int nsamp_per_uv_out,
+                          int ntime_per_cu,
+                          int ndm,
+                          int stage_mode,
+                          stats_t *stats
+                          );
+  
+  void transpose_stripe(
+                        stream_uv &in_stream,
+                        burst_uv *stage_fill,
+                        int nburst_fill,
+                        const burst_uv *stage_drain,
+                        stream_uv &out_stream,
+                        int nsamp_per_uv_out,
+                        int ntime_per_cu,
+                        int ndm_drain,
+                        stats_t *stats);
+  
+  void transpose_memory(
+                        const burst_uv *in,
+                        burst_uv *out,
+                        int nsamp_per_uv_out,
+                        int ntime_per_cu,
+                        int ndm,
+                        int dm_offset,
+                        int nburst_dm,
+                        stats_t *stats);
+  
+  void stream2stage(
+                    int nburst,
+                    stream_uv &in_stream,
+                    burst_uv *stage_in);
+  
   void read2fifo(
-                 int nburst_per_uv_out,
+                 int nsamp_per_uv_out,
                  int ntime_per_cu,
-                 int nburst_dm,
+                 int ndm,
+                 int dm_offset,
+                 int nburst_dm_in,
+                 bool stripe_order,
                  const burst_uv *in,
-                 fifo_uv &in_fifo);
+                 fifo_uv &in_fifo,
+                 fifo_stats &stats_fifo);
   
   void transpose(
-                 int nburst_per_uv_out,
+                 int nsamp_per_uv_out,
                  int ntime_per_cu,
-                 int nburst_dm,
+                 int ndm,
                  fifo_uv &in_fifo,
-                 fifo_uv &out_fifo);
+                 fifo_uv &out_fifo,
+                 fifo_stats &fill_stats_fifo,
+                 fifo_stats &transpose_stats_fifo);
 
-  void fill_tile(
-                 fifo_uv &in_fifo,
-                 uv_t uv_tile[TILE_WIDTH][TILE_WIDTH]);
+  void mask_burst(
+                  burst_uv &burst,
+                  int nsamp_valid);
+  
+  void next_burst(
+                  int ntran_per_uv_out,
+                  int ntran_dm,
+                  int &i,
+                  int &j,
+                  int &k,
+                  int &m,
+                  int &n);
   
-  void transpose_tile(
-                      uv_t uv_tile[TILE_WIDTH][TILE_WIDTH],
-                      fifo_uv &in_fifo);
+  void next_stripe_burst(
+                         int ntran_per_uv_out,
+                         int ntime_per_cu,
+                         int &i,
+                         int &j,
+                         int &k,
+                         int &m,
+                         int &n);
   
   void write_from_fifo(
-                       int nburst_per_uv_out,
+                       int nsamp_per_uv_out,
                        int ntime_per_cu,
-                       int nburst_dm,
+                       int ndm,
                        fifo_uv &out_fifo,
-                       burst_uv *out);
+                       burst_uv *out,
+                       fifo_stats &stats_fifo);
+  
+  void stripe2stream(
+                     int nsamp_per_uv_out,
+                     int ntime_per_cu,
+                     int ndm,
+                     fifo_uv &out_fifo,
+                     stream_uv &out_stream,
+                     fifo_stats &stats_fifo);
+
+  void write_stats(
+                   int nsamp_per_uv_out,
+                   int ntime_per_cu,
+                   int ndm,
+                   fifo_stats stats_fifo[NSTATS],
+                   stats_t *stats);
 }
 
 void knl_transpose(
                    const burst_uv *in,
                    burst_uv *out,
-                   int nburst_per_uv_out,
+                   int nsamp_per_uv_out,
                    int ntime_per_cu,
-                   int nburst_dm
+                   int ndm,
+                   int dm_offset,
+                   int nburst_dm,
+                   stats_t *stats
                    )
 {
   const int burst_length      = BURST_LENGTH;
   
 #pragma HLS INTERFACE m_axi port = in    offset = slave bundle = gmem0 max_read_burst_length =burst_length
 #pragma HLS INTERFACE m_axi port = out   offset = slave bundle = gmem1 max_write_burst_length=burst_length
+#pragma HLS INTERFACE m_axi port = stats offset = slave bundle = gmem2
 
 #pragma HLS INTERFACE s_axilite port = in     bundle = control
 #pragma HLS INTERFACE s_axilite port = out    bundle = control
+#pragma HLS INTERFACE s_axilite port = stats  bundle = control
 
-#pragma HLS INTERFACE s_axilite port = nburst_per_uv_out bundle = control
+#pragma HLS INTERFACE s_axilite port = nsamp_per_uv_out  bundle = control
 #pragma HLS INTERFACE s_axilite port = ntime_per_cu      bundle = control
+#pragma HLS INTERFACE s_axilite port = ndm               bundle = control
+#pragma HLS INTERFACE s_axilite port = dm_offset         bundle = control
 #pragma HLS INTERFACE s_axilite port = nburst_dm         bundle = control
 #pragma HLS INTERFACE s_axilite port = return            bundle = control
 
 #pragma HLS DATA_PACK variable = in
 #pragma HLS DATA_PACK variable = out
+#pragma HLS DATA_PACK variable = stats
+
+  transpose_memory(
+                   in,
+                   out,
+                   nsamp_per_uv_out,
+                   ntime_per_cu,
+                   ndm,
+                   dm_offset,
+                   nburst_dm,
+                   stats);
+}
+
+// Same transpose with AXIS ports, to chain it between kernels without a DDR round trip
+// The first output row needs the last input, so a block is staged with the input layout before it is transposed,
+// the stage is meant to be HBM given at link time, 3567x256x1024 samples are 3.7 GB and do not fit on chip
+// Two stage buffers make a ping-pong over blocks, a launch streams block b into stage_fill while block b-1 goes out of stage_drain,
+// the host swaps the two buffers between launches and stage_mode says if a launch fills, drains or both
+// The output is not staged, tiles go through an on-chip stripe straight to out_stream
+// The stream is in stripe order, DM tile, time, DM in the tile and then the UV bursts of the row,
+// so a DM row comes out whole but the rows of a DM tile are interleaved over time
+void knl_transpose_axis(
+                        stream_uv &in_stream,
+                        stream_uv &out_stream,
+                        burst_uv *stage_fill,
+                        const burst_uv *stage_drain,
+                        int nsamp_per_uv_out,
+                        int ntime_per_cu,
+                        int ndm,
+                        int stage_mode,
+                        stats_t *stats
+                        )
+{
+  const int burst_length      = BURST_LENGTH;
+  
+#pragma HLS INTERFACE axis  port = in_stream
+#pragma HLS INTERFACE axis  port = out_stream
+#pragma HLS INTERFACE m_axi port = stage_fill  offset = slave bundle = gmem0 max_write_burst_length=burst_length
+#pragma HLS INTERFACE m_axi port = stage_drain offset = slave bundle = gmem1 max_read_burst_length =burst_length
+#pragma HLS INTERFACE m_axi port = stats       offset = slave bundle = gmem2
 
+#pragma HLS INTERFACE s_axilite port = stage_fill  bundle = control
+#pragma HLS INTERFACE s_axilite port = stage_drain bundle = control
+#pragma HLS INTERFACE s_axilite port = stats       bundle = control
+
+#pragma HLS INTERFACE s_axilite port = nsamp_per_uv_out  bundle = control
+#pragma HLS INTERFACE s_axilite port = ntime_per_cu      bundle = control
+#pragma HLS INTERFACE s_axilite port = ndm               bundle = control
+#pragma HLS INTERFACE s_axilite port = stage_mode        bundle = control
+#pragma HLS INTERFACE s_axilite port = return            bundle = control
+
+#pragma HLS DATA_PACK variable = stage_fill
+#pragma HLS DATA_PACK variable = stage_drain
+#pragma HLS DATA_PACK variable = stats
+
+  // A launch without a block to drain runs the tile engine on no DM tiles
+  int nburst_fill = (stage_mode & STAGE_FILL) ? nsamp_per_uv_out*ntime_per_cu*((ndm + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST) : 0;
+  int ndm_drain   = (stage_mode & STAGE_DRAIN) ? ndm : 0;
+  
+  transpose_stripe(
+                   in_stream,
+                   stage_fill,
+                   nburst_fill,
+                   stage_drain,
+                   out_stream,
+                   nsamp_per_uv_out,
+                   ntime_per_cu,
+                   ndm_drain,
+                   stats);
+}
+
+void transpose_memory(
+                      const burst_uv *in,
+                      burst_uv *out,
+                      int nsamp_per_uv_out,
+                      int ntime_per_cu,
+                      int ndm,
+                      int dm_offset,
+                      int nburst_dm,
+                      stats_t *stats){
   fifo_uv in_fifo;
   fifo_uv out_fifo;
-  const int nburst_per_tran = BURST_LENGTH*BURST_LENGTH;
-#pragma HLS STREAM variable = in_fifo  depth = nburst_per_tran //256 //32
-#pragma HLS STREAM variable = out_fifo depth = nburst_per_tran //256 //32
+  fifo_stats stats_fifo[NSTATS]; // Counters of each stage
+  const int fifo_depth = FIFO_DEPTH;
+#pragma HLS STREAM variable = in_fifo  depth = fifo_depth
+#pragma HLS STREAM variable = out_fifo depth = fifo_depth
+#pragma HLS STREAM variable = stats_fifo
   
 #pragma HLS DATAFLOW
   
   read2fifo(
-            nburst_per_uv_out,
+            nsamp_per_uv_out,
             ntime_per_cu,
+            ndm,
+            dm_offset,
             nburst_dm,
+            false,
             in,
-            in_fifo);
+            in_fifo,
+            stats_fifo[STATS_READ2FIFO]);
   
   transpose(
-            nburst_per_uv_out,
+            nsamp_per_uv_out,
             ntime_per_cu,
-            nburst_dm,
+            ndm,
             in_fifo,
-            out_fifo);
+            out_fifo,
+            stats_fifo[STATS_FILL_TILE],
+            stats_fifo[STATS_TRANSPOSE_TILE]);
 
   write_from_fifo(
-                  nburst_per_uv_out,
+                  nsamp_per_uv_out,
                   ntime_per_cu,
-                  nburst_dm,
+                  ndm,
                   out_fifo,
-                  out);
+                  out,
+                  stats_fifo[STATS_WRITE_FROM_FIFO]);
+
+  write_stats(
+              nsamp_per_uv_out,
+              ntime_per_cu,
+              ndm,
+              stats_fifo,
+              stats);
+}
+
+// Staging of the next block, read, tile engine and stripe run concurrently, the stripe takes the place of write_from_fifo in the counters
+// The block which is staged and the one which is read are in different buffers, so the two sides never touch the same data
+void transpose_stripe(
+                      stream_uv &in_stream,
+                      burst_uv *stage_fill,
+                      int nburst_fill,
+                      const burst_uv *stage_drain,
+                      stream_uv &out_stream,
+                      int nsamp_per_uv_out,
+                      int ntime_per_cu,
+                      int ndm_drain,
+                      stats_t *stats){
+  fifo_uv in_fifo;
+  fifo_uv out_fifo;
+  fifo_stats stats_fifo[NSTATS]; // Counters of each stage
+  const int fifo_depth = FIFO_DEPTH;
+#pragma HLS STREAM variable = in_fifo  depth = fifo_depth
+#pragma HLS STREAM variable = out_fifo depth = fifo_depth
+#pragma HLS STREAM variable = stats_fifo
+  
+#pragma HLS DATAFLOW
+  
+  stream2stage(
+               nburst_fill,
+               in_stream,
+               stage_fill);
+  
+  read2fifo(
+            nsamp_per_uv_out,
+            ntime_per_cu,
+            ndm_drain,
+            0,
+            (ndm_drain + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST,
+            true,
+            stage_drain,
+            in_fifo,
+            stats_fifo[STATS_READ2FIFO]);
+  
+  transpose(
+            nsamp_per_uv_out,
+            ntime_per_cu,
+            ndm_drain,
+            in_fifo,
+            out_fifo,
+            stats_fifo[STATS_FILL_TILE],
+            stats_fifo[STATS_TRANSPOSE_TILE]);
+
+  stripe2stream(
+                nsamp_per_uv_out,
+                ntime_per_cu,
+                ndm_drain,
+                out_fifo,
+                out_stream,
+                stats_fifo[STATS_WRITE_FROM_FIFO]);
+
+  write_stats(
+              nsamp_per_uv_out,
+              ntime_per_cu,
+              ndm_drain,
+              stats_fifo,
+              stats);
 }
 
 void read2fifo(
-               int nburst_per_uv_out,
+               int nsamp_per_uv_out,
                int ntime_per_cu,
-               int nburst_dm,
+               int ndm,
+               int dm_offset,
+               int nburst_dm_in,
+               bool stripe_order,
                const burst_uv *in,
-               fifo_uv &in_fifo){
+               fifo_uv &in_fifo,
+               fifo_stats &stats_fifo){
   int i;
   int j;
   int k;
   int m;
   int n;
   int loc_burst;
-  int ntran_dm         = nburst_dm/BURST_LENGTH;
-  int ntran_per_uv_out = nburst_per_uv_out/BURST_LENGTH;
-  int nsamp_per_burst  = NSAMP_PER_BURST;
-
-  const int mburst_per_uv_out = MBURST_PER_UV_OUT;
-  const int mtran_per_uv_out = MBURST_PER_UV_OUT/BURST_LENGTH;
-  const int mtime_per_cu     = MTIME_PER_CU;  
-  const int mtran_dm         = MBURST_DM/BURST_LENGTH;
-    
-  for(k = 0; k < ntime_per_cu; k++){        // For Time
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtime_per_cu
-    for(i = 0; i < ntran_per_uv_out; i++){  // For UV
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_per_uv_out
-      for(j = 0; j < ntran_dm; j++){        // For DM
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_dm
-        
-        // Burst in
-        for(m = 0; m < TILE_WIDTH; m++){            // For UV
-        loop_read2fifo:
-          for(n = 0; n < BURST_LENGTH; n++){        // For DM
+  int uv;
+  int burst_dm;
+  bool valid;
+  burst_uv burst;
+  uint64_t count;
+  stats_t stats = {0, 0, 0, 0, 0};
+  int nburst_dm        = (ndm + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  int ntran_dm         = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  int ntran_per_uv_out = (nsamp_per_uv_out + TILE_WIDTH - 1)/TILE_WIDTH;
+  uint64_t nburst      = (uint64_t)ntime_per_cu*ntran_per_uv_out*ntran_dm*TILE_WIDTH*BURST_LENGTH;
+
+  const int mburst = MTIME_PER_CU*MTRAN_PER_UV_OUT*MTRAN_DM*TILE_WIDTH*BURST_LENGTH;
+
+  // One flat loop over Time, UV tiles, DM tiles, UV in a tile and DM in a tile,
+  // so that the pipeline is not drained at the end of every tile row
+  // In stripe order DM tiles are the slowest, then Time and UV tiles
+  i = 0;
+  j = 0;
+  k = 0;
+  m = 0;
+  n = 0;
+  count = 0;
+ loop_read2fifo:
+  while(count < nburst){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
 #pragma HLS PIPELINE
-            loc_burst = (i*TILE_WIDTH+m)*ntime_per_cu*nburst_dm+
-              k*nburst_dm+
-              j*BURST_LENGTH +
-              n;
-            in_fifo.write(in[loc_burst]);
-          }
-        }        
-      }      
+    // Count the cycles blocked by the transpose instead of waiting on the write
+    if(in_fifo.full()){
+      stats.stall_full++;
+    }
+    else{
+      // Edge tiles are filled up with zeros, so the rest of the chain always sees full tiles
+      uv       = i*TILE_WIDTH+m;
+      burst_dm = j*BURST_LENGTH+n;
+      valid    = (uv < nsamp_per_uv_out) && (burst_dm < nburst_dm);
+      loc_burst = uv*ntime_per_cu*nburst_dm_in+
+        k*nburst_dm_in+
+        dm_offset/NSAMP_PER_BURST+
+        burst_dm;
+      if(valid){
+        burst = in[loc_burst];
+        stats.burst++;
+      }
+      mask_burst(burst, valid ? ndm - burst_dm*NSAMP_PER_BURST : 0);
+      in_fifo.write(burst);
+      stats.active++;
+      count++;
+      
+      if(stripe_order){
+        next_stripe_burst(ntran_per_uv_out, ntime_per_cu, i, j, k, m, n);
+      }
+      else{
+        next_burst(ntran_per_uv_out, ntran_dm, i, j, k, m, n);
+      }
     }
   }
+  stats_fifo.write(stats);
 }
 
+// Explicit ping-pong tile engine, one tile is filled while the previous one is transposed out
+// Both sides move a burst per iteration of one flat loop, so the pipeline is not drained between tiles
+// A side which is done with its tile waits for the other one, which is counted as a stall of the tile buffer
 void transpose(
-               int nburst_per_uv_out,
+               int nsamp_per_uv_out,
                int ntime_per_cu,
-               int nburst_dm,
+               int ndm,
                fifo_uv &in_fifo,
-               fifo_uv &out_fifo){
-  int i;
-  int j;
-  int k;
-  int ntran_dm         = nburst_dm/BURST_LENGTH;
-  int ntran_per_uv_out = nburst_per_uv_out/BURST_LENGTH;
-  
-  const int mtran_per_uv_out = MBURST_PER_UV_OUT/BURST_LENGTH;
-  const int mtime_per_cu     = MTIME_PER_CU;  
-  const int mtran_dm         = MBURST_DM/BURST_LENGTH;
-  const int nsamp_per_burst  = NSAMP_PER_BURST;
-  
-  uv_t uv_tile[TILE_WIDTH][TILE_WIDTH];
-  //#pragma HLS ARRAY_RESHAPE variable = uv_tile    cyclic factor = nsamp_per_burst dim =1
-  //#pragma HLS ARRAY_RESHAPE variable = uv_tile    cyclic factor = nsamp_per_burst dim =2
-#pragma HLS ARRAY_PARTITION variable = uv_tile    cyclic factor = nsamp_per_burst dim =1
+               fifo_uv &out_fifo,
+               fifo_stats &fill_stats_fifo,
+               fifo_stats &transpose_stats_fifo){
+  int n1;
+  int step;
+  int ping;
+  int nfill;
+  int ndrain;
+  int loc_tile;
+  bool fill_bool;
+  bool drain_bool;
+  burst_uv fill_burst;
+  burst_uv drain_burst;
+  stats_t fill_stats = {0, 0, 0, 0, 0};
+  stats_t transpose_stats = {0, 0, 0, 0, 0};
+  int ntran_dm         = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  int ntran_per_uv_out = (nsamp_per_uv_out + TILE_WIDTH - 1)/TILE_WIDTH;
+  int ntile            = ntime_per_cu*ntran_per_uv_out*ntran_dm;
+  
+  const int nburst_per_tile = TILE_WIDTH*BURST_LENGTH;
+  const int mcycle          = (MTIME_PER_CU*MTRAN_PER_UV_OUT*MTRAN_DM + 1)*TILE_WIDTH*BURST_LENGTH;
+  const int nsamp_per_burst = NSAMP_PER_BURST;
+  
+  uv_t uv_tile[2][TILE_WIDTH][TILE_WIDTH];
+#pragma HLS ARRAY_PARTITION variable = uv_tile    complete dim =1
 #pragma HLS ARRAY_PARTITION variable = uv_tile    cyclic factor = nsamp_per_burst dim =2
+#pragma HLS ARRAY_PARTITION variable = uv_tile    cyclic factor = nsamp_per_burst dim =3
 
-  for(k = 0; k < ntime_per_cu; k++){        // For Time
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtime_per_cu
-    for(i = 0; i < ntran_per_uv_out; i++){  // For UV
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_per_uv_out
-      for(j = 0; j < ntran_dm; j++){        // For DM
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_dm
-#pragma HLS DATAFLOW 
-        
-        fill_tile(in_fifo, uv_tile);
-        transpose_tile(uv_tile, out_fifo);
-      }      
+  // Step s fills tile s into buffer s%2 and drains tile s-1 from the other buffer
+  step   = 0;
+  nfill  = 0;
+  ndrain = 0;
+ loop_transpose:
+  while(step <= ntile){
+#pragma HLS LOOP_TRIPCOUNT min = nburst_per_tile max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = uv_tile inter false
+    ping       = step%2;
+    fill_bool  = (step < ntile) && (nfill < nburst_per_tile);
+    drain_bool = (step > 0) && (ndrain < nburst_per_tile);
+    
+    if(!fill_bool){
+      fill_stats.stall_full++;
+    }
+    else if(in_fifo.empty()){
+      fill_stats.stall_empty++;
+    }
+    else{
+      fill_burst = in_fifo.read();
+      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){  // For DM
+        loc_tile = (nfill%BURST_LENGTH)*NSAMP_PER_BURST+n1;
+        uv_tile[ping][nfill/BURST_LENGTH][loc_tile] = fill_burst.data[n1];
+      }
+      fill_stats.active++;
+      fill_stats.burst++;
+      nfill++;
+    }
+    
+    if(!drain_bool){
+      transpose_stats.stall_empty++;
     }
-  }  
+    else if(out_fifo.full()){
+      transpose_stats.stall_full++;
+    }
+    else{
+      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){  // For UV
+        loc_tile = (ndrain%BURST_LENGTH)*NSAMP_PER_BURST+n1;
+        drain_burst.data[n1] = uv_tile[1-ping][loc_tile][ndrain/BURST_LENGTH];
+      }
+      out_fifo.write(drain_burst);
+      transpose_stats.active++;
+      transpose_stats.burst++;
+      ndrain++;
+    }
+    
+    if((step == ntile || nfill == nburst_per_tile) && (step == 0 || ndrain == nburst_per_tile)){
+      step++;
+      nfill  = 0;
+      ndrain = 0;
+    }
+  }
+  fill_stats_fifo.write(fill_stats);
+  transpose_stats_fifo.write(transpose_stats);
 }
 
-void fill_tile(
-               fifo_uv &in_fifo,
-               uv_t uv_tile[TILE_WIDTH][TILE_WIDTH]){
-  
+void write_from_fifo(
+                     int nsamp_per_uv_out,
+                     int ntime_per_cu,
+                     int ndm,
+                     fifo_uv &out_fifo,
+                     burst_uv *out,
+                     fifo_stats &stats_fifo){
+  int i;
+  int j;
+  int k;
   int m;
   int n;
-  int n1;
-  int loc_tile;
+  int loc_burst;
+  int dm;
+  int burst_uv_out;
   burst_uv burst;
+  uint64_t count;
+  stats_t stats = {0, 0, 0, 0, 0};
+  int nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  int ntran_dm          = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  int ntran_per_uv_out  = (nsamp_per_uv_out + TILE_WIDTH - 1)/TILE_WIDTH;
+  uint64_t nburst       = (uint64_t)ntime_per_cu*ntran_per_uv_out*ntran_dm*TILE_WIDTH*BURST_LENGTH;
   
-  for(m = 0; m < TILE_WIDTH; m++){              // For UV
-  loop_fill_tile:
-    for(n = 0; n < BURST_LENGTH; n++){          // For DM
+  const int mburst = MTIME_PER_CU*MTRAN_PER_UV_OUT*MTRAN_DM*TILE_WIDTH*BURST_LENGTH;
+  
+  // Same flat loop as read2fifo, here m is DM in a tile and n is UV in a tile
+  i = 0;
+  j = 0;
+  k = 0;
+  m = 0;
+  n = 0;
+  count = 0;
+ loop_write_from_fifo:
+  while(count < nburst){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
 #pragma HLS PIPELINE
-      burst = in_fifo.read();
-      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){  // For DM
-        loc_tile = n*NSAMP_PER_BURST+n1;
-        uv_tile[m][loc_tile] = burst.data[n1];
+    if(out_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      // Bursts of edge tiles outside of the data are dropped, padding samples are already zero
+      dm           = j*TILE_WIDTH+m;
+      burst_uv_out = i*BURST_LENGTH+n;
+      loc_burst = dm*ntime_per_cu*nburst_per_uv_out +
+        k*nburst_per_uv_out +
+        burst_uv_out;
+      burst = out_fifo.read();
+      if((dm < ndm) && (burst_uv_out < nburst_per_uv_out)){
+        out[loc_burst] = burst;
+        stats.burst++;
       }
+      stats.active++;
+      count++;
+      
+      next_burst(ntran_per_uv_out, ntran_dm, i, j, k, m, n);
     }
   }
+  stats_fifo.write(stats);
 }
 
-void transpose_tile(
-                    uv_t uv_tile[TILE_WIDTH][TILE_WIDTH],
-                    fifo_uv &out_fifo){
+// Ping-pong over two stripes, a stripe is the TILE_WIDTH DM rows of one DM tile at one time
+// The tiles of the next stripe come in while the previous stripe goes out row by row
+// A stripe is MBURST_PER_STRIPE bursts, the pair takes 224 URAMs at the maximum UV count
+void stripe2stream(
+                   int nsamp_per_uv_out,
+                   int ntime_per_cu,
+                   int ndm,
+                   fifo_uv &out_fifo,
+                   stream_uv &out_stream,
+                   fifo_stats &stats_fifo){
+  int i;
+  int j;
   int m;
   int n;
-  int n1;
-  int loc_tile;
+  int dm;
+  int burst_uv_out;
+  int step;
+  int ping;
+  int nfill;
+  int nemit;
+  int ndm_emit;
+  bool fill_bool;
+  bool emit_bool;
   burst_uv burst;
+  stripe_burst_t word;
+  stream_t stream;
+  stats_t stats = {0, 0, 0, 0, 0};
+  int nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  int ntran_dm          = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  int ntran_per_uv_out  = (nsamp_per_uv_out + TILE_WIDTH - 1)/TILE_WIDTH;
+  int nstripe           = ntran_dm*ntime_per_cu;
+  int nfill_per_stripe  = ntran_per_uv_out*TILE_WIDTH*BURST_LENGTH;
   
-  for(m = 0; m < TILE_WIDTH; m++){              // For DM
-  loop_transpose_tile:
-    for(n = 0; n < BURST_LENGTH; n++){          // For UV
-#pragma HLS PIPELINE            
-      for(n1 = 0; n1 < NSAMP_PER_BURST; n1++){  // For UV
-        loc_tile = n*NSAMP_PER_BURST+n1;
-        burst.data[n1] = uv_tile[loc_tile][m];
+  const int mcycle = (MTRAN_DM*MTIME_PER_CU + 1)*MBURST_PER_STRIPE;
+  
+  stripe_burst_t stripe[2][MBURST_PER_STRIPE];
+#pragma HLS ARRAY_PARTITION variable = stripe complete dim =1
+#pragma HLS RESOURCE variable = stripe core = XPM_MEMORY uram
+  
+  // Step s fills stripe s into buffer s%2 and sends stripe s-1 from the other buffer
+  // Tiles come with DM in the tile as m and the UV burst in the tile as n, the fill side puts them at their place in the rows
+  step     = 0;
+  nfill    = 0;
+  nemit    = 0;
+  ndm_emit = 0;
+  i  = 0;
+  m  = 0;
+  n  = 0;
+  dm = 0;
+  burst_uv_out = 0;
+ loop_stripe2stream:
+  while(step <= nstripe){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mcycle
+#pragma HLS PIPELINE
+#pragma HLS DEPENDENCE variable = stripe inter false
+    ping      = step%2;
+    fill_bool = (step < nstripe) && (nfill < nfill_per_stripe);
+    emit_bool = (step > 0) && (nemit < ndm_emit*nburst_per_uv_out);
+    
+    // The sends of the last stripe have nothing to fill
+    if(!fill_bool){
+      stats.stall_full++;
+    }
+    else if(out_fifo.empty()){
+      stats.stall_empty++;
+    }
+    else{
+      burst = out_fifo.read();
+      for(j = 0; j < NSAMP_PER_BURST; j++){
+        word(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH) = burst.data[j];
+      }
+      stripe[ping][m*MBURST_PER_STRIPE_ROW+i*BURST_LENGTH+n] = word;
+      stats.active++;
+      nfill++;
+      
+      if(n < BURST_LENGTH-1){
+        n++;
+      }
+      else{
+        n = 0;
+        if(m < TILE_WIDTH-1){
+          m++;
+        }
+        else{
+          m = 0;
+          i++;
+        }
       }
-      out_fifo.write(burst);
-    }          
+    }
+    
+    // Bursts of edge tiles outside of the data are never sent, padding samples are already zero
+    if(emit_bool && !out_stream.full()){
+      stream.data = stripe[1-ping][dm*MBURST_PER_STRIPE_ROW+burst_uv_out];
+      out_stream.write(stream);
+      stats.burst++;
+      nemit++;
+      
+      if(burst_uv_out < nburst_per_uv_out-1){
+        burst_uv_out++;
+      }
+      else{
+        burst_uv_out = 0;
+        dm++;
+      }
+    }
+    
+    if((step == nstripe || nfill == nfill_per_stripe) && (step == 0 || nemit == ndm_emit*nburst_per_uv_out)){
+      // DM tiles are the slowest, only the last one can be short
+      ndm_emit = ndm - (step/ntime_per_cu)*TILE_WIDTH;
+      ndm_emit = (ndm_emit < TILE_WIDTH) ? ndm_emit : TILE_WIDTH;
+      step++;
+      nfill = 0;
+      nemit = 0;
+      i  = 0;
+      m  = 0;
+      n  = 0;
+      dm = 0;
+      burst_uv_out = 0;
+    }
   }
+  stats_fifo.write(stats);
 }
 
-void write_from_fifo(
-                     int nburst_per_uv_out,
-                     int ntime_per_cu,
-                     int nburst_dm,
-                     fifo_uv &out_fifo,
-                     burst_uv *out){
+void write_stats(
+                 int nsamp_per_uv_out,
+                 int ntime_per_cu,
+                 int ndm,
+                 fifo_stats stats_fifo[NSTATS],
+                 stats_t *stats){
+  int i;
+  bool finish;
+  uint64_t ncycle;
+  int nrecord[NSTATS];
+  int count[NSTATS];
+  stats_t record;
+  stats_t total[NSTATS];
+#pragma HLS ARRAY_PARTITION variable = nrecord complete
+#pragma HLS ARRAY_PARTITION variable = count   complete
+#pragma HLS ARRAY_PARTITION variable = total   complete
+
+  // Stages send one record per call
+  nrecord[STATS_READ2FIFO]       = 1;
+  nrecord[STATS_FILL_TILE]       = 1;
+  nrecord[STATS_TRANSPOSE_TILE]  = 1;
+  nrecord[STATS_WRITE_FROM_FIFO] = 1;
+  
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS UNROLL
+    count[i] = 0;
+    total[i].active      = 0;
+    total[i].stall_empty = 0;
+    total[i].stall_full  = 0;
+    total[i].burst       = 0;
+  }
+
+  // write_stats starts with the other stages and polls once a cycle, so it counts the cycles up to the last record
+  ncycle = 0;
+  finish = false;
+ loop_collect_stats:
+  while(!finish){
+#pragma HLS PIPELINE II=1
+    ncycle++;
+    finish = true;
+    for(i = 0; i < NSTATS; i++){
+      if(count[i] < nrecord[i] && stats_fifo[i].read_nb(record)){
+        total[i].active      += record.active;
+        total[i].stall_empty += record.stall_empty;
+        total[i].stall_full  += record.stall_full;
+        total[i].burst       += record.burst;
+        count[i]++;
+      }
+      finish = finish && (count[i] == nrecord[i]);
+    }
+  }
+  
+ loop_write_stats:
+  for(i = 0; i < NSTATS; i++){
+#pragma HLS PIPELINE
+    total[i].cycle = ncycle;
+    stats[i] = total[i];
+  }
+}
+
+void mask_burst(
+                burst_uv &burst,
+                int nsamp_valid){
+#pragma HLS INLINE
+  int i;
+  
+  for(i = 0; i < NSAMP_PER_BURST; i++){
+#pragma HLS UNROLL
+    if(i >= nsamp_valid){
+      burst.data[i] = 0;
+    }
+  }
+}
+
+// Step the tile indices of the flat loops, n is the fastest and k the slowest
+void next_burst(
+                int ntran_per_uv_out,
+                int ntran_dm,
+                int &i,
+                int &j,
+                int &k,
+                int &m,
+                int &n){
+#pragma HLS INLINE
+  if(n < BURST_LENGTH-1){
+    n++;
+  }
+  else{
+    n = 0;
+    if(m < TILE_WIDTH-1){
+      m++;
+    }
+    else{
+      m = 0;
+      if(j < ntran_dm-1){
+        j++;
+      }
+      else{
+        j = 0;
+        if(i < ntran_per_uv_out-1){
+          i++;
+        }
+        else{
+          i = 0;
+          k++;
+        }
+      }
+    }
+  }
+}
+
+// Step the indices in stripe order, n is the fastest and j the slowest
+void next_stripe_burst(
+                       int ntran_per_uv_out,
+                       int ntime_per_cu,
+                       int &i,
+                       int &j,
+                       int &k,
+                       int &m,
+                       int &n){
+#pragma HLS INLINE
+  if(n < BURST_LENGTH-1){
+    n++;
+  }
+  else{
+    n = 0;
+    if(m < TILE_WIDTH-1){
+      m++;
+    }
+    else{
+      m = 0;
+      if(i < ntran_per_uv_out-1){
+        i++;
+      }
+      else{
+        i = 0;
+        if(k < ntime_per_cu-1){
+          k++;
+        }
+        else{
+          k = 0;
+          j++;
+        }
+      }
+    }
+  }
+}
+
+void stream2stage(
+                  int nburst,
+                  stream_uv &in_stream,
+                  burst_uv *stage_in){
   int i;
   int j;
-  int k;
-  int m;
-  int n;
-  int loc_burst;
-  int ntran_dm         = nburst_dm/BURST_LENGTH;
-  int ntran_per_uv_out = nburst_per_uv_out/BURST_LENGTH;
-  
-  const int mtran_per_uv_out = MBURST_PER_UV_OUT/BURST_LENGTH;
-  const int mtime_per_cu     = MTIME_PER_CU;  
-  const int mtran_dm         = MBURST_DM/BURST_LENGTH;
-  
-  for(k = 0; k < ntime_per_cu; k++){        // For Time
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtime_per_cu
-    for(i = 0; i < ntran_per_uv_out; i++){  // For UV
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_per_uv_out
-      for(j = 0; j < ntran_dm; j++){        // For DM
-#pragma HLS LOOP_TRIPCOUNT min = 1 max = mtran_dm
-        
-        // Burst out
-        for(m = 0; m < TILE_WIDTH; m++){            // For DM
-        loop_write_from_fifo:
-          for(n = 0; n < BURST_LENGTH; n++){        // For UV
+  burst_uv burst;
+  stream_t stream;
+  
+  const int mburst = MSAMP_PER_UV_OUT*MTIME_PER_CU*MBURST_DM;
+  
+ loop_stream2stage:
+  for(i = 0; i < nburst; i++){
+#pragma HLS LOOP_TRIPCOUNT min = 1 max = mburst
 #pragma HLS PIPELINE
-            loc_burst = (j*TILE_WIDTH+m)*ntime_per_cu*nburst_per_uv_out +
-              k*nburst_per_uv_out +
-              i*BURST_LENGTH +
-              n;
-            out[loc_burst] = out_fifo.read();
-          }
-        }        
-      }      
+    stream = in_stream.read();
+    for(j = 0; j < NSAMP_PER_BURST; j++){
+      burst.data[j] = stream.data(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH);
     }
+    stage_in[i] = burst;
   }
 }
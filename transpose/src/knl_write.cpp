@@ -0,0 +1,41 @@
+#include "transpose.h"
+
+// Writes transposed data from knl_transpose_axis to memory, stands for the next kernel in the test
+extern "C"{
+  void knl_write(
+                 stream_uv &out_stream,
+                 burst_uv *out,
+                 int nburst);
+}
+
+void knl_write(
+               stream_uv &out_stream,
+               burst_uv *out,
+               int nburst){
+#pragma HLS INTERFACE axis  port = out_stream
+#pragma HLS INTERFACE m_axi port = out offset = slave bundle = gmem2
+
+#pragma HLS INTERFACE s_axilite port = out    bundle = control
+#pragma HLS INTERFACE s_axilite port = nburst bundle = control
+#pragma HLS INTERFACE s_axilite port = return bundle = control
+
+#pragma HLS DATA_PACK variable = out
+  
+  const int mburst = MDM*MTIME_PER_CU*MBURST_PER_UV_OUT;
+  
+  int i;
+  int j;
+  burst_uv burst;
+  stream_t stream;
+  
+ loop_write:
+  for(i = 0; i < nburst; i++){
+#pragma HLS LOOP_TRIPCOUNT max = mburst
+#pragma HLS PIPELINE
+    stream = out_stream.read();
+    for(j = 0; j < NSAMP_PER_BURST; j++){
+      burst.data[j] = stream.data(2*(j+1)*DATA_WIDTH-1, 2*j*DATA_WIDTH);
+    }
+    out[i] = burst;
+  }
+}
@@ -7,6 +7,10 @@
 #include "transpose.h"
 #include "util_sdaccel.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 int transpose(
               uv_data_t *in,
               uv_data_t *out,
@@ -18,12 +22,14 @@ int transpose(
   int k;
   int loc_in;
   int loc_out;
+  int ndm_pitch = (ndm_per_cu + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;             // Rows are padded to whole bursts
+  int nuv_pitch = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
   
   for(i = 0; i < ntime_per_cu; i++){
     for(j = 0; j < nsamp_per_uv_out; j++){
       for(k = 0; k < ndm_per_cu; k++){
-        loc_in  = j*ntime_per_cu*ndm_per_cu + i * ndm_per_cu + k;
-        loc_out = k*nsamp_per_uv_out*ntime_per_cu + i * nsamp_per_uv_out + j;
+        loc_in  = j*ntime_per_cu*ndm_pitch + i * ndm_pitch + k;
+        loc_out = k*nuv_pitch*ntime_per_cu + i * nuv_pitch + j;
         
         out[2*loc_out]   = in[2*loc_in];
         out[2*loc_out+1] = in[2*loc_in+1];
@@ -33,3 +39,244 @@ int transpose(
   
   return EXIT_SUCCESS;
 }
+
+// Transpose an 8x8 block of complex samples, each of them is 32 bits
+static inline void transpose_8x8(
+                                 const uint32_t *src,
+                                 size_t src_stride,
+                                 uint32_t *dst,
+                                 size_t dst_stride){
+#ifdef __AVX2__
+  __m256 r0 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 0*src_stride)));
+  __m256 r1 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 1*src_stride)));
+  __m256 r2 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 2*src_stride)));
+  __m256 r3 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 3*src_stride)));
+  __m256 r4 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 4*src_stride)));
+  __m256 r5 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 5*src_stride)));
+  __m256 r6 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 6*src_stride)));
+  __m256 r7 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(src + 7*src_stride)));
+  __m256 t0;
+  __m256 t1;
+  __m256 t2;
+  __m256 t3;
+  __m256 t4;
+  __m256 t5;
+  __m256 t6;
+  __m256 t7;
+  
+  // Interleave pairs of rows, then pairs of pairs, then swap 128-bit lanes
+  // Only shuffles are used, so the bit patterns go through untouched
+  t0 = _mm256_unpacklo_ps(r0, r1);
+  t1 = _mm256_unpackhi_ps(r0, r1);
+  t2 = _mm256_unpacklo_ps(r2, r3);
+  t3 = _mm256_unpackhi_ps(r2, r3);
+  t4 = _mm256_unpacklo_ps(r4, r5);
+  t5 = _mm256_unpackhi_ps(r4, r5);
+  t6 = _mm256_unpacklo_ps(r6, r7);
+  t7 = _mm256_unpackhi_ps(r6, r7);
+  
+  r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+  
+  t0 = _mm256_permute2f128_ps(r0, r4, 0x20);
+  t1 = _mm256_permute2f128_ps(r1, r5, 0x20);
+  t2 = _mm256_permute2f128_ps(r2, r6, 0x20);
+  t3 = _mm256_permute2f128_ps(r3, r7, 0x20);
+  t4 = _mm256_permute2f128_ps(r0, r4, 0x31);
+  t5 = _mm256_permute2f128_ps(r1, r5, 0x31);
+  t6 = _mm256_permute2f128_ps(r2, r6, 0x31);
+  t7 = _mm256_permute2f128_ps(r3, r7, 0x31);
+  
+  _mm256_storeu_si256((__m256i *)(dst + 0*dst_stride), _mm256_castps_si256(t0));
+  _mm256_storeu_si256((__m256i *)(dst + 1*dst_stride), _mm256_castps_si256(t1));
+  _mm256_storeu_si256((__m256i *)(dst + 2*dst_stride), _mm256_castps_si256(t2));
+  _mm256_storeu_si256((__m256i *)(dst + 3*dst_stride), _mm256_castps_si256(t3));
+  _mm256_storeu_si256((__m256i *)(dst + 4*dst_stride), _mm256_castps_si256(t4));
+  _mm256_storeu_si256((__m256i *)(dst + 5*dst_stride), _mm256_castps_si256(t5));
+  _mm256_storeu_si256((__m256i *)(dst + 6*dst_stride), _mm256_castps_si256(t6));
+  _mm256_storeu_si256((__m256i *)(dst + 7*dst_stride), _mm256_castps_si256(t7));
+#else
+  int i;
+  int j;
+  
+  for(i = 0; i < 8; i++){
+    for(j = 0; j < 8; j++){
+      dst[j*dst_stride + i] = src[i*src_stride + j];
+    }
+  }
+#endif
+}
+
+// Blocked and multithreaded version of transpose(), same layout in and out
+// Each time is a UV x DM matrix which goes to DM x UV, it is done by CPU_TILE_WIDTH^2 tiles
+// which stay in L1 and each tile is done by 8x8 register transposes, tiles are spread across threads
+int transpose_fast(
+                   uv_data_t *in,
+                   uv_data_t *out,
+                   int nsamp_per_uv_out,
+                   int ntime_per_cu,
+                   int ndm_per_cu){
+  int i;
+  int j;
+  int k;
+  int m;
+  int n;
+  int ntile_uv = (nsamp_per_uv_out + CPU_TILE_WIDTH - 1)/CPU_TILE_WIDTH;
+  int ntile_dm = (ndm_per_cu + CPU_TILE_WIDTH - 1)/CPU_TILE_WIDTH;
+  int uv_end;
+  int dm_end;
+  int ndm_pitch = (ndm_per_cu + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
+  int nuv_pitch = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST*NSAMP_PER_BURST;
+  size_t stride_in  = (size_t)ntime_per_cu*ndm_pitch;  // Between UV samples of the input
+  size_t stride_out = (size_t)ntime_per_cu*nuv_pitch;  // Between DMs of the output
+  const uint32_t *src;
+  uint32_t *dst;
+  
+  // One complex sample is moved as one 32-bit word
+  assert(2*sizeof(uv_data_t) == sizeof(uint32_t));
+  
+#pragma omp parallel for collapse(3) private(m, n, uv_end, dm_end, src, dst) schedule(static)
+  for(i = 0; i < ntime_per_cu; i++){
+    for(j = 0; j < ntile_uv; j++){
+      for(k = 0; k < ntile_dm; k++){
+        src = (const uint32_t *)in  + (size_t)i*ndm_pitch;
+        dst = (uint32_t *)out + (size_t)i*nuv_pitch;
+        
+        uv_end = (j + 1)*CPU_TILE_WIDTH < nsamp_per_uv_out ? (j + 1)*CPU_TILE_WIDTH : nsamp_per_uv_out;
+        dm_end = (k + 1)*CPU_TILE_WIDTH < ndm_per_cu ? (k + 1)*CPU_TILE_WIDTH : ndm_per_cu;
+        
+        // Full 8x8 blocks first, the remainder of the tile sample by sample
+        for(m = j*CPU_TILE_WIDTH; m + 8 <= uv_end; m += 8){
+          for(n = k*CPU_TILE_WIDTH; n + 8 <= dm_end; n += 8){
+            transpose_8x8(&src[m*stride_in + n], stride_in, &dst[n*stride_out + m], stride_out);
+          }
+          for(; n < dm_end; n++){
+            dst[n*stride_out + m + 0] = src[(m + 0)*stride_in + n];
+            dst[n*stride_out + m + 1] = src[(m + 1)*stride_in + n];
+            dst[n*stride_out + m + 2] = src[(m + 2)*stride_in + n];
+            dst[n*stride_out + m + 3] = src[(m + 3)*stride_in + n];
+            dst[n*stride_out + m + 4] = src[(m + 4)*stride_in + n];
+            dst[n*stride_out + m + 5] = src[(m + 5)*stride_in + n];
+            dst[n*stride_out + m + 6] = src[(m + 6)*stride_in + n];
+            dst[n*stride_out + m + 7] = src[(m + 7)*stride_in + n];
+          }
+        }
+        for(; m < uv_end; m++){
+          for(n = k*CPU_TILE_WIDTH; n < dm_end; n++){
+            dst[n*stride_out + m] = src[m*stride_in + n];
+          }
+        }
+      }
+    }
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+// Stall-free counters of knl_transpose
+// Edge tiles go through the tile stages in full, but only their valid bursts reach memory
+int transpose_stats(
+                    int nsamp_per_uv_out,
+                    int ntime_per_cu,
+                    int ndm,
+                    stats_t *stats){
+  uint64_t ntran_per_uv_out  = (nsamp_per_uv_out + TILE_WIDTH - 1)/TILE_WIDTH;
+  uint64_t ntran_dm          = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  uint64_t nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  uint64_t nburst_dm         = (ndm + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  uint64_t nburst = (uint64_t)ntime_per_cu*ntran_per_uv_out*ntran_dm*TILE_WIDTH*BURST_LENGTH;
+  int i;
+  
+  // The launch takes as long as the tile engine, one step per tile and one more to drain the last one
+  for(i = 0; i < NSTATS; i++){
+    stats[i].active      = nburst;
+    stats[i].stall_empty = 0;
+    stats[i].stall_full  = 0;
+    stats[i].burst       = nburst;
+    stats[i].cycle       = nburst + TILE_WIDTH*BURST_LENGTH;
+  }
+  // The ping-pong engine has nothing to fill in the last step and nothing to drain in the first one
+  stats[STATS_FILL_TILE].stall_full       = TILE_WIDTH*BURST_LENGTH;
+  stats[STATS_TRANSPOSE_TILE].stall_empty = TILE_WIDTH*BURST_LENGTH;
+  stats[STATS_READ2FIFO].burst       = (uint64_t)ntime_per_cu*nsamp_per_uv_out*nburst_dm;
+  stats[STATS_WRITE_FROM_FIFO].burst = (uint64_t)ntime_per_cu*ndm*nburst_per_uv_out;
+  
+  return EXIT_SUCCESS;
+}
+
+// knl_transpose_axis has the same stages, but the stripe sends the last stripe after the tile engine is done
+// ndm is the DMs of the block the launch drains, 0 for the first launch, which only fills a stage buffer
+// and runs the tile engine and the stripe for one empty step
+// Staging the next block runs next to them and has no counters
+int transpose_axis_stats(
+                         int nsamp_per_uv_out,
+                         int ntime_per_cu,
+                         int ndm,
+                         stats_t *stats){
+  uint64_t ntran_dm          = (ndm + TILE_WIDTH - 1)/TILE_WIDTH;
+  uint64_t nburst_per_uv_out = (nsamp_per_uv_out + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST;
+  uint64_t nburst_last;
+  int i;
+  
+  if(ndm == 0){
+    memset(stats, 0x00, NSTATS*sizeof(stats_t));
+    for(i = 0; i < NSTATS; i++){
+      stats[i].cycle = 1;
+    }
+    stats[STATS_FILL_TILE].stall_full       = 1;
+    stats[STATS_TRANSPOSE_TILE].stall_empty = 1;
+    stats[STATS_WRITE_FROM_FIFO].stall_full = 1;
+    return EXIT_SUCCESS;
+  }
+  
+  nburst_last = (ndm - (ntran_dm - 1)*TILE_WIDTH)*nburst_per_uv_out;
+  transpose_stats(nsamp_per_uv_out, ntime_per_cu, ndm, stats);
+  for(i = 0; i < NSTATS; i++){
+    stats[i].cycle += nburst_last;
+  }
+  stats[STATS_WRITE_FROM_FIFO].stall_full = nburst_last;
+  
+  return EXIT_SUCCESS;
+}
+
+// Sum up the counters of several CUs
+int add_stats(
+              stats_t *total,
+              stats_t *stats,
+              int nstats){
+  int i;
+  
+  for(i = 0; i < nstats; i++){
+    total[i].active      += stats[i].active;
+    total[i].stall_empty += stats[i].stall_empty;
+    total[i].stall_full  += stats[i].stall_full;
+    total[i].burst       += stats[i].burst;
+    total[i].cycle       += stats[i].cycle;
+  }
+  
+  return EXIT_SUCCESS;
+}
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats){
+  int i;
+  
+  fprintf(stdout, "INFO: %s\n", title);
+  fprintf(stdout, "INFO: %-16s %14s %14s %14s %14s %14s %12s\n", "stage", "active", "stall_empty", "stall_full", "burst", "cycle", "utilisation");
+  for(i = 0; i < nstats; i++){
+    fprintf(stdout, "INFO: %-16s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %11.1f%%\n",
+            stage[i], stats[i].active, stats[i].stall_empty, stats[i].stall_full, stats[i].burst, stats[i].cycle,
+            stats[i].cycle ? 100.0*stats[i].active/stats[i].cycle : 0.0);
+  }
+  
+  return EXIT_SUCCESS;
+}
@@ -15,6 +15,8 @@
 #include <ap_int.h>
 #include <assert.h>
 #include <hls_stream.h>
+#include <inttypes.h>
+#include "ap_axi_sdata.h"
 
 #define BURST_LENGTH        16
 #define FLOAT     1
@@ -28,9 +30,22 @@
 #define MBURST_DM       (MDM/NSAMP_PER_BURST)
 
 #define MSAMP_PER_UV_IN     4368
-#define MSAMP_PER_UV_OUT    3552     // 3567 round to 16, the number is not certain
+#define MSAMP_PER_UV_OUT    3567     // Does not have to be a multiple of TILE_WIDTH, edge tiles are masked
 #define MTIME_PER_CU        256
-#define MBURST_PER_UV_OUT   (MSAMP_PER_UV_OUT/NSAMP_PER_BURST)
+#define MBURST_PER_UV_OUT   ((MSAMP_PER_UV_OUT + NSAMP_PER_BURST - 1)/NSAMP_PER_BURST) // Rows are padded to whole bursts
+#define MTRAN_PER_UV_OUT    ((MSAMP_PER_UV_OUT + TILE_WIDTH - 1)/TILE_WIDTH)
+#define MTRAN_DM            ((MDM + TILE_WIDTH - 1)/TILE_WIDTH)
+#define MBURST_PER_STRIPE_ROW (MTRAN_PER_UV_OUT*BURST_LENGTH) // A DM row of the on-chip stripe of knl_transpose_axis, edge tile included
+#define MBURST_PER_STRIPE   (TILE_WIDTH*MBURST_PER_STRIPE_ROW)
+
+#define NCU                 4        // CUs of knl_transpose, each one has its own HBM pseudo-channels
+#define FIFO_DEPTH          (2*BURST_LENGTH) // Two memory bursts, the ping-pong tile engine does not need a tile of slack
+
+// What a launch of knl_transpose_axis does with its two stage buffers
+#define STAGE_FILL          1        // Stream a block into stage_fill
+#define STAGE_DRAIN         2        // Transpose the block in stage_drain to the output stream
+
+#define CPU_TILE_WIDTH      64       // Tile of transpose_fast, 64x64 complex samples are 16 KB and stay in L1
 
 #define COORD_WIDTH1   16       // Wider than the required width, but to 2^n
 #define COORD_WIDTH2   13       // Wide enough to cover the input index range
@@ -81,9 +96,61 @@ typedef struct burst_uv{
 
 typedef hls::stream<burst_uv> fifo_uv;
 
+typedef ap_axiu<BURST_WIDTH, 0, 0, 0> stream_t; 
+typedef hls::stream<stream_t> stream_uv; // Same as the output of knl_grid
+typedef ap_uint<BURST_WIDTH> stripe_burst_t; // A burst as one word, so a stripe maps to URAM rows
+
+// Performance counters of one dataflow stage, in iterations of its pipelined loop, which are cycles only at II=1
+typedef struct stats_t{
+  uint64_t active;      // Iterations which move data
+  uint64_t stall_empty; // Iterations waiting on an empty input FIFO
+  uint64_t stall_full;  // Iterations waiting on a full output FIFO
+  uint64_t burst;       // Bursts moved by the stage
+  uint64_t cycle;       // Cycles of the launch, counted by write_stats and the same for all stages
+}stats_t;
+
+typedef hls::stream<stats_t> fifo_stats;
+
+// Stages with counters, also the order of them in the stats buffer
+#define STATS_READ2FIFO        0
+#define STATS_FILL_TILE        1
+#define STATS_TRANSPOSE_TILE   2
+#define STATS_WRITE_FROM_FIFO  3
+#define NSTATS                 4
+
 int transpose(
               uv_data_t *in,
               uv_data_t *out,
               int nsamp_per_uv_out,
               int ntime_per_cu,
               int ndm_per_cu);
+
+int transpose_fast(
+                   uv_data_t *in,
+                   uv_data_t *out,
+                   int nsamp_per_uv_out,
+                   int ntime_per_cu,
+                   int ndm_per_cu);
+
+int transpose_stats(
+                    int nsamp_per_uv_out,
+                    int ntime_per_cu,
+                    int ndm,
+                    stats_t *stats);
+
+int transpose_axis_stats(
+                         int nsamp_per_uv_out,
+                         int ntime_per_cu,
+                         int ndm,
+                         stats_t *stats);
+
+int add_stats(
+              stats_t *total,
+              stats_t *stats,
+              int nstats);
+
+int print_stats(
+                const char *title,
+                const char *stage[],
+                stats_t *stats,
+                int nstats);